@@ -0,0 +1,484 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+#include "histogram.h"
+#include "level_hashing.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/*  Benchmark:
+    This is a single-threaded latency benchmark for the Level hashing variants. The variant is chosen at
+    compile time by BENCH_LEVEL, BENCH_CONCURRENT or BENCH_PERSISTENT (see the makefile). Every operation is
+    timed on its own and recorded in a latency histogram, so that the pauses of expanding show up in the
+    tail latencies instead of being averaged away.
+
+    The load phase inserts items until the target number of items or the target load factor is reached; the
+    run phase then issues the operation mix, picking the keys of searches, updates and deletions from the
+    loaded items by the chosen key distribution.
+*/
+
+#define BENCH_ZIPF_THETA 0.99             // The skewness of the zipfian distribution, as in YCSB
+#define BENCH_CALIBRATE_NS 100000000      // The time to calibrate the TSC against the monotonic clock
+
+enum { OP_INSERT, OP_SEARCH, OP_UPDATE, OP_DELETE, OP_NUM };
+static const char *op_names[OP_NUM] = {"insert", "search", "update", "delete"};
+
+enum { DIST_SEQUENTIAL, DIST_UNIFORM, DIST_ZIPFIAN };
+static const char *dist_names[] = {"sequential", "uniform", "zipfian"};
+
+enum { FORMAT_TEXT, FORMAT_CSV, FORMAT_JSON };
+
+/*  The variant adapters:
+    Each adapter maps the benchmark operations onto the API of one variant; an operation returns 0 if
+    it hits and 1 otherwise. An insertion which fails for a full table expands and retries within the
+    timed operation.
+*/
+#if defined(BENCH_CONCURRENT)
+
+#define BENCH_VARIANT "concurrent_level_hashing"
+static level_hash *level;
+static uint8_t query_value[VALUE_LEN];
+
+static void bench_init(uint64_t level_size, int write_latency)
+{
+    level = level_init(level_size, 1);
+}
+
+static uint64_t bench_slot_num()
+{
+    return level->total_capacity*ASSOC_NUM;
+}
+
+static double bench_max_load_factor()
+{
+    return 1;
+}
+
+static uint8_t bench_insert(uint8_t *key)
+{
+    return level_insert(level, key, key, 0);
+}
+
+static uint8_t bench_search(uint8_t *key)
+{
+    return level_query(level, key, query_value, 0);
+}
+
+static uint8_t bench_update(uint8_t *key)
+{
+    return level_update(level, key, key, 0);
+}
+
+static uint8_t bench_delete(uint8_t *key)
+{
+    return level_delete(level, key, 0);
+}
+
+#elif defined(BENCH_PERSISTENT)
+
+#include "pflush.h"
+#define BENCH_VARIANT "persistent_level_hashing"
+static level_hash *level;
+
+static void bench_init(uint64_t level_size, int write_latency)
+{
+    init_pflush(2000, write_latency);
+    level = level_init(level_size);
+}
+
+static uint64_t bench_slot_num()
+{
+    return level->total_capacity*ASSOC_NUM;
+}
+
+static double bench_max_load_factor()
+{
+    return 1;
+}
+
+static uint8_t bench_insert(uint8_t *key)
+{
+    while (level_insert(level, key, key))
+        level_expand(level);
+    return 0;
+}
+
+static uint8_t bench_search(uint8_t *key)
+{
+    return level_static_query(level, key) == NULL;
+}
+
+static uint8_t bench_update(uint8_t *key)
+{
+    return level_update(level, key, key);
+}
+
+static uint8_t bench_delete(uint8_t *key)
+{
+    return level_delete(level, key);
+}
+
+#else
+
+#define BENCH_VARIANT "level_hashing"
+static level_hash *level;
+
+static void bench_init(uint64_t level_size, int write_latency)
+{
+    level = level_init(level_size);
+}
+
+static uint64_t bench_slot_num()
+{
+    return level->total_capacity*ASSOC_NUM;
+}
+
+static double bench_max_load_factor()
+{
+    return level->auto_resize ? level->expand_load_factor : 1;
+}
+
+static uint8_t bench_insert(level_key_t key)
+{
+    while (level_insert(level, key, key))
+        level_expand(level);
+    return 0;
+}
+
+static uint8_t bench_search(level_key_t key)
+{
+    return level_static_query(level, key) == NULL;
+}
+
+static uint8_t bench_update(level_key_t key)
+{
+    return level_update(level, key, key);
+}
+
+static uint8_t bench_delete(level_key_t key)
+{
+    return level_delete(level, key);
+}
+
+#endif
+
+#if defined(BENCH_LEVEL) && defined(LEVEL_INTEGER_KEY)
+typedef uint64_t bench_key_t;
+#define BENCH_KEY(buf, id) (id)
+#else
+typedef uint8_t bench_key_t[KEY_LEN];
+#define BENCH_KEY(buf, id) (snprintf((char *)(buf), KEY_LEN, "%lu", (unsigned long)(id) + 1), (buf))
+#endif
+
+static uint64_t rand_state = 88172645463325252UL;
+
+/*
+Function: bench_rand()
+        Return a 64-bit xorshift* random number
+*/
+static inline uint64_t bench_rand()
+{
+    rand_state ^= rand_state >> 12;
+    rand_state ^= rand_state << 25;
+    rand_state ^= rand_state >> 27;
+    return rand_state * 2685821657736338717UL;
+}
+
+static inline double bench_rand_double()
+{
+    return (bench_rand() >> 11) * (1.0 / (1UL << 53));
+}
+
+typedef struct zipfian{                   // The zipfian generator of YCSB (Gray et al., "Quickly generating billion-record synthetic databases")
+    uint64_t n;
+    double theta;
+    double alpha;
+    double zetan;
+    double eta;
+    double half_pow_theta;
+} zipfian;
+
+static void zipfian_init(zipfian *zipf, uint64_t n, double theta)
+{
+    uint64_t i;
+    double zeta2 = 1 + pow(0.5, theta);
+
+    zipf->n = n;
+    zipf->theta = theta;
+    zipf->alpha = 1 / (1 - theta);
+    zipf->zetan = 0;
+    for (i = 1; i <= n; i ++)
+        zipf->zetan += 1 / pow((double)i, theta);
+    zipf->eta = (1 - pow(2.0 / n, 1 - theta)) / (1 - zeta2 / zipf->zetan);
+    zipf->half_pow_theta = pow(0.5, theta);
+}
+
+/*
+Function: zipfian_next()
+        Return a rank in [0, n); the ranks are scattered over the key space by a hash, so that the hot
+        keys are not neighbours
+*/
+static uint64_t zipfian_next(zipfian *zipf)
+{
+    double u = bench_rand_double();
+    double uz = u * zipf->zetan;
+    uint64_t rank;
+
+    if (uz < 1)
+        rank = 0;
+    else if (uz < 1 + zipf->half_pow_theta)
+        rank = 1;
+    else
+        rank = (uint64_t)(zipf->n * pow(zipf->eta * u - zipf->eta + 1, zipf->alpha));
+    if (rank >= zipf->n)
+        rank = zipf->n - 1;
+
+    rank = (rank ^ (rank >> 33)) * 0xff51afd7ed558ccdUL;
+    rank = (rank ^ (rank >> 33)) * 0xc4ceb9fe1a85ec53UL;
+    return (rank ^ (rank >> 33)) % zipf->n;
+}
+
+static int use_tsc = 0;
+static double tsc_ns_per_tick = 1;
+
+static inline uint64_t clock_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/*
+Function: bench_now()
+        Return the current time stamp, in TSC ticks when the TSC is used and in nanoseconds otherwise
+*/
+static inline uint64_t bench_now()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (use_tsc)
+        return __rdtsc();
+#endif
+    return clock_ns();
+}
+
+static inline uint64_t bench_ns(uint64_t elapsed)
+{
+    return use_tsc ? (uint64_t)(elapsed * tsc_ns_per_tick) : elapsed;
+}
+
+static void tsc_calibrate()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    uint64_t start_ns = clock_ns(), start_tick = __rdtsc(), end_ns;
+    while ((end_ns = clock_ns()) - start_ns < BENCH_CALIBRATE_NS)
+        ;
+    tsc_ns_per_tick = (double)(end_ns - start_ns) / (__rdtsc() - start_tick);
+#else
+    printf("The TSC is not available on this architecture!\n");
+    exit(1);
+#endif
+}
+
+typedef struct bench_result{
+    histogram hist[OP_NUM];
+    uint64_t miss[OP_NUM];
+    uint64_t item_num;                    // The number of items in the hash table, counted by the benchmark since not every variant keeps it
+    uint64_t time_ns;                     // The wall-clock time of the phase
+} bench_result;
+
+static inline void bench_op(bench_result *result, int op, uint64_t id)
+{
+    bench_key_t buf;
+    uint8_t ret = 0;
+    uint64_t start;
+
+#if defined(BENCH_LEVEL) && defined(LEVEL_INTEGER_KEY)
+    level_key_t key = BENCH_KEY(buf, id);
+#else
+    uint8_t *key = BENCH_KEY(buf, id);
+#endif
+
+    start = bench_now();
+    switch (op) {
+    case OP_INSERT: ret = bench_insert(key); break;
+    case OP_SEARCH: ret = bench_search(key); break;
+    case OP_UPDATE: ret = bench_update(key); break;
+    case OP_DELETE: ret = bench_delete(key); break;
+    }
+    hist_record(&result->hist[op], bench_ns(bench_now() - start));
+    result->miss[op] += ret;
+    if (!ret && op == OP_INSERT)
+        result->item_num ++;
+    else if (!ret && op == OP_DELETE)
+        result->item_num --;
+}
+
+static void print_result(int format, const char *phase, bench_result *result, int *first)
+{
+    int op;
+    for (op = 0; op < OP_NUM; op ++) {
+        histogram *hist = &result->hist[op];
+        if (hist->total == 0)
+            continue;
+
+        double mops = (double)hist->total / (result->time_ns / 1000.0);
+        uint64_t p50 = hist_percentile(hist, 50), p99 = hist_percentile(hist, 99);
+        uint64_t p999 = hist_percentile(hist, 99.9);
+
+        if (format == FORMAT_CSV)
+            printf("%s,%s,%s,%lu,%lu,%.1f,%lu,%lu,%lu,%lu,%.3f\n", BENCH_VARIANT, phase, op_names[op],
+                hist->total, result->miss[op], hist_mean(hist), p50, p99, p999, hist->max, mops);
+        else if (format == FORMAT_JSON)
+        {
+            printf("%s\n  {\"variant\": \"%s\", \"phase\": \"%s\", \"op\": \"%s\", \"count\": %lu, \"miss\": %lu, "
+                "\"mean_ns\": %.1f, \"p50_ns\": %lu, \"p99_ns\": %lu, \"p999_ns\": %lu, \"max_ns\": %lu, \"mops\": %.3f}",
+                *first ? "" : ",", BENCH_VARIANT, phase, op_names[op], hist->total, result->miss[op],
+                hist_mean(hist), p50, p99, p999, hist->max, mops);
+            *first = 0;
+        }else
+            printf("%-6s %-7s %10lu %8lu %9.1f %8lu %8lu %8lu %10lu %8.3f\n", phase, op_names[op], hist->total,
+                result->miss[op], hist_mean(hist), p50, p99, p999, hist->max, mops);
+    }
+}
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s [options]\n"
+        "  -s level_size   the number of addressable buckets is 2^level_size (default 10)\n"
+        "  -n items        the number of items to load (default 1000000)\n"
+        "  -l load_factor  load until this load factor is reached instead of loading -n items\n"
+        "  -o ops          the number of operations in the run phase (default 1000000)\n"
+        "  -m S:U:I:D      the percentages of searches, updates, insertions and deletions (default 100:0:0:0)\n"
+        "  -d dist         the key distribution: sequential, uniform or zipfian (default uniform)\n"
+        "  -z theta        the skewness of the zipfian distribution (default %.2f)\n"
+        "  -f format       the output format: text, csv or json (default text)\n"
+        "  -t timer        the timer: clock or tsc (default clock)\n"
+        "  -r seed         the random seed\n"
+        "  -w latency      the emulated NVM write latency in ns (persistent_level_hashing only)\n",
+        prog, BENCH_ZIPF_THETA);
+    exit(1);
+}
+
+int main(int argc, char* argv[])
+{
+    uint64_t level_size = 10, load_num = 1000000, op_num = 1000000;
+    double load_factor = 0, theta = BENCH_ZIPF_THETA;
+    int mix[OP_NUM] = {0, 100, 0, 0};
+    int dist = DIST_UNIFORM, format = FORMAT_TEXT, write_latency = 0;
+    int opt, i;
+
+    while ((opt = getopt(argc, argv, "s:n:l:o:m:d:z:f:t:r:w:h")) != -1) {
+        switch (opt) {
+        case 's': level_size = strtoull(optarg, NULL, 10); break;
+        case 'n': load_num = strtoull(optarg, NULL, 10); break;
+        case 'l': load_factor = atof(optarg); break;
+        case 'o': op_num = strtoull(optarg, NULL, 10); break;
+        case 'm':
+            if (sscanf(optarg, "%d:%d:%d:%d", &mix[OP_SEARCH], &mix[OP_UPDATE], &mix[OP_INSERT], &mix[OP_DELETE]) != 4)
+                usage(argv[0]);
+            break;
+        case 'd':
+            for (dist = 0; dist < 3 && strcmp(optarg, dist_names[dist]); dist ++)
+                ;
+            if (dist == 3)
+                usage(argv[0]);
+            break;
+        case 'z': theta = atof(optarg); break;
+        case 'f':
+            if (!strcmp(optarg, "csv"))
+                format = FORMAT_CSV;
+            else if (!strcmp(optarg, "json"))
+                format = FORMAT_JSON;
+            else if (strcmp(optarg, "text"))
+                usage(argv[0]);
+            break;
+        case 't':
+            if (!strcmp(optarg, "tsc"))
+                use_tsc = 1;
+            else if (strcmp(optarg, "clock"))
+                usage(argv[0]);
+            break;
+        case 'r': rand_state = strtoull(optarg, NULL, 10) | 1; break;
+        case 'w': write_latency = atoi(optarg); break;
+        default: usage(argv[0]);
+        }
+    }
+    if (mix[OP_SEARCH] + mix[OP_UPDATE] + mix[OP_INSERT] + mix[OP_DELETE] != 100)
+    {
+        printf("The percentages of the operation mix must add up to 100!\n");
+        exit(1);
+    }
+    if (use_tsc)
+        tsc_calibrate();
+
+    bench_init(level_size, write_latency);
+    if (load_factor >= bench_max_load_factor())
+    {
+        printf("The target load factor must be below %f!\n", bench_max_load_factor());
+        exit(1);
+    }
+
+    static bench_result load, run;
+    uint64_t loaded = 0, start;
+
+    for (i = 0; i < OP_NUM; i ++) {
+        hist_init(&load.hist[i]);
+        hist_init(&run.hist[i]);
+    }
+
+    start = clock_ns();
+    while (load_factor > 0 ? (double)load.item_num / bench_slot_num() < load_factor : loaded < load_num) {
+        bench_op(&load, OP_INSERT, loaded);
+        loaded ++;
+    }
+    load.time_ns = clock_ns() - start;
+
+    zipfian zipf = {0};                   // Only set up for the zipfian distribution
+    if (dist == DIST_ZIPFIAN && loaded > 0)
+        zipfian_init(&zipf, loaded, theta);
+
+    uint64_t next_id = loaded, seq = 0, n;
+    start = clock_ns();
+    for (n = 0; n < op_num; n ++) {
+        int op, pick = bench_rand() % 100;
+        for (op = 0; op < OP_NUM - 1 && pick >= mix[op]; op ++)
+            pick -= mix[op];
+
+        uint64_t id;
+        if (op == OP_INSERT || loaded == 0)
+            id = next_id ++;
+        else if (dist == DIST_SEQUENTIAL)
+            id = seq ++ % loaded;
+        else if (dist == DIST_UNIFORM)
+            id = bench_rand() % loaded;
+        else
+            id = zipfian_next(&zipf);
+        bench_op(&run, op, id);
+    }
+    run.time_ns = clock_ns() - start;
+    run.item_num += load.item_num;
+
+    int first = 1;
+    if (format == FORMAT_CSV)
+        printf("variant,phase,op,count,miss,mean_ns,p50_ns,p99_ns,p999_ns,max_ns,mops\n");
+    else if (format == FORMAT_JSON)
+        printf("[");
+    else
+    {
+        printf("%s: %lu items loaded, load factor %f, %s keys, timer %s\n", BENCH_VARIANT, loaded,
+            (double)run.item_num / bench_slot_num(), dist_names[dist], use_tsc ? "tsc" : "clock");
+        printf("%-6s %-7s %10s %8s %9s %8s %8s %8s %10s %8s\n", "phase", "op", "count", "miss", "mean_ns",
+            "p50_ns", "p99_ns", "p99.9_ns", "max_ns", "Mops");
+    }
+    print_result(format, "load", &load, &first);
+    print_result(format, "run", &run, &first);
+    if (format == FORMAT_JSON)
+        printf("\n]\n");
+
+    level_destroy(level);
+    return 0;
+}
@@ -0,0 +1,87 @@
+#include <string.h>
+#include "histogram.h"
+
+/*
+Function: hist_index() 
+        Map a value to its bucket: values below 2^HIST_SUB_BITS have a bucket each, and every 
+        larger power of two is split into 2^HIST_SUB_BITS buckets of equal width
+*/
+static inline uint64_t hist_index(uint64_t value)
+{
+    if (value < (1UL << HIST_SUB_BITS))
+        return value;
+    uint64_t shift = 63 - __builtin_clzl(value) - HIST_SUB_BITS;
+    return ((shift + 1) << HIST_SUB_BITS) + (value >> shift) - (1UL << HIST_SUB_BITS);
+}
+
+/*
+Function: hist_value() 
+        Return the middle value of a bucket
+*/
+static inline uint64_t hist_value(uint64_t idx)
+{
+    if (idx < (1UL << HIST_SUB_BITS))
+        return idx;
+    uint64_t shift = (idx >> HIST_SUB_BITS) - 1;
+    uint64_t sub = idx & ((1UL << HIST_SUB_BITS) - 1);
+    return (((1UL << HIST_SUB_BITS) + sub) << shift) + ((1UL << shift) >> 1);
+}
+
+/*
+Function: hist_init() 
+        Clear a histogram
+*/
+void hist_init(histogram *hist)
+{
+    memset(hist, 0, sizeof(histogram));
+}
+
+/*
+Function: hist_record() 
+        Record a value in a histogram
+*/
+void hist_record(histogram *hist, uint64_t value)
+{
+    hist->counts[hist_index(value)] ++;
+    hist->total ++;
+    hist->sum += value;
+    if (value > hist->max)
+        hist->max = value;
+}
+
+/*
+Function: hist_percentile() 
+        Return the value below which the given percentile (0-100) of the recorded values fall;
+        The exact maximum is returned for the 100th percentile
+*/
+uint64_t hist_percentile(histogram *hist, double percentile)
+{
+    if (hist->total == 0)
+        return 0;
+    if (percentile >= 100)
+        return hist->max;
+
+    uint64_t rank = (uint64_t)(percentile / 100 * hist->total);
+    if (rank == 0)
+        rank = 1;
+
+    uint64_t idx, seen = 0;
+    for (idx = 0; idx < HIST_BUCKET_NUM; idx ++) {
+        seen += hist->counts[idx];
+        if (seen >= rank)
+        {
+            uint64_t value = hist_value(idx);
+            return value > hist->max ? hist->max : value;
+        }
+    }
+    return hist->max;
+}
+
+/*
+Function: hist_mean() 
+        Return the mean of the recorded values
+*/
+double hist_mean(histogram *hist)
+{
+    return hist->total ? hist->sum / hist->total : 0;
+}
@@ -0,0 +1,19 @@
+#include <stdint.h>
+
+#define HIST_SUB_BITS 6                   // Each power of two is split into 2^HIST_SUB_BITS buckets, so a recorded value is off by less than 1/64
+#define HIST_BUCKET_NUM ((64 - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+
+typedef struct histogram{                 // A log-linear latency histogram in the style of HdrHistogram
+    uint64_t counts[HIST_BUCKET_NUM];
+    uint64_t total;                       // The number of recorded values
+    uint64_t max;
+    double sum;
+} histogram;
+
+void hist_init(histogram *hist);
+
+void hist_record(histogram *hist, uint64_t value);
+
+uint64_t hist_percentile(histogram *hist, double percentile);
+
+double hist_mean(histogram *hist);
@@ -1,4 +1,64 @@
 #include "level_hashing.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Count an event of a lookup or an insertion in the statistics of the thread
+#ifdef LEVEL_STATS
+#define LEVEL_STATS_ADD(level, thread_id, counter) ((level)->thread_stats[thread_id].stats.counter ++)
+#else
+#define LEVEL_STATS_ADD(level, thread_id, counter) ((void)0)
+#endif
+
+/*
+Function: level_time_ns()
+        Read the monotonic clock in nanoseconds, to time the resizings
+*/
+static inline uint64_t level_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// The bytes of the slot locks of a bucket kept in the lock arrays, which are not allocated with LEVEL_BUCKET_LOCK
+#ifdef LEVEL_BUCKET_LOCK
+#define LEVEL_LOCKS_SIZE 0
+#define LEVEL_LOCKS_ALLOCATED(level) 1
+#define LEVEL_LOCKS_OF(level, i) NULL
+#else
+#define LEVEL_LOCKS_SIZE sizeof(level_locks)
+#define LEVEL_LOCKS_ALLOCATED(level) ((level)->level_locks[0] && (level)->level_locks[1])
+#define LEVEL_LOCKS_OF(level, i) ((level)->level_locks[i])
+#endif
+
+// The number of bytes a key is hashed over: all KEY_LEN bytes of a binary key, or the bytes before the terminator
+#ifdef LEVEL_BINARY_KEY
+#define LEVEL_KEY_LENGTH(key) KEY_LEN
+#else
+#define LEVEL_KEY_LENGTH(key) strlen((const char *)(key))
+#endif
+
+/*
+Function: level_key_equal()
+        Compare two keys, reading at most KEY_LEN bytes of each; A binary key is compared as one 16-byte 
+        block with a single SSE2 compare
+*/
+static inline int level_key_equal(const uint8_t *a, const uint8_t *b)
+{
+#if defined(LEVEL_BINARY_KEY) && defined(__SSE2__)
+    __m128i diff = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)a), _mm_loadu_si128((const __m128i *)b));
+    return _mm_movemask_epi8(diff) == 0xffff;
+#elif defined(LEVEL_BINARY_KEY)
+    return memcmp(a, b, KEY_LEN) == 0;
+#else
+    return strncmp((const char *)a, (const char *)b, KEY_LEN) == 0;
+#endif
+}
 
 /*
 Function: F_HASH()
@@ -6,7 +66,7 @@ Function: F_HASH()
 */
 uint64_t F_HASH(level_hash *level, const uint8_t *key)
 {
-    return (hash((void *)key, strlen(key), level->f_seed));
+    return (hash((void *)key, LEVEL_KEY_LENGTH(key), level->f_seed));
 }
 
 /*
@@ -15,7 +75,7 @@ Function: S_HASH()
 */
 uint64_t S_HASH(level_hash *level, const uint8_t *key)
 {
-    return (hash((void *)key, strlen(key), level->s_seed));
+    return (hash((void *)key, LEVEL_KEY_LENGTH(key), level->s_seed));
 }
 
 /*
@@ -76,17 +136,32 @@ void barrier_cross(barrier *b,void (*expand_func)(),level_hash* level, int threa
     pthread_mutex_unlock(&b->mutex);
 }
 /*
-Function: level_init()
-        Initialize a level hash table
+Function: level_block_alloc()
+        Allocate a bucket, lock or counter array with the allocator of the hash table;
+        The block is cleared here unless the allocator returns zeroed memory
 */
-level_hash *level_init(uint64_t level_size, size_t num_threads)
+static void *level_block_alloc(level_hash *level, uint64_t size)
+{
+    level_allocator *allocator = &level->allocator;
+    uint64_t alignment = allocator->alignment > __alignof__(level_thread_stats) ? allocator->alignment : __alignof__(level_thread_stats);
+    void *addr = allocator->alloc(allocator->ctx, size, alignment);
+    if (addr && !allocator->zeroed)
+        memset(addr, 0, size);
+    return addr;
+}
+
+static inline void level_block_free(level_hash *level, void *addr, uint64_t size)
+{
+    level->allocator.free(level->allocator.ctx, addr, size);
+}
+
+/*
+Function: level_init_state()
+        Set the sizes and the state of an empty level hash table and allocate its locks and the counters 
+        of the threads, but not its buckets or seeds
+*/
+static void level_init_state(level_hash *level, uint64_t level_size, size_t num_threads)
 {
-    level_hash *level = malloc(sizeof(level_hash));
-    if (!level)
-    {
-        printf("The level hash table initialization fails:1\n");
-        exit(1);
-    }
     level->thread_num = num_threads;
     //pthread_barrier_init(&level->resize_barrier, NULL, num_threads);
     barrier_init(&level->resize_barrier,num_threads);
@@ -94,33 +169,1068 @@ level_hash *level_init(uint64_t level_size, size_t num_threads)
     level->level_size = level_size;
     level->addr_capacity = pow(2, level_size);
     level->total_capacity = pow(2, level_size) + pow(2, level_size - 1);
-    level->buckets[0] = calloc(pow(2, level_size), sizeof(level_bucket));
-    level->buckets[1] = calloc(pow(2, level_size - 1), sizeof(level_bucket));
-    level->level_locks[0] = calloc(pow(2, level_size), sizeof(level_locks));
-    level->level_locks[1] = calloc(pow(2, level_size - 1), sizeof(level_locks));
+#ifndef LEVEL_BUCKET_LOCK
+    level->level_locks[0] = level_block_alloc(level, pow(2, level_size) * sizeof(level_locks));
+    level->level_locks[1] = level_block_alloc(level, pow(2, level_size - 1) * sizeof(level_locks));
+#endif
+    level->level_resize = 0;
+    level->iter_num = 0;
+    level->mover_num = 0;
+    level->retired = NULL;
+    memset(&level->stats, 0, sizeof(level_stats));
+    level->thread_stats = level_block_alloc(level, num_threads * sizeof(level_thread_stats));
+#ifdef LEVEL_ONLINE_RESIZE
+    level->interim_level_buckets = NULL;
+    level->interim_bucket_num = 0;
+    level->migrate_cursor = 0;
+    level->migrate_done = 0;
+    level->resize_begin = 0;
+    level->table_seq = 0;
+    level->resize_lock = SPINLOCK_INITIALIZER;
+    level->epoch = 1;                     // 0 marks a thread outside operations
+#endif
+}
 
+/*
+Function: level_init_with()
+        Initialize a level hash table whose buckets and locks are allocated by an allocator,
+        or by level_alloc() following a policy if the allocator is NULL
+*/
+static level_hash *level_init_with(uint64_t level_size, size_t num_threads, const level_alloc_policy *policy, 
+    const level_allocator *allocator)
+{
+    level_hash *level = malloc(sizeof(level_hash));
+    if (!level)
+    {
+        printf("The level hash table initialization fails:1\n");
+        exit(1);
+    }
+    if (policy)
+        level->alloc_policy = *policy;
+    else
+        memset(&level->alloc_policy, 0, sizeof(level_alloc_policy));
+    if (allocator)
+        level->allocator = *allocator;
+    else
+        level_allocator_policy(&level->allocator, &level->alloc_policy);
+    if (!level->allocator.alloc || !level->allocator.free)
+    {
+        printf("The level hash table initialization fails:3\n");
+        exit(1);
+    }
+    level_init_state(level, level_size, num_threads);
+    level->buckets[0] = level_block_alloc(level, pow(2, level_size) * sizeof(level_bucket));
+    level->buckets[1] = level_block_alloc(level, pow(2, level_size - 1) * sizeof(level_bucket));
     generate_seeds(level);
-    level->level_resize = 0;
 
-    if (!level->buckets[0] || !level->buckets[1])
+    if (!level->buckets[0] || !level->buckets[1] || !LEVEL_LOCKS_ALLOCATED(level) || !level->thread_stats)
     {
         printf("The level hash table initialization fails:2\n");
         exit(1);
     }
-
-    printf("Level hashing: ASSOC_NUM %d, KEY_LEN %d, VALUE_LEN %d \n", ASSOC_NUM, KEY_LEN, VALUE_LEN);
-    printf("The number of top-level buckets: %ld\n", level->addr_capacity);
-    printf("The number of all buckets: %ld\n", level->total_capacity);
-    printf("The number of all entries: %ld\n", level->total_capacity * ASSOC_NUM);
-    printf("The level hash table initialization succeeds!\n");
-    return level;
+
+    printf("Level hashing: ASSOC_NUM %d, KEY_LEN %d, VALUE_LEN %d \n", ASSOC_NUM, KEY_LEN, VALUE_LEN);
+    printf("The number of top-level buckets: %ld\n", level->addr_capacity);
+    printf("The number of all buckets: %ld\n", level->total_capacity);
+    printf("The number of all entries: %ld\n", level->total_capacity * ASSOC_NUM);
+    printf("The level hash table initialization succeeds!\n");
+    return level;
+}
+
+/*
+Function: level_init()
+        Initialize a level hash table
+*/
+level_hash *level_init(uint64_t level_size, size_t num_threads)
+{
+    return level_init_policy(level_size, num_threads, NULL);
+}
+
+/*
+Function: level_init_policy()
+        Initialize a level hash table whose buckets and locks are allocated following an allocation policy;
+        A NULL policy means base pages placed on the node of the thread first touching them
+*/
+level_hash *level_init_policy(uint64_t level_size, size_t num_threads, const level_alloc_policy *policy)
+{
+    return level_init_with(level_size, num_threads, policy, NULL);
+}
+
+/*
+Function: level_init_ex()
+        Initialize a level hash table whose buckets, locks and counters are allocated and freed by a given 
+        allocator, which also takes back the old levels after each resizing, e.g., to recycle them;
+        A NULL allocator means level_alloc() with the default policy
+*/
+level_hash *level_init_ex(uint64_t level_size, size_t num_threads, const level_allocator *allocator)
+{
+    return level_init_with(level_size, num_threads, NULL, allocator);
+}
+
+/*
+Function: level_retire()
+        Free the old bottom level after a resizing; While scans are running it is kept as it was, 
+        since they read the items they have not reached yet from it, and freed when the last scan ends
+*/
+static void level_retire(level_hash *level, level_bucket *buckets, uint64_t size)
+{
+#ifndef LEVEL_ONLINE_RESIZE
+    if (__atomic_load_n(&level->iter_num, __ATOMIC_SEQ_CST) == 0)
+    {
+        level_block_free(level, buckets, size);
+        return;
+    }
+#endif
+
+    level_retired *retired = malloc(sizeof(level_retired));
+    if (!retired)
+    {
+        printf("The resizing fails: 4\n");
+        exit(1);
+    }
+    retired->buckets = buckets;
+    retired->size = size;
+#ifdef LEVEL_ONLINE_RESIZE
+    retired->epoch = __atomic_fetch_add(&level->epoch, 1, __ATOMIC_SEQ_CST);
+#endif
+    retired->next = level->retired;
+    level->retired = retired;
+}
+
+/*
+Function: level_free_retired()
+        Free the levels retired during scans
+*/
+static void level_free_retired(level_hash *level)
+{
+    level_retired *retired = __atomic_exchange_n(&level->retired, NULL, __ATOMIC_SEQ_CST);
+    while (retired)
+    {
+        level_retired *next = retired->next;
+        level_block_free(level, retired->buckets, retired->size);
+        free(retired);
+        retired = next;
+    }
+}
+
+/*
+Function: level_movement_begin()
+        Announce an item movement; Return 1 without announcing it if a scan is running, since a moved 
+        item could be produced twice or missed by the scan
+*/
+static inline uint8_t level_movement_begin(level_hash *level)
+{
+    __atomic_add_fetch(&level->mover_num, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&level->iter_num, __ATOMIC_SEQ_CST))
+    {
+        __atomic_sub_fetch(&level->mover_num, 1, __ATOMIC_SEQ_CST);
+        return 1;
+    }
+    return 0;
+}
+
+static inline void level_movement_end(level_hash *level)
+{
+    __atomic_sub_fetch(&level->mover_num, 1, __ATOMIC_SEQ_CST);
+}
+
+#ifdef LEVEL_BUCKET_LOCK
+/*
+Function: level_bucket_lock()
+        Lock a bucket by making its lock word odd; Return 0 if it is locked, or 1 without locking it 
+        if it is an interim bucket whose items were migrated by an online resizing
+*/
+static inline uint8_t level_bucket_lock(level_bucket *bucket)
+{
+    uint32_t version;
+    while (true)
+    {
+        version = __atomic_load_n(&bucket->lock, __ATOMIC_RELAXED);
+#ifdef LEVEL_ONLINE_RESIZE
+        if (version & LEVEL_BUCKET_MIGRATED)
+            return 1;
+#endif
+        if (!(version & 1) && __atomic_compare_exchange_n(&bucket->lock, &version, version + 1, false, 
+            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            return 0;
+        cpu_relax();
+    }
+}
+
+/*
+Function: level_bucket_trylock()
+        Try to lock a bucket without waiting; Return 0 if it is locked, 1 if another thread holds it
+*/
+static inline uint8_t level_bucket_trylock(level_bucket *bucket)
+{
+    uint32_t version = __atomic_load_n(&bucket->lock, __ATOMIC_RELAXED);
+#ifdef LEVEL_ONLINE_RESIZE
+    if (version & LEVEL_BUCKET_MIGRATED)
+        return 1;
+#endif
+    return (version & 1) || !__atomic_compare_exchange_n(&bucket->lock, &version, version + 1, false, 
+        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+/*
+Function: level_bucket_unlock()
+        Unlock a bucket; A change moves the lock word to the next even version, otherwise the version 
+        of the bucket before the lock is restored, so that the lookups reading it without locks go on
+*/
+static inline void level_bucket_unlock(level_bucket *bucket, uint8_t changed)
+{
+    uint32_t version = changed ? bucket->lock + 1 : bucket->lock - 1;
+#ifdef LEVEL_ONLINE_RESIZE
+    version &= ~LEVEL_BUCKET_MIGRATED;    // The versions wrap around below the migrated bit
+#endif
+    __atomic_store_n(&bucket->lock, version, __ATOMIC_RELEASE);
+}
+
+// A bucket is locked once for all its slots, and the items are moved with trylocks to avoid deadlocks
+#define LEVEL_LOCK_BUCKET(bucket) level_bucket_lock(bucket)
+#define LEVEL_TRYLOCK_BUCKET(bucket) level_bucket_trylock(bucket)
+#define LEVEL_UNLOCK_BUCKET(bucket, changed) level_bucket_unlock(bucket, changed)
+#define LEVEL_LOCK_SLOT(locks, n)
+#define LEVEL_UNLOCK_SLOT(locks, n)
+#define LEVEL_VERSION(level, i, idx) (&(level)->buckets[i][idx].lock)
+#else
+// Each slot is locked in the lock array of its level
+#define LEVEL_LOCK_BUCKET(bucket) ((void)0)
+#define LEVEL_TRYLOCK_BUCKET(bucket) 0
+#define LEVEL_UNLOCK_BUCKET(bucket, changed) ((void)0)
+#define LEVEL_LOCK_SLOT(locks, n) spin_lock(&(locks)->s_lock[n])
+#define LEVEL_UNLOCK_SLOT(locks, n) spin_unlock(&(locks)->s_lock[n])
+#define LEVEL_VERSION(level, i, idx) (&(level)->level_locks[i][idx].version)
+#endif
+
+#ifdef LEVEL_ONLINE_RESIZE
+// A migrated bucket is not locked, and the operation is retried on the levels replacing it
+#define LEVEL_LOCK_LIVE_BUCKET(bucket) level_bucket_lock(bucket)
+#else
+#define LEVEL_LOCK_LIVE_BUCKET(bucket) (LEVEL_LOCK_BUCKET(bucket), 0)
+#endif
+
+#if defined(LEVEL_OPTIMISTIC_READ) && !defined(LEVEL_BUCKET_LOCK)
+/*
+Function: level_write_begin()
+        Announce a change of a bucket to the lookups reading it without locks; The writer holds the lock of
+        the slot it changes, but the other slots of the bucket may be changed at the same time, so the
+        writers in progress are counted instead of making the version odd
+*/
+static inline void level_write_begin(level_locks *locks)
+{
+    __atomic_fetch_add(&locks->version, 1, __ATOMIC_SEQ_CST);
+}
+
+/*
+Function: level_write_end()
+        Finish a change of a bucket: remove the writer and count the change in a single step
+*/
+static inline void level_write_end(level_locks *locks)
+{
+    __atomic_fetch_add(&locks->version, LEVEL_VERSION_STEP - 1, __ATOMIC_RELEASE);
+}
+#else
+// A bucket lock word is its version, and without LEVEL_OPTIMISTIC_READ no version is kept
+#define level_write_begin(locks)
+#define level_write_end(locks)
+#endif
+
+#ifdef LEVEL_OPTIMISTIC_READ
+/*
+Function: level_bucket_read()
+        Look a key up in a bucket without locks and copy its value out; The bucket is read again
+        if a writer was changing it; A slot key is compared as a local copy, which may be torn, so the
+        result only counts once the version is checked; Return 0 if the key is found, 1 otherwise, 
+        and 2 if the bucket was migrated by an online resizing
+*/
+static inline uint8_t level_bucket_read(level_bucket *bucket, uint32_t *version, const uint8_t *key, uint8_t *value)
+{
+    uint8_t slot_key[KEY_LEN];
+    uint8_t copy[VALUE_LEN];
+    uint32_t seen;
+    uint64_t j;
+
+    while (true)
+    {
+        seen = __atomic_load_n(version, __ATOMIC_ACQUIRE);
+#ifdef LEVEL_ONLINE_RESIZE
+        if (seen & LEVEL_BUCKET_MIGRATED)
+            return 2;
+#endif
+        if (seen & LEVEL_VERSION_WRITERS)
+        {
+            cpu_relax();
+            continue;
+        }
+
+        for (j = 0; j < ASSOC_NUM; j++)
+        {
+            if (!GET_TOKEN(bucket->token, j))
+                continue;
+            memcpy(slot_key, bucket->slot[j].key, KEY_LEN);
+            if (level_key_equal(slot_key, key))
+            {
+                memcpy(copy, bucket->slot[j].value, VALUE_LEN);
+                break;
+            }
+        }
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(version, __ATOMIC_RELAXED) == seen)
+            break;
+    }
+
+    if (j == ASSOC_NUM)
+        return 1;
+    memcpy(value, copy, VALUE_LEN);
+    return 0;
+}
+
+#define LEVEL_LOCK_PREFETCH 0             // Lookups only read the versions of the buckets
+#else
+#define LEVEL_LOCK_PREFETCH 1             // Lookups write the locks of the slots
+#endif
+
+/*
+Function: level_empty_slot()
+        Return the first empty slot in a bucket, or -1 if the bucket is full;
+        With LEVEL_ALIGNED_BUCKET, it is found with one tzcnt on the inverted occupancy bitmap
+*/
+static inline int level_empty_slot(level_bucket *bucket)
+{
+#ifdef LEVEL_ALIGNED_BUCKET
+    uint32_t empty = ~__atomic_load_n(&bucket->token, __ATOMIC_ACQUIRE) & ((1U << ASSOC_NUM) - 1);
+    return empty ? __builtin_ctz(empty) : -1;
+#else
+    int j;
+    for (j = 0; j < ASSOC_NUM; j++)
+    {
+        if (!GET_TOKEN(bucket->token, j))
+            return j;
+    }
+    return -1;
+#endif
+}
+
+/*
+Function: level_pair_empty_slot()
+        Return the first empty slot of two buckets in the order of their slots, the first bucket first at the
+        same slot, which fills the less-loaded bucket; Set second if the slot is in the second bucket; Return
+        -1 if both are full; Without LEVEL_BUCKET_LOCK the slot may be taken before its lock is held, so the 
+        caller checks its token again under the slot lock
+*/
+static inline int level_pair_empty_slot(level_bucket *f_bucket, level_bucket *s_bucket, uint8_t *second)
+{
+    int f_slot = level_empty_slot(f_bucket);
+    int s_slot = level_empty_slot(s_bucket);
+
+    *second = s_slot >= 0 && (f_slot < 0 || s_slot < f_slot);
+    return *second ? s_slot : f_slot;
+}
+
+#ifdef LEVEL_ONLINE_RESIZE
+static uint8_t level_move(level_hash *level, level_bucket *buckets, level_locks *locks, uint64_t bucket_num, 
+    uint64_t idx, uint8_t *key, uint8_t *value, uint8_t scanned);
+
+static int level_b2t_move(level_hash *level, level_bucket *top, level_locks *top_locks, uint64_t top_num,
+    level_bucket *bottom, level_locks *bottom_locks, uint64_t idx);
+
+#define LEVEL_CURSOR_MASK ((1ULL << 56) - 1)  // The bucket part of migrate_cursor, below level_resize
+#define LEVEL_OP_QUERY 0                  // The operations level_online_apply() applies to the slot of a key
+#define LEVEL_OP_DELETE 1
+#define LEVEL_OP_UPDATE 2
+
+typedef struct level_table{               // The levels of a hash table as seen by one operation
+    level_bucket *buckets[3];             // The top, bottom and interim levels; The interim level is NULL between resizings
+    uint64_t bucket_num[3];
+    uint8_t generation;                   // level_resize when the levels were read
+} level_table;
+
+/*
+Function: level_table_load()
+        Read the levels of a hash table, retrying while a resizing replaces them
+*/
+static inline void level_table_load(level_hash *level, level_table *table)
+{
+    uint32_t seq;
+    do
+    {
+        while ((seq = __atomic_load_n(&level->table_seq, __ATOMIC_ACQUIRE)) & 1)
+            cpu_relax();
+        table->buckets[0] = level->buckets[0];
+        table->buckets[1] = level->buckets[1];
+        table->buckets[2] = level->interim_level_buckets;
+        table->bucket_num[0] = level->addr_capacity;
+        table->bucket_num[1] = level->addr_capacity / 2;
+        table->bucket_num[2] = level->interim_bucket_num;
+        table->generation = level->level_resize;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&level->table_seq, __ATOMIC_RELAXED) != seq);
+}
+
+/*
+Function: level_table_write_begin()
+        Make the levels unreadable while a resizing replaces them; The resize lock is held
+*/
+static inline void level_table_write_begin(level_hash *level)
+{
+    __atomic_store_n(&level->table_seq, level->table_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static inline void level_table_write_end(level_hash *level)
+{
+    __atomic_store_n(&level->table_seq, level->table_seq + 1, __ATOMIC_SEQ_CST);
+}
+
+/*
+Function: level_epoch_enter()
+        Announce that a thread reads the levels until level_epoch_exit(); A level retired in an epoch 
+        is only freed once no thread is in that epoch or an earlier one
+*/
+static inline void level_epoch_enter(level_hash *level, uint32_t thread_id)
+{
+    __atomic_store_n(&level->thread_stats[thread_id].epoch, __atomic_load_n(&level->epoch, __ATOMIC_SEQ_CST), 
+        __ATOMIC_SEQ_CST);
+}
+
+/*
+Function: level_reclaim()
+        Free the retired levels that no thread can still read; None is freed while scans are running, 
+        since a scan keeps its levels across its steps; The resize lock is held
+*/
+static void level_reclaim(level_hash *level)
+{
+    uint64_t t, epoch, min_epoch = UINT64_MAX;
+    level_retired **link = &level->retired;
+
+    if (__atomic_load_n(&level->iter_num, __ATOMIC_SEQ_CST))
+        return;
+    for (t = 0; t < level->thread_num; t++)
+    {
+        epoch = __atomic_load_n(&level->thread_stats[t].epoch, __ATOMIC_SEQ_CST);
+        if (epoch && epoch < min_epoch)
+            min_epoch = epoch;
+    }
+
+    while (*link)
+    {
+        level_retired *retired = *link;
+        if (retired->epoch < min_epoch)
+        {
+            *link = retired->next;
+            level_block_free(level, retired->buckets, retired->size);
+            free(retired);
+        }
+        else
+            link = &retired->next;
+    }
+}
+
+/*
+Function: level_epoch_exit()
+        Leave the epoch entered by level_epoch_enter(), and free the retired levels unless another 
+        thread is already at it
+*/
+static inline void level_epoch_exit(level_hash *level, uint32_t thread_id)
+{
+    __atomic_store_n(&level->thread_stats[thread_id].epoch, 0, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&level->retired, __ATOMIC_RELAXED) && !spin_trylock(&level->resize_lock))
+    {
+        level_reclaim(level);
+        spin_unlock(&level->resize_lock);
+    }
+}
+
+/*
+Function: level_pair_insert()
+        Insert an item into the less-loaded bucket between its two buckets in a level;
+        Return 0 if it is inserted, 1 if both buckets are full and 2 if one of them was migrated
+*/
+static uint8_t level_pair_insert(level_bucket *f_bucket, level_bucket *s_bucket, const uint8_t *key, const uint8_t *value)
+{
+    level_bucket *bucket;
+    uint8_t second;
+    int j;
+
+    // The first bucket is below the second one, so two insertions lock the same two buckets in the same order
+    if (level_bucket_lock(f_bucket))
+        return 2;
+    if (level_bucket_lock(s_bucket))
+    {
+        level_bucket_unlock(f_bucket, 0);
+        return 2;
+    }
+    j = level_pair_empty_slot(f_bucket, s_bucket, &second);
+    if (j < 0)
+    {
+        level_bucket_unlock(s_bucket, 0);
+        level_bucket_unlock(f_bucket, 0);
+        return 1;
+    }
+    bucket = second ? s_bucket : f_bucket;
+    memcpy(bucket->slot[j].key, key, KEY_LEN);
+    memcpy(bucket->slot[j].value, value, VALUE_LEN);
+    SET_TOKEN(bucket->token, j, 1);
+    level_bucket_unlock(second ? f_bucket : s_bucket, 0);
+    level_bucket_unlock(bucket, 1);
+    return 0;
+}
+
+/*
+Function: level_migrate_item()
+        Rehash an interim item into the top level, or into the bottom level if its top-level buckets are full,
+        or else into a top-level slot emptied by a movement; Return the level it is put into, or -1
+*/
+static int level_migrate_item(level_hash *level, level_table *table, uint8_t *key, uint8_t *value)
+{
+    uint64_t f_hash = F_HASH(level, key);
+    uint64_t s_hash = S_HASH(level, key);
+    uint64_t top_num = table->bucket_num[0];
+    uint64_t bottom_num = table->bucket_num[1];
+    uint8_t full;
+
+    if (!level_pair_insert(&table->buckets[0][F_IDX(f_hash, top_num)], &table->buckets[0][S_IDX(s_hash, top_num)], key, value))
+        return 0;
+
+    // A scan reads the bottom level, so an item put there during the scan could be produced twice
+    if (level_movement_begin(level))
+        return -1;
+    full = level_pair_insert(&table->buckets[1][F_IDX(f_hash, bottom_num)], &table->buckets[1][S_IDX(s_hash, bottom_num)], key, value);
+    level_movement_end(level);
+    if (!full)
+        return 1;
+
+    // No scan begins while an interim level exists, so no running scan reads the new top level
+    if (!level_move(level, table->buckets[0], NULL, top_num, F_IDX(f_hash, top_num), key, value, 0)
+        || !level_move(level, table->buckets[0], NULL, top_num, S_IDX(s_hash, top_num), key, value, 0))
+        return 0;
+    return -1;
+}
+
+/*
+Function: level_pair_take()
+        Remove the item of a key from its two buckets in a level and copy its value out; Both buckets are 
+        locked, so that no movement carries the item from one to the other meanwhile; Return 0 if it is found
+*/
+static uint8_t level_pair_take(level_bucket *f_bucket, level_bucket *s_bucket, const uint8_t *key, uint8_t *value)
+{
+    level_bucket *bucket[2] = {f_bucket, s_bucket};
+    uint64_t k, j;
+
+    if (level_bucket_lock(f_bucket))
+        return 1;
+    if (level_bucket_lock(s_bucket))
+    {
+        level_bucket_unlock(f_bucket, 0);
+        return 1;
+    }
+    for (k = 0; k < 2; k++)
+    {
+        for (j = 0; j < ASSOC_NUM; j++)
+        {
+            if (GET_TOKEN(bucket[k]->token, j) && level_key_equal(bucket[k]->slot[j].key, key))
+            {
+                memcpy(value, bucket[k]->slot[j].value, VALUE_LEN);
+                SET_TOKEN(bucket[k]->token, j, 0);
+                level_bucket_unlock(bucket[1 - k], 0);
+                level_bucket_unlock(bucket[k], 1);
+                return 0;
+            }
+        }
+    }
+    level_bucket_unlock(s_bucket, 0);
+    level_bucket_unlock(f_bucket, 0);
+    return 1;
+}
+
+/*
+Function: level_migrate_undo()
+        Take the first num items of an interim bucket back from the levels they were rehashed into, with the
+        values updated meanwhile, and drop the ones deleted meanwhile; The bottom pair is probed first, since 
+        a movement only carries an item from the bottom level up to the top one
+*/
+static void level_migrate_undo(level_hash *level, level_table *table, level_bucket *bucket, uint64_t num)
+{
+    uint64_t i, f_hash, s_hash;
+    int k;
+
+    for (i = 0; i < num; i++)
+    {
+        if (!GET_TOKEN(bucket->token, i))
+            continue;
+        f_hash = F_HASH(level, bucket->slot[i].key);
+        s_hash = S_HASH(level, bucket->slot[i].key);
+        for (k = 1; k >= 0; k--)
+        {
+            if (!level_pair_take(&table->buckets[k][F_IDX(f_hash, table->bucket_num[k])], 
+                &table->buckets[k][S_IDX(s_hash, table->bucket_num[k])], bucket->slot[i].key, bucket->slot[i].value))
+                break;
+        }
+        if (k < 0)
+            SET_TOKEN(bucket->token, i, 0);
+    }
+}
+
+/*
+Function: level_migrate_bucket()
+        Rehash the items of an interim bucket and seal it; The items stay in the sealed bucket as a read-only
+        image for the lookups and scans reading it, which look for them again in the other levels;
+        An item that still fits nowhere after LEVEL_MIGRATE_RETRY tries leaves the whole bucket unmigrated 
+        and sets need_resizing, so that level_expand_stalled() rehashes it with the other threads paused;
+        Return 0 if the bucket is sealed, 1 otherwise
+*/
+static uint8_t level_migrate_bucket(level_hash *level, level_table *table, uint64_t idx, uint32_t thread_id)
+{
+    level_bucket *bucket = &table->buckets[2][idx];
+    uint64_t *item_num = level->thread_stats[thread_id].level_item_num;
+    uint64_t i, tries;
+    int level_num[ASSOC_NUM];
+
+    // Each interim bucket is claimed by one thread, so it is not sealed yet
+    level_bucket_lock(bucket);
+    for (i = 0; i < ASSOC_NUM; i++)
+    {
+        if (!GET_TOKEN(bucket->token, i))
+            continue;
+        // Retried while a deletion or a movement in the top level, or the end of the scans, may make room
+        for (tries = 0; (level_num[i] = level_migrate_item(level, table, bucket->slot[i].key, bucket->slot[i].value)) < 0; tries++)
+        {
+            if (tries == LEVEL_MIGRATE_RETRY)
+            {
+                level_migrate_undo(level, table, bucket, i);
+                level_bucket_unlock(bucket, 1);
+                __atomic_store_n(&level->need_resizing, true, __ATOMIC_SEQ_CST);
+                return 1;
+            }
+            cpu_relax();
+        }
+    }
+    for (i = 0; i < ASSOC_NUM; i++)
+    {
+        if (!GET_TOKEN(bucket->token, i))
+            continue;
+        item_num[(uint8_t)(table->generation - 2) & 3]--;
+        item_num[(uint8_t)(table->generation - level_num[i]) & 3]++;
+    }
+    __atomic_store_n(&bucket->lock, (bucket->lock + 1) | LEVEL_BUCKET_MIGRATED, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/*
+Function: level_migrate_finish()
+        Remove the interim level once all its buckets are migrated, and retire it
+*/
+static void level_migrate_finish(level_hash *level, level_table *table)
+{
+    spin_lock(&level->resize_lock);
+    level_table_write_begin(level);
+    level->interim_level_buckets = NULL;
+    level->interim_bucket_num = 0;
+    level_table_write_end(level);
+
+    level->stats.expand_ns += level_time_ns() - level->resize_begin;
+    level_retire(level, table->buckets[2], table->bucket_num[2] * sizeof(level_bucket));
+    level_reclaim(level);
+    spin_unlock(&level->resize_lock);
+}
+
+/*
+Function: level_migrate()
+        Migrate up to num buckets of the interim level of a table, which is skipped unless it is still 
+        being migrated; The buckets are claimed one by one from migrate_cursor, and the thread migrating 
+        the last one removes the interim level; A bucket left unmigrated stops the migration until
+        level_expand_stalled() runs; Return the number of buckets migrated
+*/
+static uint64_t level_migrate(level_hash *level, level_table *table, uint64_t num, uint32_t thread_id)
+{
+    uint64_t generation = (uint64_t)table->generation << 56;
+    uint64_t cursor, idx, done = 0;
+
+    for (; num > 0 && !__atomic_load_n(&level->need_resizing, __ATOMIC_RELAXED); num--)
+    {
+        cursor = __atomic_load_n(&level->migrate_cursor, __ATOMIC_RELAXED);
+        do
+        {
+            idx = cursor & LEVEL_CURSOR_MASK;
+            if ((cursor & ~LEVEL_CURSOR_MASK) != generation || idx >= table->bucket_num[2])
+            {
+                idx = UINT64_MAX;
+                break;
+            }
+        } while (!__atomic_compare_exchange_n(&level->migrate_cursor, &cursor, cursor + 1, false, 
+            __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+        if (idx == UINT64_MAX)
+            break;
+
+        if (level_migrate_bucket(level, table, idx, thread_id))
+            break;
+        done++;
+    }
+
+    if (done && __atomic_add_fetch(&level->migrate_done, done, __ATOMIC_SEQ_CST) == table->bucket_num[2])
+        level_migrate_finish(level, table);
+    return done;
+}
+
+/*
+Function: level_expand_stalled()
+        Expand a hash table whose migration is stuck, with no other thread in an epoch: the items of the
+        bottom level and of the interim buckets not migrated yet are rehashed into a new top level, and the
+        top level becomes the bottom one; The old levels are sealed and retired as they are, so that the
+        running scans still read them; The resize lock is held
+*/
+static void level_expand_stalled(level_hash *level)
+{
+    level_bucket *old[2] = {level->buckets[1], level->interim_level_buckets};
+    uint64_t old_num[2] = {level->addr_capacity / 2, level->interim_bucket_num};
+    uint64_t capacity = level->addr_capacity * 2;
+    uint8_t generation = level->level_resize;
+    uint64_t k, idx, i, t, f_idx, s_idx;
+
+    level_bucket *newBuckets = level_block_alloc(level, capacity * sizeof(level_bucket));
+    if (!newBuckets)
+    {
+        printf("The resizing fails: 2\n");
+        exit(1);
+    }
+
+    for (k = 0; k < 2; k++)
+    {
+        for (idx = 0; idx < old_num[k]; idx++)
+        {
+            level_bucket *bucket = &old[k][idx];
+            // A migrated interim bucket has its items in the top or bottom level already
+            if (level_bucket_lock(bucket))
+                continue;
+            for (i = 0; i < ASSOC_NUM; i++)
+            {
+                if (!GET_TOKEN(bucket->token, i))
+                    continue;
+                f_idx = F_IDX(F_HASH(level, bucket->slot[i].key), capacity);
+                s_idx = S_IDX(S_HASH(level, bucket->slot[i].key), capacity);
+                // No scan reads the new top level, so the items may be moved within it
+                if (level_pair_insert(&newBuckets[f_idx], &newBuckets[s_idx], bucket->slot[i].key, bucket->slot[i].value)
+                    && level_move(level, newBuckets, NULL, capacity, f_idx, bucket->slot[i].key, bucket->slot[i].value, 0)
+                    && level_move(level, newBuckets, NULL, capacity, s_idx, bucket->slot[i].key, bucket->slot[i].value, 0))
+                {
+                    printf("The resizing fails: 3\n");
+                    exit(1);
+                }
+            }
+            __atomic_store_n(&bucket->lock, (bucket->lock + 1) | LEVEL_BUCKET_MIGRATED, __ATOMIC_RELEASE);
+        }
+    }
+
+    // The items of the bottom and interim levels are now counted in the new top level
+    for (t = 0; t < level->thread_num; t++)
+    {
+        uint64_t *item_num = level->thread_stats[t].level_item_num;
+        item_num[(uint8_t)(generation + 1) & 3] += item_num[(uint8_t)(generation - 1) & 3] 
+            + item_num[(uint8_t)(generation - 2) & 3];
+        item_num[(uint8_t)(generation - 1) & 3] = 0;
+        item_num[(uint8_t)(generation - 2) & 3] = 0;
+    }
+
+    level_table_write_begin(level);
+    level->interim_level_buckets = NULL;
+    level->interim_bucket_num = 0;
+    level->buckets[1] = level->buckets[0];
+    level->buckets[0] = newBuckets;
+    level->addr_capacity = capacity;
+    level->level_size++;
+    level->total_capacity = pow(2, level->level_size) + pow(2, level->level_size - 1);
+    level->level_resize++;
+    level->migrate_cursor = (uint64_t)level->level_resize << 56;
+    level->migrate_done = 0;
+    level_table_write_end(level);
+
+    level->stats.expand_ns += level_time_ns() - level->resize_begin;
+    level->stats.expand_num++;
+    level_retire(level, old[0], old_num[0] * sizeof(level_bucket));
+    level_retire(level, old[1], old_num[1] * sizeof(level_bucket));
+    level_reclaim(level);
+}
+
+/*
+Function: level_online_pause()
+        Leave the epoch of a thread while need_resizing is set, and enter it again; Once no thread is in
+        an epoch, the first one to take the resize lock runs level_expand_stalled()
+*/
+static void level_online_pause(level_hash *level, uint32_t thread_id)
+{
+    uint64_t t;
+
+    if (!__atomic_load_n(&level->need_resizing, __ATOMIC_SEQ_CST))
+        return;
+    level_epoch_exit(level, thread_id);
+    while (__atomic_load_n(&level->need_resizing, __ATOMIC_SEQ_CST))
+    {
+        // The threads entering an epoch meanwhile see need_resizing and leave it again
+        for (t = 0; t < level->thread_num; t++)
+        {
+            if (__atomic_load_n(&level->thread_stats[t].epoch, __ATOMIC_SEQ_CST))
+                break;
+        }
+        if (t == level->thread_num && !spin_trylock(&level->resize_lock))
+        {
+            if (level->need_resizing)
+            {
+                level_expand_stalled(level);
+                __atomic_store_n(&level->need_resizing, false, __ATOMIC_SEQ_CST);
+            }
+            spin_unlock(&level->resize_lock);
+        }
+        cpu_relax();
+    }
+    level_epoch_enter(level, thread_id);
+}
+
+/*
+Function: level_expand_online()
+        Expand a hash table without stopping the other threads: a new top level is published at once, 
+        and the old bottom level becomes the interim level, which the insertions and deletions migrate;
+        A running migration is finished first; Nothing is done if another thread already expanded
+        the table seen at generation; The thread is in an epoch
+*/
+static void level_expand_online(level_hash *level, uint8_t generation, uint32_t thread_id)
+{
+    level_table table;
+    while (true)
+    {
+        level_online_pause(level, thread_id);
+        level_table_load(level, &table);
+        if (table.generation != generation)
+            return;
+        if (!table.buckets[2])
+            break;
+        level_migrate(level, &table, UINT64_MAX, thread_id);
+        cpu_relax();
+    }
+
+    spin_lock(&level->resize_lock);
+    if (level->level_resize != generation || level->interim_level_buckets)
+    {
+        spin_unlock(&level->resize_lock);
+        return;
+    }
+    uint64_t begin = level_time_ns();
+    level_bucket *newBuckets = level_block_alloc(level, level->addr_capacity * 2 * sizeof(level_bucket));
+    if (!newBuckets)
+    {
+        printf("The resizing fails: 2\n");
+        exit(1);
+    }
+
+    level_table_write_begin(level);
+    level->interim_level_buckets = level->buckets[1];
+    level->interim_bucket_num = level->addr_capacity / 2;
+    level->buckets[1] = level->buckets[0];
+    level->buckets[0] = newBuckets;
+    level->addr_capacity *= 2;
+    level->level_size++;
+    level->total_capacity = pow(2, level->level_size) + pow(2, level->level_size - 1);
+    level->level_resize++;
+    level->migrate_cursor = (uint64_t)level->level_resize << 56;
+    level->migrate_done = 0;
+    level_table_write_end(level);
+
+    level->resize_begin = begin;
+    level->stats.expand_num++;
+    spin_unlock(&level->resize_lock);
+}
+
+/*
+Function: level_bucket_apply()
+        Look a key up in a bucket and copy its value out, remove it or overwrite its value;
+        Return 0 if the key is found, 1 otherwise, and 2 if the bucket was migrated
+*/
+static uint8_t level_bucket_apply(level_bucket *bucket, uint8_t op, const uint8_t *key, uint8_t *value)
+{
+    uint64_t j;
+
+#ifdef LEVEL_OPTIMISTIC_READ
+    if (op == LEVEL_OP_QUERY)
+        return level_bucket_read(bucket, &bucket->lock, key, value);
+#endif
+    if (level_bucket_lock(bucket))
+        return 2;
+    for (j = 0; j < ASSOC_NUM; j++)
+    {
+        if (GET_TOKEN(bucket->token, j) && level_key_equal(bucket->slot[j].key, key))
+        {
+            if (op == LEVEL_OP_QUERY)
+                memcpy(value, bucket->slot[j].value, VALUE_LEN);
+            else if (op == LEVEL_OP_DELETE)
+                SET_TOKEN(bucket->token, j, 0);
+            else
+                memcpy(bucket->slot[j].value, value, VALUE_LEN);
+            level_bucket_unlock(bucket, op != LEVEL_OP_QUERY);
+            return 0;
+        }
+    }
+    level_bucket_unlock(bucket, 0);
+    return 1;
+}
+
+/*
+Function: level_online_apply()
+        Apply an operation to the item of a key, whose hash values are already computed, during online 
+        resizings; The top and bottom levels are probed before the interim level, since an item is only 
+        migrated upwards; A migrated top-level or bottom-level bucket means that the table was expanded
+        meanwhile, and the operation starts over; A migrated interim bucket means that its items are in 
+        the top or bottom level, which are probed again; The thread is in an epoch
+*/
+static uint8_t level_online_apply(level_hash *level, uint8_t op, uint8_t *key, uint8_t *value, 
+    uint64_t f_hash, uint64_t s_hash, uint32_t thread_id)
+{
+    level_table table;
+    uint64_t i, k, idx[2];
+    uint8_t result, migrated, skip = 0, skipped = 0;
+
+    while (true)
+    {
+        level_table_load(level, &table);
+        // The last try met a migrated interim bucket, whose items are in the other levels by now
+        if (skip && skipped == table.generation)
+            table.buckets[2] = NULL;
+        migrated = 0;
+
+        for (i = 0; i < 3 && table.buckets[i]; i++)
+        {
+            idx[0] = F_IDX(f_hash, table.bucket_num[i]);
+            idx[1] = S_IDX(s_hash, table.bucket_num[i]);
+            for (k = 0; k < 2; k++)
+            {
+                result = level_bucket_apply(&table.buckets[i][idx[k]], op, key, value);
+                if (result == 0)
+                {
+                    if (op == LEVEL_OP_QUERY)
+                        LEVEL_STATS_ADD(level, thread_id, hit_probes[2 * i + k + 1]);
+                    if (op == LEVEL_OP_DELETE)
+                        level->thread_stats[thread_id].level_item_num[(uint8_t)(table.generation - i) & 3]--;
+                    return 0;
+                }
+                if (result == 2)
+                    migrated = 1;
+            }
+            if (migrated)
+                break;
+        }
+        if (!migrated)
+            break;
+        skip = i == 2;
+        skipped = table.generation;
+    }
+
+    if (op == LEVEL_OP_QUERY)
+        LEVEL_STATS_ADD(level, thread_id, miss_probes[2 * i]);
+    return 1;
+}
+
+/*
+Function: level_online_insert()
+        Insert a key-value item during online resizings; Each insertion first migrates LEVEL_MIGRATE_STEP 
+        interim buckets, and an item that fits nowhere expands the table and is inserted again
+*/
+static uint8_t level_online_insert(level_hash *level, uint8_t *key, uint8_t *value, uint32_t thread_id)
+{
+    uint64_t f_hash = F_HASH(level, key);
+    uint64_t s_hash = S_HASH(level, key);
+    uint64_t *item_num = level->thread_stats[thread_id].level_item_num;
+    uint64_t f_idx, s_idx;
+    level_table table;
+
+    uint64_t i;
+    uint8_t result;
+    int empty_location;
+
+    level_epoch_enter(level, thread_id);
+    while (true)
+    {
+        level_online_pause(level, thread_id);
+        level_table_load(level, &table);
+        /*  Once all interim buckets are claimed, the insertions wait for the threads migrating the last ones,
+            which could otherwise find the top level filled by the insertions made meanwhile
+        */
+        if (table.buckets[2] && !level_migrate(level, &table, LEVEL_MIGRATE_STEP, thread_id))
+        {
+            cpu_relax();
+            continue;
+        }
+
+        for (i = 0; i < 2; i++)
+        {
+            f_idx = F_IDX(f_hash, table.bucket_num[i]);
+            s_idx = S_IDX(s_hash, table.bucket_num[i]);
+            result = level_pair_insert(&table.buckets[i][f_idx], &table.buckets[i][s_idx], key, value);
+            if (result != 1)
+                break;
+        }
+        if (result == 0)
+        {
+            item_num[(uint8_t)(table.generation - i) & 3]++;
+            level_epoch_exit(level, thread_id);
+            return 0;
+        }
+        // The levels were replaced by another expanding
+        if (result == 2)
+            continue;
+
+        for (i = 0; i < 2; i++)
+        {
+            f_idx = F_IDX(f_hash, table.bucket_num[i]);
+            s_idx = S_IDX(s_hash, table.bucket_num[i]);
+            LEVEL_STATS_ADD(level, thread_id, movement_tries[0]);
+            if (!level_move(level, table.buckets[i], NULL, table.bucket_num[i], f_idx, key, value, 1))
+                break;
+            LEVEL_STATS_ADD(level, thread_id, movement_tries[0]);
+            if (!level_move(level, table.buckets[i], NULL, table.bucket_num[i], s_idx, key, value, 1))
+                break;
+        }
+        if (i < 2)
+        {
+            LEVEL_STATS_ADD(level, thread_id, movement_successes[0]);
+            item_num[(uint8_t)(table.generation - i) & 3]++;
+            level_epoch_exit(level, thread_id);
+            return 0;
+        }
+
+        if (table.generation > 0)
+        {
+            for (i = 0; i < 2; i++)
+            {
+                uint64_t idx = i ? S_IDX(s_hash, table.bucket_num[1]) : F_IDX(f_hash, table.bucket_num[1]);
+                LEVEL_STATS_ADD(level, thread_id, movement_tries[1]);
+                empty_location = level_b2t_move(level, table.buckets[0], NULL, table.bucket_num[0], 
+                    table.buckets[1], NULL, idx);
+                if (empty_location != -1)
+                {
+                    // The moved item is now in the top level and the new item takes its slot
+                    level_bucket *bucket = &table.buckets[1][idx];
+                    LEVEL_STATS_ADD(level, thread_id, movement_successes[1]);
+                    item_num[table.generation & 3]++;
+                    memcpy(bucket->slot[empty_location].key, key, KEY_LEN);
+                    memcpy(bucket->slot[empty_location].value, value, VALUE_LEN);
+                    SET_TOKEN(bucket->token, empty_location, 1);
+                    level_bucket_unlock(bucket, 1);
+                    level_epoch_exit(level, thread_id);
+                    return 0;
+                }
+            }
+        }
+        level_expand_online(level, table.generation, thread_id);
+    }
 }
+#endif
 
 /*
 Function: level_resize()
         Expand a level hash table in place;
         Put a new level on the top of the old hash table and only rehash the
         items in the bottom level of the old hash table;
+        With LEVEL_ONLINE_RESIZE the items are rehashed by the following operations instead
 */
 void level_resize(level_hash *level,uint32_t thread_id)
 {
@@ -130,10 +1240,23 @@ void level_resize(level_hash *level,uint32_t thread_id)
         printf("The resizing fails: 1\n");
         exit(1);
     }
+#ifdef LEVEL_ONLINE_RESIZE
+    level_epoch_enter(level, thread_id);
+    level_expand_online(level, level->level_resize, thread_id);
+    level_epoch_exit(level, thread_id);
+#else
+    uint64_t begin = level_time_ns();
 
     level->addr_capacity = pow(2, level->level_size + 1);
-    level_bucket *newBuckets = calloc(level->addr_capacity, sizeof(level_bucket));
-    level_locks *newLocks = calloc(level->addr_capacity, sizeof(level_locks));
+    level_bucket *newBuckets = level_block_alloc(level, level->addr_capacity * sizeof(level_bucket));
+#ifndef LEVEL_BUCKET_LOCK
+    level_locks *newLocks = level_block_alloc(level, level->addr_capacity * sizeof(level_locks));
+    if (!newLocks)
+    {
+        printf("The resizing fails: 2\n");
+        exit(1);
+    }
+#endif
     if (!newBuckets)
     {
         printf("The resizing fails: 2\n");
@@ -147,7 +1270,7 @@ void level_resize(level_hash *level,uint32_t thread_id)
         for (i = 0; i < ASSOC_NUM; i++)
         {
             // spin_lock(&level->level_locks[i][old_idx].s_lock[i]);
-            if (level->buckets[1][old_idx].token[i] == 1)
+            if (GET_TOKEN(level->buckets[1][old_idx].token, i))
             {
                 uint8_t *key = level->buckets[1][old_idx].slot[i].key;
                 uint8_t *value = level->buckets[1][old_idx].slot[i].value;
@@ -161,20 +1284,20 @@ void level_resize(level_hash *level,uint32_t thread_id)
                     /*  The rehashed item is inserted into the less-loaded bucket between
                         the two hash locations in the new level
                     */
-                    if (newBuckets[f_idx].token[j] == 0)
+                    if (!GET_TOKEN(newBuckets[f_idx].token, j))
                     {
                         memcpy(newBuckets[f_idx].slot[j].key, key, KEY_LEN);
                         memcpy(newBuckets[f_idx].slot[j].value, value, VALUE_LEN);
-                        newBuckets[f_idx].token[j] = 1;
+                        SET_TOKEN(newBuckets[f_idx].token, j, 1);
                         insertSuccess = 1;
 
                         break;
                     }
-                    if (newBuckets[s_idx].token[j] == 0)
+                    if (!GET_TOKEN(newBuckets[s_idx].token, j))
                     {
                         memcpy(newBuckets[s_idx].slot[j].key, key, KEY_LEN);
                         memcpy(newBuckets[s_idx].slot[j].value, value, VALUE_LEN);
-                        newBuckets[s_idx].token[j] = 1;
+                        SET_TOKEN(newBuckets[s_idx].token, j, 1);
                         insertSuccess = 1;
 
                         break;
@@ -185,8 +1308,6 @@ void level_resize(level_hash *level,uint32_t thread_id)
                     printf("The resizing fails: 3\n");
                     exit(1);
                 }
-
-                level->buckets[1][old_idx].token[i] = 0;
             }
         }
     }
@@ -194,45 +1315,105 @@ void level_resize(level_hash *level,uint32_t thread_id)
     level->level_size++;
     level->total_capacity = pow(2, level->level_size) + pow(2, level->level_size - 1);
 
-    free(level->buckets[1]);
+    level_retire(level, level->buckets[1], pow(2, level->level_size - 2) * sizeof(level_bucket));
     level->buckets[1] = level->buckets[0];
     level->buckets[0] = newBuckets;
     newBuckets = NULL;
-    free(level->level_locks[1]);
+#ifndef LEVEL_BUCKET_LOCK
+    level_block_free(level, level->level_locks[1], pow(2, level->level_size - 2) * sizeof(level_locks));
     level->level_locks[1] = level->level_locks[0];
     level->level_locks[0] = newLocks;
     newLocks = NULL;
+#endif
+
+    /*  The other threads wait at the barrier, so the item counts of the threads are folded in here;
+        The rehashed bottom level is the new top level and the old top level is the new bottom level
+    */
+    uint64_t t, items[2] = {level->stats.level_item_num[0], level->stats.level_item_num[1]};
+    for (t = 0; t < level->thread_num; t++)
+    {
+        items[0] += level->thread_stats[t].stats.level_item_num[0];
+        items[1] += level->thread_stats[t].stats.level_item_num[1];
+        level->thread_stats[t].stats.level_item_num[0] = 0;
+        level->thread_stats[t].stats.level_item_num[1] = 0;
+    }
+    level->stats.level_item_num[0] = items[1];
+    level->stats.level_item_num[1] = items[0];
+    level->stats.expand_num++;
+    level->stats.expand_ns += level_time_ns() - begin;
 
     level->level_resize++;
     level->need_resizing = false;
+#endif
 }
 
-void level_statistic(level_hash *level)
+/*
+Function: level_get_stats()
+        Fill in the statistics of a level hash table by summing up the counters of all threads; The item counts
+        are read without locks and may be off by the operations in flight; Unless scan is set, no bucket is read
+*/
+void level_get_stats(level_hash *level, level_stats *stats, uint8_t scan)
 {
-    uint64_t level0_items = 0;
-    uint64_t level1_items = 0;
-    for (int bkt_idx = 0; bkt_idx < pow(2, level->level_size); bkt_idx++)
+    uint64_t *sum = (uint64_t *)stats;
+    uint64_t t, k, idx, i;
+
+    // All the fields are uint64_t counters, and an item count changed by a thread may wrap around below zero
+    *stats = level->stats;
+    for (t = 0; t < level->thread_num; t++)
     {
-        uint64_t i;
-        for (i = 0; i < ASSOC_NUM; i++)
-        {
-            if (level->buckets[0][bkt_idx].token[i] == 1)
-            {
-                level0_items++;
-            }
-        }
+        uint64_t *counters = (uint64_t *)&level->thread_stats[t].stats;
+        for (k = 0; k < sizeof(level_stats) / sizeof(uint64_t); k++)
+            sum[k] += __atomic_load_n(&counters[k], __ATOMIC_RELAXED);
+    }
+
+#ifdef LEVEL_ONLINE_RESIZE
+    // The items are counted by the level_resize at the creation of their level: r for the top level, r - 1 
+    // for the bottom level and r - 2 for the interim level
+    uint64_t items[4] = {0};
+    for (t = 0; t < level->thread_num; t++)
+    {
+        for (k = 0; k < 4; k++)
+            items[k] += __atomic_load_n(&level->thread_stats[t].level_item_num[k], __ATOMIC_RELAXED);
+    }
+    uint8_t generation = level->level_resize;
+    stats->level_item_num[0] = items[generation & 3];
+    stats->level_item_num[1] = items[(uint8_t)(generation - 1) & 3];
+    stats->interim_item_num = level->interim_level_buckets ? items[(uint8_t)(generation - 2) & 3] : 0;
+    stats->bucket_bytes = (level->total_capacity + level->interim_bucket_num) * sizeof(level_bucket);
+#else
+    stats->interim_item_num = 0;
+    stats->bucket_bytes = level->total_capacity * sizeof(level_bucket);
+#endif
+    stats->level_slot_num[0] = level->addr_capacity * ASSOC_NUM;
+    stats->level_slot_num[1] = level->addr_capacity / 2 * ASSOC_NUM;
+    stats->lock_bytes = level->total_capacity * LEVEL_LOCKS_SIZE;
+    stats->log_bytes = 0;
+    stats->value_bytes = 0;
 
-        if (bkt_idx < pow(2, level->level_size - 1))
+    memset(stats->occupancy, 0, sizeof(stats->occupancy));
+    if (scan)
+    {
+        for (idx = 0; idx < level->total_capacity; idx++)
         {
+            level_bucket *bucket = idx < level->addr_capacity ? &level->buckets[0][idx] : &level->buckets[1][idx - level->addr_capacity];
+            uint64_t items = 0;
             for (i = 0; i < ASSOC_NUM; i++)
-            {
-                if (level->buckets[1][bkt_idx].token[i] == 1)
-                {
-                    level1_items++;
-                }
-            }
+                items += GET_TOKEN(bucket->token, i) != 0;
+            stats->occupancy[items]++;
         }
     }
+}
+
+/*
+Function: level_statistic()
+        Print the item counts and the space utilization of the two levels
+*/
+void level_statistic(level_hash *level)
+{
+    level_stats stats;
+    level_get_stats(level, &stats, 0);
+    uint64_t level0_items = stats.level_item_num[0];
+    uint64_t level1_items = stats.level_item_num[1];
     printf("Level0 : %ld/%ld  Level1 : %ld/%ld \
     total entries %ld total capacity %ld  \
     space utilization %lf\n",
@@ -242,59 +1423,405 @@ void level_statistic(level_hash *level)
 }
 
 /*
-Function: level_query()
-        Lookup a key-value item in level hash table;
+Function: level_snapshot_layout()
+        Describe the buckets, the key and value lengths and the hashing of this build, which a snapshot file 
+        must have been saved with
 */
-uint8_t level_query(level_hash *level, uint8_t *key, uint8_t *value,uint32_t thread_id)
+static uint64_t level_snapshot_layout(void)
 {
-    if (level->need_resizing)
+    uint64_t options = 0;
+#ifdef LEVEL_ALIGNED_BUCKET
+    options |= 4;
+#endif
+#ifdef LEVEL_BINARY_KEY
+    options |= 16;
+#endif
+#ifdef LEVEL_BUCKET_LOCK
+    options |= 32;
+#endif
+    return (sizeof(level_bucket) & 0xffffff) | (uint64_t)ASSOC_NUM << 24 | (uint64_t)(KEY_LEN & 0xfff) << 32 
+        | (uint64_t)(VALUE_LEN & 0xfff) << 44 | options << 56;
+}
+
+static inline uint64_t level_snapshot_pages(uint64_t size, uint64_t page_size)
+{
+    return (size + page_size - 1) & ~(page_size - 1);
+}
+
+/*
+Function: level_snapshot_write()
+        Write a block to a snapshot file and pad it to whole pages; Return 1 if the write fails
+*/
+static uint8_t level_snapshot_write(FILE *file, const void *block, uint64_t size, uint64_t page_size)
+{
+    static const uint8_t zero[512];
+    uint64_t padding = level_snapshot_pages(size, page_size) - size, n;
+    if (size && fwrite(block, size, 1, file) != 1)
+        return 1;
+    for (; padding; padding -= n)
     {
-        barrier_cross(&level->resize_barrier,level_resize,level,thread_id);
+        n = padding < sizeof(zero) ? padding : sizeof(zero);
+        if (fwrite(zero, n, 1, file) != 1)
+            return 1;
     }
+    return 0;
+}
 
-    uint64_t f_hash = F_HASH(level, key);
-    uint64_t s_hash = S_HASH(level, key);
+/*
+Function: level_save()
+        Save a level hash table to a snapshot file, which level_open_snapshot() maps back without rehashing;
+        No other thread may use the hash table meanwhile; The file is written next to path and renamed over it 
+        once complete, so that a table opened from an older snapshot at path keeps its mapping;
+        Return 0 if the snapshot is saved, 1 otherwise
+*/
+uint8_t level_save(level_hash *level, const char *path)
+{
+#ifdef LEVEL_ONLINE_RESIZE
+    // A snapshot holds two levels, so the interim level of a running expanding is migrated first
+    level_table table;
+    level_epoch_enter(level, 0);
+    while (true)
+    {
+        level_online_pause(level, 0);
+        level_table_load(level, &table);
+        if (!table.buckets[2])
+            break;
+        level_migrate(level, &table, UINT64_MAX, 0);
+    }
+    level_epoch_exit(level, 0);
+#endif
+    level_stats stats;
+    level_get_stats(level, &stats, 0);
+
+    level_snapshot_header header;
+    memset(&header, 0, sizeof(level_snapshot_header));
+    header.magic = LEVEL_SNAPSHOT_MAGIC;
+    header.layout = level_snapshot_layout();
+    header.f_seed = level->f_seed;
+    header.s_seed = level->s_seed;
+    header.level_size = level->level_size;
+    header.level_item_num[0] = stats.level_item_num[0];
+    header.level_item_num[1] = stats.level_item_num[1];
+    header.level_expand_time = level->level_resize;
+    header.min_level_size = level->level_size;
+    uint64_t size[2] = {level->addr_capacity * sizeof(level_bucket), level->addr_capacity / 2 * sizeof(level_bucket)};
+    header.page_size = sysconf(_SC_PAGESIZE);
+    header.level_offset[0] = header.page_size;
+    header.level_offset[1] = header.level_offset[0] + level_snapshot_pages(size[0], header.page_size);
+
+    char *tmp_path = malloc(strlen(path) + 5);
+    if (!tmp_path)
+    {
+        printf("The snapshot saving fails: 1\n");
+        return 1;
+    }
+    sprintf(tmp_path, "%s.tmp", path);
+    FILE *file = fopen(tmp_path, "wb");
+    if (!file)
+    {
+        printf("The snapshot saving fails: 2\n");
+        free(tmp_path);
+        return 1;
+    }
+
+    uint8_t failed = level_snapshot_write(file, &header, sizeof(level_snapshot_header), header.page_size)
+        || level_snapshot_write(file, level->buckets[0], size[0], header.page_size)
+        || level_snapshot_write(file, level->buckets[1], size[1], header.page_size)
+        || fflush(file) || fsync(fileno(file));
+    failed |= fclose(file) != 0;
+    if (failed || rename(tmp_path, path))
+    {
+        printf("The snapshot saving fails: 3\n");
+        unlink(tmp_path);
+        free(tmp_path);
+        return 1;
+    }
+    free(tmp_path);
+    return 0;
+}
+
+/*
+Function: level_open_snapshot()
+        Open a level hash table saved by level_save() for num_threads threads; The levels are mapped from the 
+        file copy-on-write, so lookups are served right away from the page cache, while mutations copy the 
+        pages they touch and never reach the file; The locks are allocated anew; 
+        Return NULL if the file is not a snapshot of this build
+*/
+level_hash *level_open_snapshot(const char *path, size_t num_threads)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        printf("The snapshot opening fails: 1\n");
+        return NULL;
+    }
+
+    level_snapshot_header header;
+    struct stat st;
+    if (pread(fd, &header, sizeof(level_snapshot_header), 0) != sizeof(level_snapshot_header) || fstat(fd, &st)
+        || header.magic != LEVEL_SNAPSHOT_MAGIC || header.layout != level_snapshot_layout()
+        || header.level_size < 2 || header.level_size > 62)
+    {
+        printf("The snapshot opening fails: 2\n");
+        close(fd);
+        return NULL;
+    }
+    uint64_t size[2] = {(1ULL << header.level_size) * sizeof(level_bucket), (1ULL << (header.level_size - 1)) * sizeof(level_bucket)};
+    // The levels are mapped at their offsets and unmapped by themselves, so they lie on pages of this machine
+    uint64_t page_size = sysconf(_SC_PAGESIZE);
+    if (!header.page_size || header.page_size & (header.page_size - 1) || header.page_size % page_size
+        || header.level_offset[0] != header.page_size 
+        || header.level_offset[1] != header.level_offset[0] + level_snapshot_pages(size[0], header.page_size)
+        || (uint64_t)st.st_size < header.level_offset[1] + level_snapshot_pages(size[1], header.page_size))
+    {
+        printf("The snapshot opening fails: 3\n");
+        close(fd);
+        return NULL;
+    }
+
+    uint64_t map_size = header.level_offset[1] + level_snapshot_pages(size[1], header.page_size);
+    uint8_t *map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        printf("The snapshot opening fails: 4\n");
+        return NULL;
+    }
+    // The header page is not needed any more, and each level is unmapped by itself once it is freed
+    munmap(map, header.page_size);
+    madvise(map + header.page_size, map_size - header.page_size, MADV_WILLNEED);
+
+    level_hash *level = malloc(sizeof(level_hash));
+    if (!level)
+    {
+        printf("The snapshot opening fails: 5\n");
+        exit(1);
+    }
+    // The default allocator frees a level with munmap() of whole base pages, which also unmaps a level of the file
+    memset(&level->alloc_policy, 0, sizeof(level_alloc_policy));
+    level_allocator_policy(&level->allocator, &level->alloc_policy);
+    level_init_state(level, header.level_size, num_threads);
+    if (!LEVEL_LOCKS_ALLOCATED(level) || !level->thread_stats)
+    {
+        printf("The snapshot opening fails: 6\n");
+        exit(1);
+    }
+    level->buckets[0] = (level_bucket *)(map + header.level_offset[0]);
+    level->buckets[1] = (level_bucket *)(map + header.level_offset[1]);
+    level->f_seed = header.f_seed;
+    level->s_seed = header.s_seed;
+    level->level_resize = header.level_expand_time;
+#ifdef LEVEL_ONLINE_RESIZE
+    level->thread_stats[0].level_item_num[level->level_resize & 3] = header.level_item_num[0];
+    level->thread_stats[0].level_item_num[(uint8_t)(level->level_resize - 1) & 3] = header.level_item_num[1];
+#else
+    level->stats.level_item_num[0] = header.level_item_num[0];
+    level->stats.level_item_num[1] = header.level_item_num[1];
+#endif
+    return level;
+}
+
+/*
+Function: level_search()
+        Search a key whose hash values are already computed and copy its value out;
+*/
+static inline uint8_t level_search(level_hash *level, uint8_t *key, uint8_t *value, uint64_t f_hash, uint64_t s_hash, uint32_t thread_id)
+{
     uint64_t f_idx = F_IDX(f_hash, level->addr_capacity);
     uint64_t s_idx = S_IDX(s_hash, level->addr_capacity);
 
-    uint64_t i, j;
+    uint64_t i;
     for (i = 0; i < 2; i++)
     {
+#ifdef LEVEL_OPTIMISTIC_READ
+        if (!level_bucket_read(&level->buckets[i][f_idx], LEVEL_VERSION(level, i, f_idx), key, value))
+        {
+            LEVEL_STATS_ADD(level, thread_id, hit_probes[2 * i + 1]);
+            return 0;
+        }
+        if (!level_bucket_read(&level->buckets[i][s_idx], LEVEL_VERSION(level, i, s_idx), key, value))
+        {
+            LEVEL_STATS_ADD(level, thread_id, hit_probes[2 * i + 2]);
+            return 0;
+        }
+#else
+        uint64_t j;
+        LEVEL_LOCK_BUCKET(&level->buckets[i][f_idx]);
         for (j = 0; j < ASSOC_NUM; j++)
         {
-            spin_lock(&level->level_locks[i][f_idx].s_lock[j]);
-            if (level->buckets[i][f_idx].token[j] == 1 && strcmp(level->buckets[i][f_idx].slot[j].key, key) == 0)
+            LEVEL_LOCK_SLOT(&level->level_locks[i][f_idx], j);
+            if (GET_TOKEN(level->buckets[i][f_idx].token, j) && level_key_equal(level->buckets[i][f_idx].slot[j].key, key))
             {
                 memcpy(value, level->buckets[i][f_idx].slot[j].value, VALUE_LEN);
-                spin_unlock(&level->level_locks[i][f_idx].s_lock[j]);
+                LEVEL_UNLOCK_SLOT(&level->level_locks[i][f_idx], j);
+                LEVEL_UNLOCK_BUCKET(&level->buckets[i][f_idx], 0);
+                LEVEL_STATS_ADD(level, thread_id, hit_probes[2 * i + 1]);
                 return 0;
             }
-            spin_unlock(&level->level_locks[i][f_idx].s_lock[j]);
+            LEVEL_UNLOCK_SLOT(&level->level_locks[i][f_idx], j);
         }
+        LEVEL_UNLOCK_BUCKET(&level->buckets[i][f_idx], 0);
+        LEVEL_LOCK_BUCKET(&level->buckets[i][s_idx]);
         for (j = 0; j < ASSOC_NUM; j++)
         {
-            spin_lock(&level->level_locks[i][s_idx].s_lock[j]);
-            if (level->buckets[i][s_idx].token[j] == 1 && strcmp(level->buckets[i][s_idx].slot[j].key, key) == 0)
+            LEVEL_LOCK_SLOT(&level->level_locks[i][s_idx], j);
+            if (GET_TOKEN(level->buckets[i][s_idx].token, j) && level_key_equal(level->buckets[i][s_idx].slot[j].key, key))
             {
                 memcpy(value, level->buckets[i][s_idx].slot[j].value, VALUE_LEN);
-                spin_unlock(&level->level_locks[i][s_idx].s_lock[j]);
+                LEVEL_UNLOCK_SLOT(&level->level_locks[i][s_idx], j);
+                LEVEL_UNLOCK_BUCKET(&level->buckets[i][s_idx], 0);
+                LEVEL_STATS_ADD(level, thread_id, hit_probes[2 * i + 2]);
                 return 0;
             }
-            spin_unlock(&level->level_locks[i][s_idx].s_lock[j]);
+            LEVEL_UNLOCK_SLOT(&level->level_locks[i][s_idx], j);
         }
+        LEVEL_UNLOCK_BUCKET(&level->buckets[i][s_idx], 0);
+#endif
         f_idx = F_IDX(f_hash, level->addr_capacity / 2);
         s_idx = S_IDX(s_hash, level->addr_capacity / 2);
     }
 
+    LEVEL_STATS_ADD(level, thread_id, miss_probes[4]);
     return 1;
 }
 
+/*
+Function: level_query()
+        Lookup a key-value item in level hash table;
+*/
+uint8_t level_query(level_hash *level, uint8_t *key, uint8_t *value,uint32_t thread_id)
+{
+#ifdef LEVEL_ONLINE_RESIZE
+    level_epoch_enter(level, thread_id);
+    level_online_pause(level, thread_id);
+    uint8_t result = level_online_apply(level, LEVEL_OP_QUERY, key, value, F_HASH(level, key), S_HASH(level, key), thread_id);
+    level_epoch_exit(level, thread_id);
+    return result;
+#else
+    if (level->need_resizing)
+    {
+        barrier_cross(&level->resize_barrier,level_resize,level,thread_id);
+    }
+
+    return level_search(level, key, value, F_HASH(level, key), S_HASH(level, key), thread_id);
+#endif
+}
+
+/*
+Function: level_query_batch()
+        Lookup n key-value items, copy the value of keys[k] into values[k] and set results[k] 
+        to 0 if it is found, or 1 otherwise;
+        The keys are handled in groups of LEVEL_BATCH_SIZE: all keys of a group are hashed and their four
+        candidate buckets and locks are prefetched before any bucket is probed, so that the cache misses 
+        of different keys overlap; A resizing only happens when all threads cross the barrier,
+        so the bucket locations computed for a group stay valid while it is probed;
+        With LEVEL_ONLINE_RESIZE the whole batch runs in one epoch and each group is prefetched in the
+        levels read before it, which a lookup reads again if they were replaced;
+        Return the number of keys found
+*/
+uint64_t level_query_batch(level_hash *level, uint8_t **keys, uint64_t n, uint8_t **values, uint8_t *results, uint32_t thread_id)
+{
+#ifndef LEVEL_ONLINE_RESIZE
+    if (level->need_resizing)
+    {
+        barrier_cross(&level->resize_barrier,level_resize,level,thread_id);
+    }
+#endif
+
+    uint64_t f_hash[LEVEL_BATCH_SIZE], s_hash[LEVEL_BATCH_SIZE];
+    uint64_t found = 0;
+    uint64_t base, k, batch;
+    uint64_t f_idx, s_idx;
+#ifdef LEVEL_ONLINE_RESIZE
+    level_table table;
+    level_epoch_enter(level, thread_id);
+    level_online_pause(level, thread_id);
+#endif
+
+    for (base = 0; base < n; base += batch)
+    {
+        batch = n - base < LEVEL_BATCH_SIZE ? n - base : LEVEL_BATCH_SIZE;
+
+#ifdef LEVEL_ONLINE_RESIZE
+        level_table_load(level, &table);
+        for (k = 0; k < batch; k++)
+        {
+            f_hash[k] = F_HASH(level, keys[base + k]);
+            s_hash[k] = S_HASH(level, keys[base + k]);
+            f_idx = F_IDX(f_hash[k], table.bucket_num[0]);
+            s_idx = S_IDX(s_hash[k], table.bucket_num[0]);
+            __builtin_prefetch(&table.buckets[0][f_idx]);
+            __builtin_prefetch(&table.buckets[0][s_idx]);
+            f_idx = F_IDX(f_hash[k], table.bucket_num[1]);
+            s_idx = S_IDX(s_hash[k], table.bucket_num[1]);
+            __builtin_prefetch(&table.buckets[1][f_idx]);
+            __builtin_prefetch(&table.buckets[1][s_idx]);
+        }
+
+        for (k = 0; k < batch; k++)
+        {
+            results[base + k] = level_online_apply(level, LEVEL_OP_QUERY, keys[base + k], values[base + k], 
+                f_hash[k], s_hash[k], thread_id);
+            if (results[base + k] == 0)
+                found++;
+        }
+#else
+
+        for (k = 0; k < batch; k++)
+        {
+            f_hash[k] = F_HASH(level, keys[base + k]);
+            s_hash[k] = S_HASH(level, keys[base + k]);
+            f_idx = F_IDX(f_hash[k], level->addr_capacity);
+            s_idx = S_IDX(s_hash[k], level->addr_capacity);
+            __builtin_prefetch(&level->buckets[0][f_idx]);
+            __builtin_prefetch(&level->buckets[0][s_idx]);
+#ifndef LEVEL_BUCKET_LOCK
+            __builtin_prefetch(&level->level_locks[0][f_idx], LEVEL_LOCK_PREFETCH);
+            __builtin_prefetch(&level->level_locks[0][s_idx], LEVEL_LOCK_PREFETCH);
+#endif
+            f_idx = F_IDX(f_hash[k], level->addr_capacity / 2);
+            s_idx = S_IDX(s_hash[k], level->addr_capacity / 2);
+            __builtin_prefetch(&level->buckets[1][f_idx]);
+            __builtin_prefetch(&level->buckets[1][s_idx]);
+#ifndef LEVEL_BUCKET_LOCK
+            __builtin_prefetch(&level->level_locks[1][f_idx], LEVEL_LOCK_PREFETCH);
+            __builtin_prefetch(&level->level_locks[1][s_idx], LEVEL_LOCK_PREFETCH);
+#endif
+        }
+
+        for (k = 0; k < batch; k++)
+        {
+            results[base + k] = level_search(level, keys[base + k], values[base + k], f_hash[k], s_hash[k], thread_id);
+            if (results[base + k] == 0)
+                found++;
+        }
+#endif
+    }
+
+#ifdef LEVEL_ONLINE_RESIZE
+    level_epoch_exit(level, thread_id);
+#endif
+    return found;
+}
+
 /*
 Function: level_delete()
         Remove a key-value item from level hash table;
 */
 uint8_t level_delete(level_hash *level, uint8_t *key,uint32_t thread_id)
 {
+#ifdef LEVEL_ONLINE_RESIZE
+    // Deletions help to migrate the interim level as insertions do
+    level_table table;
+    level_epoch_enter(level, thread_id);
+    level_online_pause(level, thread_id);
+    level_table_load(level, &table);
+    if (table.buckets[2])
+        level_migrate(level, &table, LEVEL_MIGRATE_STEP, thread_id);
+    uint8_t result = level_online_apply(level, LEVEL_OP_DELETE, key, NULL, F_HASH(level, key), S_HASH(level, key), thread_id);
+    level_epoch_exit(level, thread_id);
+    return result;
+#else
     if (level->need_resizing)
     {
         barrier_cross(&level->resize_barrier,level_resize,level,thread_id);
@@ -308,33 +1835,46 @@ uint8_t level_delete(level_hash *level, uint8_t *key,uint32_t thread_id)
     uint64_t i, j;
     for (i = 0; i < 2; i++)
     {
+        LEVEL_LOCK_BUCKET(&level->buckets[i][f_idx]);
         for (j = 0; j < ASSOC_NUM; j++)
         {
-            spin_lock(&level->level_locks[i][f_idx].s_lock[j]);
-            if (level->buckets[i][f_idx].token[j] == 1 && strcmp(level->buckets[i][f_idx].slot[j].key, key) == 0)
+            LEVEL_LOCK_SLOT(&level->level_locks[i][f_idx], j);
+            if (GET_TOKEN(level->buckets[i][f_idx].token, j) && level_key_equal(level->buckets[i][f_idx].slot[j].key, key))
             {
-                level->buckets[i][f_idx].token[j] = 0;
-                spin_unlock(&level->level_locks[i][f_idx].s_lock[j]);
+                level_write_begin(&level->level_locks[i][f_idx]);
+                SET_TOKEN(level->buckets[i][f_idx].token, j, 0);
+                level_write_end(&level->level_locks[i][f_idx]);
+                LEVEL_UNLOCK_SLOT(&level->level_locks[i][f_idx], j);
+                LEVEL_UNLOCK_BUCKET(&level->buckets[i][f_idx], 1);
+                level->thread_stats[thread_id].stats.level_item_num[i]--;
                 return 0;
             }
-            spin_unlock(&level->level_locks[i][f_idx].s_lock[j]);
+            LEVEL_UNLOCK_SLOT(&level->level_locks[i][f_idx], j);
         }
+        LEVEL_UNLOCK_BUCKET(&level->buckets[i][f_idx], 0);
+        LEVEL_LOCK_BUCKET(&level->buckets[i][s_idx]);
         for (j = 0; j < ASSOC_NUM; j++)
         {
-            spin_lock(&level->level_locks[i][s_idx].s_lock[j]);
-            if (level->buckets[i][s_idx].token[j] == 1 && strcmp(level->buckets[i][s_idx].slot[j].key, key) == 0)
+            LEVEL_LOCK_SLOT(&level->level_locks[i][s_idx], j);
+            if (GET_TOKEN(level->buckets[i][s_idx].token, j) && level_key_equal(level->buckets[i][s_idx].slot[j].key, key))
             {
-                level->buckets[i][s_idx].token[j] = 0;
-                spin_unlock(&level->level_locks[i][s_idx].s_lock[j]);
+                level_write_begin(&level->level_locks[i][s_idx]);
+                SET_TOKEN(level->buckets[i][s_idx].token, j, 0);
+                level_write_end(&level->level_locks[i][s_idx]);
+                LEVEL_UNLOCK_SLOT(&level->level_locks[i][s_idx], j);
+                LEVEL_UNLOCK_BUCKET(&level->buckets[i][s_idx], 1);
+                level->thread_stats[thread_id].stats.level_item_num[i]--;
                 return 0;
             }
-            spin_unlock(&level->level_locks[i][s_idx].s_lock[j]);
+            LEVEL_UNLOCK_SLOT(&level->level_locks[i][s_idx], j);
         }
+        LEVEL_UNLOCK_BUCKET(&level->buckets[i][s_idx], 0);
         f_idx = F_IDX(f_hash, level->addr_capacity / 2);
         s_idx = S_IDX(s_hash, level->addr_capacity / 2);
     }
 
     return 1;
+#endif
 }
 
 /*
@@ -344,6 +1884,13 @@ Function: level_update()
 */
 uint8_t level_update(level_hash *level, uint8_t *key, uint8_t *new_value,uint32_t thread_id)
 {
+#ifdef LEVEL_ONLINE_RESIZE
+    level_epoch_enter(level, thread_id);
+    level_online_pause(level, thread_id);
+    uint8_t result = level_online_apply(level, LEVEL_OP_UPDATE, key, new_value, F_HASH(level, key), S_HASH(level, key), thread_id);
+    level_epoch_exit(level, thread_id);
+    return result;
+#else
     if (level->need_resizing)
     {
         barrier_cross(&level->resize_barrier,level_resize,level,thread_id);
@@ -356,33 +1903,44 @@ uint8_t level_update(level_hash *level, uint8_t *key, uint8_t *new_value,uint32_
     uint64_t i, j;
     for (i = 0; i < 2; i++)
     {
+        LEVEL_LOCK_BUCKET(&level->buckets[i][f_idx]);
         for (j = 0; j < ASSOC_NUM; j++)
         {
-            spin_lock(&level->level_locks[i][f_idx].s_lock[j]);
-            if (level->buckets[i][f_idx].token[j] == 1 && strcmp(level->buckets[i][f_idx].slot[j].key, key) == 0)
+            LEVEL_LOCK_SLOT(&level->level_locks[i][f_idx], j);
+            if (GET_TOKEN(level->buckets[i][f_idx].token, j) && level_key_equal(level->buckets[i][f_idx].slot[j].key, key))
             {
+                level_write_begin(&level->level_locks[i][f_idx]);
                 memcpy(level->buckets[i][f_idx].slot[j].value, new_value, VALUE_LEN);
-                spin_unlock(&level->level_locks[i][f_idx].s_lock[j]);
+                level_write_end(&level->level_locks[i][f_idx]);
+                LEVEL_UNLOCK_SLOT(&level->level_locks[i][f_idx], j);
+                LEVEL_UNLOCK_BUCKET(&level->buckets[i][f_idx], 1);
                 return 0;
             }
-            spin_unlock(&level->level_locks[i][f_idx].s_lock[j]);
+            LEVEL_UNLOCK_SLOT(&level->level_locks[i][f_idx], j);
         }
+        LEVEL_UNLOCK_BUCKET(&level->buckets[i][f_idx], 0);
+        LEVEL_LOCK_BUCKET(&level->buckets[i][s_idx]);
         for (j = 0; j < ASSOC_NUM; j++)
         {
-            spin_lock(&level->level_locks[i][s_idx].s_lock[j]);
-            if (level->buckets[i][s_idx].token[j] == 1 && strcmp(level->buckets[i][s_idx].slot[j].key, key) == 0)
+            LEVEL_LOCK_SLOT(&level->level_locks[i][s_idx], j);
+            if (GET_TOKEN(level->buckets[i][s_idx].token, j) && level_key_equal(level->buckets[i][s_idx].slot[j].key, key))
             {
+                level_write_begin(&level->level_locks[i][s_idx]);
                 memcpy(level->buckets[i][s_idx].slot[j].value, new_value, VALUE_LEN);
-                spin_unlock(&level->level_locks[i][s_idx].s_lock[j]);
+                level_write_end(&level->level_locks[i][s_idx]);
+                LEVEL_UNLOCK_SLOT(&level->level_locks[i][s_idx], j);
+                LEVEL_UNLOCK_BUCKET(&level->buckets[i][s_idx], 1);
                 return 0;
             }
-            spin_unlock(&level->level_locks[i][s_idx].s_lock[j]);
+            LEVEL_UNLOCK_SLOT(&level->level_locks[i][s_idx], j);
         }
+        LEVEL_UNLOCK_BUCKET(&level->buckets[i][s_idx], 0);
         f_idx = F_IDX(f_hash, level->addr_capacity / 2);
         s_idx = S_IDX(s_hash, level->addr_capacity / 2);
     }
 
     return 1;
+#endif
 }
 
 /*
@@ -391,47 +1949,55 @@ Function: level_insert()
 */
 uint8_t level_insert(level_hash *level, uint8_t *key, uint8_t *value,uint32_t thread_id)
 {
+#ifdef LEVEL_ONLINE_RESIZE
+    return level_online_insert(level, key, value, thread_id);
+#else
     uint64_t f_hash = F_HASH(level, key);
     uint64_t s_hash = S_HASH(level, key);
-    uint64_t f_idx = F_IDX(f_hash, level->addr_capacity);
-    uint64_t s_idx = S_IDX(s_hash, level->addr_capacity);
+    uint64_t f_idx, s_idx, idx;
 
-    uint64_t i, j;
-    int empty_location;
+    uint64_t i;
+    int slot, empty_location;
+    uint8_t second;
 
     while (true)
     {
         if(level->need_resizing){
             barrier_cross(&level->resize_barrier,level_resize,level,thread_id);
         }
+        // The locations are computed after crossing the barrier since a resizing changes them
+        f_idx = F_IDX(f_hash, level->addr_capacity);
+        s_idx = S_IDX(s_hash, level->addr_capacity);
+
         for (i = 0; i < 2; i++)
         {
-            for (j = 0; j < ASSOC_NUM; j++)
+            // f_idx is below s_idx, so two insertions lock the same two buckets in the same order
+            LEVEL_LOCK_BUCKET(&level->buckets[i][f_idx]);
+            LEVEL_LOCK_BUCKET(&level->buckets[i][s_idx]);
+            /*  The new item is inserted into the less-loaded bucket between
+                the two hash locations in each level
+            */
+            while ((slot = level_pair_empty_slot(&level->buckets[i][f_idx], &level->buckets[i][s_idx], &second)) >= 0)
             {
-                /*  The new item is inserted into the less-loaded bucket between
-                    the two hash locations in each level
-                */
-                spin_lock(&level->level_locks[i][f_idx].s_lock[j]);
-                if (level->buckets[i][f_idx].token[j] == 0)
-                {
-                    memcpy(level->buckets[i][f_idx].slot[j].key, key, KEY_LEN);
-                    memcpy(level->buckets[i][f_idx].slot[j].value, value, VALUE_LEN);
-                    level->buckets[i][f_idx].token[j] = 1;
-                    spin_unlock(&level->level_locks[i][f_idx].s_lock[j]);
-                    return 0;
-                }
-                spin_unlock(&level->level_locks[i][f_idx].s_lock[j]);
-                spin_lock(&level->level_locks[i][s_idx].s_lock[j]);
-                if (level->buckets[i][s_idx].token[j] == 0)
+                idx = second ? s_idx : f_idx;
+                LEVEL_LOCK_SLOT(&level->level_locks[i][idx], slot);
+                if (!GET_TOKEN(level->buckets[i][idx].token, slot))
                 {
-                    memcpy(level->buckets[i][s_idx].slot[j].key, key, KEY_LEN);
-                    memcpy(level->buckets[i][s_idx].slot[j].value, value, VALUE_LEN);
-                    level->buckets[i][s_idx].token[j] = 1;
-                    spin_unlock(&level->level_locks[i][s_idx].s_lock[j]);
+                    level_write_begin(&level->level_locks[i][idx]);
+                    memcpy(level->buckets[i][idx].slot[slot].key, key, KEY_LEN);
+                    memcpy(level->buckets[i][idx].slot[slot].value, value, VALUE_LEN);
+                    SET_TOKEN(level->buckets[i][idx].token, slot, 1);
+                    level_write_end(&level->level_locks[i][idx]);
+                    LEVEL_UNLOCK_SLOT(&level->level_locks[i][idx], slot);
+                    LEVEL_UNLOCK_BUCKET(&level->buckets[i][second ? f_idx : s_idx], 0);
+                    LEVEL_UNLOCK_BUCKET(&level->buckets[i][idx], 1);
+                    level->thread_stats[thread_id].stats.level_item_num[i]++;
                     return 0;
                 }
-                spin_unlock(&level->level_locks[i][s_idx].s_lock[j]);
+                LEVEL_UNLOCK_SLOT(&level->level_locks[i][idx], slot);
             }
+            LEVEL_UNLOCK_BUCKET(&level->buckets[i][s_idx], 0);
+            LEVEL_UNLOCK_BUCKET(&level->buckets[i][f_idx], 0);
 
             f_idx = F_IDX(f_hash, level->addr_capacity / 2);
             s_idx = S_IDX(s_hash, level->addr_capacity / 2);
@@ -442,12 +2008,18 @@ uint8_t level_insert(level_hash *level, uint8_t *key, uint8_t *value,uint32_t th
 
         for (i = 0; i < 2; i++)
         {
+            LEVEL_STATS_ADD(level, thread_id, movement_tries[0]);
             if (!try_movement(level, f_idx, i, key, value))
             {
+                LEVEL_STATS_ADD(level, thread_id, movement_successes[0]);
+                level->thread_stats[thread_id].stats.level_item_num[i]++;
                 return 0;
             }
+            LEVEL_STATS_ADD(level, thread_id, movement_tries[0]);
             if (!try_movement(level, s_idx, i, key, value))
             {
+                LEVEL_STATS_ADD(level, thread_id, movement_successes[0]);
+                level->thread_stats[thread_id].stats.level_item_num[i]++;
                 return 0;
             }
 
@@ -457,23 +2029,35 @@ uint8_t level_insert(level_hash *level, uint8_t *key, uint8_t *value,uint32_t th
 
         if (level->level_resize > 0)
         {
+            LEVEL_STATS_ADD(level, thread_id, movement_tries[1]);
             empty_location = b2t_movement(level, f_idx);
             if (empty_location != -1)
             {
+                // The moved item is now in the top level and the new item takes its slot
+                LEVEL_STATS_ADD(level, thread_id, movement_successes[1]);
+                level->thread_stats[thread_id].stats.level_item_num[0]++;
                 memcpy(level->buckets[1][f_idx].slot[empty_location].key, key, KEY_LEN);
                 memcpy(level->buckets[1][f_idx].slot[empty_location].value, value, VALUE_LEN);
-                level->buckets[1][f_idx].token[empty_location] = 1;
-                spin_unlock(&level->level_locks[1][f_idx].s_lock[empty_location]);
+                SET_TOKEN(level->buckets[1][f_idx].token, empty_location, 1);
+                level_write_end(&level->level_locks[1][f_idx]);
+                LEVEL_UNLOCK_SLOT(&level->level_locks[1][f_idx], empty_location);
+                LEVEL_UNLOCK_BUCKET(&level->buckets[1][f_idx], 1);
                 return 0;
             }
 
+            LEVEL_STATS_ADD(level, thread_id, movement_tries[1]);
             empty_location = b2t_movement(level, s_idx);
             if (empty_location != -1)
             {
+                // The moved item is now in the top level and the new item takes its slot
+                LEVEL_STATS_ADD(level, thread_id, movement_successes[1]);
+                level->thread_stats[thread_id].stats.level_item_num[0]++;
                 memcpy(level->buckets[1][s_idx].slot[empty_location].key, key, KEY_LEN);
                 memcpy(level->buckets[1][s_idx].slot[empty_location].value, value, VALUE_LEN);
-                level->buckets[1][s_idx].token[empty_location] = 1;
-                spin_unlock(&level->level_locks[1][s_idx].s_lock[empty_location]);
+                SET_TOKEN(level->buckets[1][s_idx].token, empty_location, 1);
+                level_write_end(&level->level_locks[1][s_idx]);
+                LEVEL_UNLOCK_SLOT(&level->level_locks[1][s_idx], empty_location);
+                LEVEL_UNLOCK_BUCKET(&level->buckets[1][s_idx], 1);
                 return 0;
             }
         }
@@ -481,108 +2065,365 @@ uint8_t level_insert(level_hash *level, uint8_t *key, uint8_t *value,uint32_t th
     }
 
     return 1;
+#endif
 }
 
 /*
-Function: try_movement()
-        Try to move an item from the current bucket to its same-level alternative bucket;
+Function: level_move()
+        Try to move an item from a bucket to its alternative bucket in the same level, given by its bucket
+        and lock arrays and its number of buckets, and insert the new item into the emptied slot; A level 
+        that no running scan can read is passed with scanned = 0, and its movements are not suspended
 */
-uint8_t try_movement(level_hash *level, uint64_t idx, uint64_t level_num, uint8_t *key, uint8_t *value)
+static uint8_t level_move(level_hash *level, level_bucket *buckets, level_locks *locks, uint64_t bucket_num, 
+    uint64_t idx, uint8_t *key, uint8_t *value, uint8_t scanned)
 {
-    uint64_t i, j, jdx;
+    uint64_t i, jdx;
+    int j;
+
+    if (scanned && level_movement_begin(level))
+        return 1;
 
+    if (LEVEL_LOCK_LIVE_BUCKET(&buckets[idx]))
+    {
+        if (scanned)
+            level_movement_end(level);
+        return 1;
+    }
     for (i = 0; i < ASSOC_NUM; i++)
     {
-        spin_lock(&level->level_locks[level_num][idx].s_lock[i]);
-        uint8_t *m_key = level->buckets[level_num][idx].slot[i].key;
-        uint8_t *m_value = level->buckets[level_num][idx].slot[i].value;
+        LEVEL_LOCK_SLOT(&locks[idx], i);
+        uint8_t *m_key = buckets[idx].slot[i].key;
+        uint8_t *m_value = buckets[idx].slot[i].value;
         uint64_t f_hash = F_HASH(level, m_key);
         uint64_t s_hash = S_HASH(level, m_key);
-        uint64_t f_idx = F_IDX(f_hash, level->addr_capacity / (1 + level_num));
-        uint64_t s_idx = S_IDX(s_hash, level->addr_capacity / (1 + level_num));
+        uint64_t f_idx = F_IDX(f_hash, bucket_num);
+        uint64_t s_idx = S_IDX(s_hash, bucket_num);
 
         if (f_idx == idx)
             jdx = s_idx;
         else
             jdx = f_idx;
 
-        for (j = 0; j < ASSOC_NUM; j++)
+        // Another movement may hold the alternative bucket and wait for this one
+        if (LEVEL_TRYLOCK_BUCKET(&buckets[jdx]))
+        {
+            LEVEL_UNLOCK_SLOT(&locks[idx], i);
+            continue;
+        }
+        while ((j = level_empty_slot(&buckets[jdx])) >= 0)
         {
-            spin_lock(&level->level_locks[level_num][jdx].s_lock[j]);
-            if (level->buckets[level_num][jdx].token[j] == 0)
+            LEVEL_LOCK_SLOT(&locks[jdx], j);
+            if (!GET_TOKEN(buckets[jdx].token, j))
             {
-                memcpy(level->buckets[level_num][jdx].slot[j].key, m_key, KEY_LEN);
-                memcpy(level->buckets[level_num][jdx].slot[j].value, m_value, VALUE_LEN);
-                level->buckets[level_num][jdx].token[j] = 1;
-                level->buckets[level_num][idx].token[i] = 0;
-                spin_unlock(&level->level_locks[level_num][jdx].s_lock[j]);
+                level_write_begin(&locks[jdx]);
+                memcpy(buckets[jdx].slot[j].key, m_key, KEY_LEN);
+                memcpy(buckets[jdx].slot[j].value, m_value, VALUE_LEN);
+                SET_TOKEN(buckets[jdx].token, j, 1);
+                level_write_end(&locks[jdx]);
+                level_write_begin(&locks[idx]);
+                SET_TOKEN(buckets[idx].token, i, 0);
+                LEVEL_UNLOCK_SLOT(&locks[jdx], j);
+                LEVEL_UNLOCK_BUCKET(&buckets[jdx], 1);
                 // The movement is finished and then the new item is inserted
 
-                memcpy(level->buckets[level_num][idx].slot[i].key, key, KEY_LEN);
-                memcpy(level->buckets[level_num][idx].slot[i].value, value, VALUE_LEN);
-                level->buckets[level_num][idx].token[i] = 1;
-                spin_unlock(&level->level_locks[level_num][idx].s_lock[i]);
+                memcpy(buckets[idx].slot[i].key, key, KEY_LEN);
+                memcpy(buckets[idx].slot[i].value, value, VALUE_LEN);
+                SET_TOKEN(buckets[idx].token, i, 1);
+                level_write_end(&locks[idx]);
+                LEVEL_UNLOCK_SLOT(&locks[idx], i);
+                LEVEL_UNLOCK_BUCKET(&buckets[idx], 1);
 
+                if (scanned)
+                    level_movement_end(level);
                 return 0;
             }
-            spin_unlock(&level->level_locks[level_num][jdx].s_lock[j]);
+            LEVEL_UNLOCK_SLOT(&locks[jdx], j);
         }
-        spin_unlock(&level->level_locks[level_num][idx].s_lock[i]);
+        LEVEL_UNLOCK_BUCKET(&buckets[jdx], 0);
+        LEVEL_UNLOCK_SLOT(&locks[idx], i);
     }
+    LEVEL_UNLOCK_BUCKET(&buckets[idx], 0);
 
+    if (scanned)
+        level_movement_end(level);
     return 1;
 }
 
 /*
-Function: b2t_movement()
-        Try to move a bottom-level item to its top-level alternative buckets;
+Function: try_movement()
+        Try to move an item from the current bucket to its same-level alternative bucket;
 */
-int b2t_movement(level_hash *level, uint64_t idx)
+uint8_t try_movement(level_hash *level, uint64_t idx, uint64_t level_num, uint8_t *key, uint8_t *value)
+{
+    return level_move(level, level->buckets[level_num], LEVEL_LOCKS_OF(level, level_num), 
+        level->addr_capacity / (1 + level_num), idx, key, value, 1);
+}
+
+/*
+Function: level_b2t_move()
+        Try to move an item of a bottom-level bucket to its alternative buckets in the top level, which has
+        top_num buckets; On success the emptied slot, or with LEVEL_BUCKET_LOCK its bucket, is left locked 
+        for the caller to fill
+*/
+static int level_b2t_move(level_hash *level, level_bucket *top, level_locks *top_locks, uint64_t top_num,
+    level_bucket *bottom, level_locks *bottom_locks, uint64_t idx)
 {
     uint8_t *key, *value;
     uint64_t s_hash, f_hash;
-    uint64_t s_idx, f_idx;
+    uint64_t s_idx, f_idx, t_idx;
+    uint8_t second;
+    int j;
 
-    uint64_t i, j;
+    if (level_movement_begin(level))
+        return -1;
+
+    uint64_t i;
+    if (LEVEL_LOCK_LIVE_BUCKET(&bottom[idx]))
+    {
+        level_movement_end(level);
+        return -1;
+    }
     for (i = 0; i < ASSOC_NUM; i++)
     {
-        spin_lock(&level->level_locks[1][idx].s_lock[i]);
-        key = level->buckets[1][idx].slot[i].key;
-        value = level->buckets[1][idx].slot[i].value;
+        LEVEL_LOCK_SLOT(&bottom_locks[idx], i);
+        key = bottom[idx].slot[i].key;
+        value = bottom[idx].slot[i].value;
         f_hash = F_HASH(level, key);
         s_hash = S_HASH(level, key);
-        f_idx = F_IDX(f_hash, level->addr_capacity);
-        s_idx = S_IDX(s_hash, level->addr_capacity);
+        f_idx = F_IDX(f_hash, top_num);
+        s_idx = S_IDX(s_hash, top_num);
 
-        for (j = 0; j < ASSOC_NUM; j++)
+        // No thread holds a top-level bucket while it waits for a bottom-level one
+        if (LEVEL_LOCK_LIVE_BUCKET(&top[f_idx]))
+        {
+            LEVEL_UNLOCK_SLOT(&bottom_locks[idx], i);
+            break;
+        }
+        if (LEVEL_LOCK_LIVE_BUCKET(&top[s_idx]))
+        {
+            LEVEL_UNLOCK_BUCKET(&top[f_idx], 0);
+            LEVEL_UNLOCK_SLOT(&bottom_locks[idx], i);
+            break;
+        }
+        while ((j = level_pair_empty_slot(&top[f_idx], &top[s_idx], &second)) >= 0)
         {
-            spin_lock(&level->level_locks[0][f_idx].s_lock[j]);
-            if (level->buckets[0][f_idx].token[j] == 0)
+            t_idx = second ? s_idx : f_idx;
+            LEVEL_LOCK_SLOT(&top_locks[t_idx], j);
+            if (!GET_TOKEN(top[t_idx].token, j))
             {
-                memcpy(level->buckets[0][f_idx].slot[j].key, key, KEY_LEN);
-                memcpy(level->buckets[0][f_idx].slot[j].value, value, VALUE_LEN);
-                level->buckets[0][f_idx].token[j] = 1;
-                level->buckets[1][idx].token[i] = 0;
-                spin_unlock(&level->level_locks[0][f_idx].s_lock[j]);
+                level_write_begin(&top_locks[t_idx]);
+                memcpy(top[t_idx].slot[j].key, key, KEY_LEN);
+                memcpy(top[t_idx].slot[j].value, value, VALUE_LEN);
+                SET_TOKEN(top[t_idx].token, j, 1);
+                level_write_end(&top_locks[t_idx]);
+                // The bottom-level slot stays announced until the caller fills it and unlocks it
+                level_write_begin(&bottom_locks[idx]);
+                SET_TOKEN(bottom[idx].token, i, 0);
+                LEVEL_UNLOCK_SLOT(&top_locks[t_idx], j);
+                LEVEL_UNLOCK_BUCKET(&top[second ? f_idx : s_idx], 0);
+                LEVEL_UNLOCK_BUCKET(&top[t_idx], 1);
+                level_movement_end(level);
                 return i;
             }
-            spin_unlock(&level->level_locks[0][f_idx].s_lock[j]);
-            spin_lock(&level->level_locks[0][s_idx].s_lock[j]);
-            if (level->buckets[0][s_idx].token[j] == 0)
+            LEVEL_UNLOCK_SLOT(&top_locks[t_idx], j);
+        }
+        LEVEL_UNLOCK_BUCKET(&top[s_idx], 0);
+        LEVEL_UNLOCK_BUCKET(&top[f_idx], 0);
+        LEVEL_UNLOCK_SLOT(&bottom_locks[idx], i);
+    }
+    LEVEL_UNLOCK_BUCKET(&bottom[idx], 0);
+
+    level_movement_end(level);
+    return -1;
+}
+
+/*
+Function: b2t_movement()
+        Try to move a bottom-level item to its top-level alternative buckets;
+*/
+int b2t_movement(level_hash *level, uint64_t idx)
+{
+    return level_b2t_move(level, level->buckets[0], LEVEL_LOCKS_OF(level, 0), level->addr_capacity,
+        level->buckets[1], LEVEL_LOCKS_OF(level, 1), idx);
+}
+
+/*
+Function: level_iter_begin()
+        Begin a scan over all items, top level first; The scan holds no lock across steps: a resizing
+        may run between two steps, and item movements are suspended until the scan ends, so that 
+        every item is produced at most once; Every scan must be closed by level_iter_end();
+        An insertion that needs a movement during a scan expands the table instead, so a long scan 
+        under insertions may double the table several times at a low load factor
+*/
+void level_iter_begin(level_hash *level, level_iter *iter, uint32_t thread_id)
+{
+#ifndef LEVEL_ONLINE_RESIZE
+    if (level->need_resizing)
+    {
+        barrier_cross(&level->resize_barrier,level_resize,level,thread_id);
+    }
+#endif
+
+    iter->level = level;
+    iter->thread_id = thread_id;
+#ifdef LEVEL_ONLINE_RESIZE
+    /*  A running migration is finished before the scan is announced, so the scan begins with two levels and 
+        no migration runs with the scan reading its top level; A later expanding puts the items of the old 
+        bottom level only into the new top level, which the scan skips, and leaves them in the migrated 
+        buckets, from which the scan reads them; No level is freed until the last scan ends
+    */
+    level_table table;
+    level_epoch_enter(level, thread_id);
+    while (true)
+    {
+        level_online_pause(level, thread_id);
+        level_table_load(level, &table);
+        if (table.buckets[2])
+        {
+            level_migrate(level, &table, UINT64_MAX, thread_id);
+            cpu_relax();
+            continue;
+        }
+        __atomic_add_fetch(&level->iter_num, 1, __ATOMIC_SEQ_CST);
+        level_table_load(level, &table);
+        if (!table.buckets[2])
+            break;
+        // An expanding began before the scan was announced
+        __atomic_sub_fetch(&level->iter_num, 1, __ATOMIC_SEQ_CST);
+    }
+    level_epoch_exit(level, thread_id);
+    // Wait for the movements that began before the scan was announced
+    while (__atomic_load_n(&level->mover_num, __ATOMIC_SEQ_CST))
+        cpu_relax();
+    iter->resize_epoch = table.generation;
+    iter->buckets[0] = table.buckets[0];
+    iter->buckets[1] = table.buckets[1];
+    iter->bucket_num[0] = table.bucket_num[0];
+    iter->bucket_num[1] = table.bucket_num[1];
+#else
+    // Wait for the movements that began before the scan was announced
+    __atomic_add_fetch(&level->iter_num, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&level->mover_num, __ATOMIC_SEQ_CST))
+        cpu_relax();
+
+    iter->resize_epoch = level->level_resize;
+    iter->buckets[0] = level->buckets[0];
+    iter->buckets[1] = level->buckets[1];
+#ifndef LEVEL_BUCKET_LOCK
+    iter->locks[0] = level->level_locks[0];
+    iter->locks[1] = level->level_locks[1];
+#endif
+    iter->bucket_num[0] = level->addr_capacity;
+    iter->bucket_num[1] = level->addr_capacity / 2;
+#endif
+    iter->level_num = 0;
+    iter->bucket = 0;
+    iter->slot = 0;
+}
+
+/*
+Function: level_iter_next()
+        Copy the next item of a scan out, return 0 if there is one and 1 if the scan is finished;
+        A resizing keeps the old top level as the new bottom level and rehashes the old bottom level 
+        into a new top level, which the scan skips: the old bottom level is retired as it was, and the 
+        scan reads the items it has not reached yet from it without locks, so they are produced once;
+        Items inserted during the scan may or may not be produced
+*/
+uint8_t level_iter_next(level_iter *iter, uint8_t *key, uint8_t *value)
+{
+#ifndef LEVEL_ONLINE_RESIZE
+    level_hash *level = iter->level;
+    if (level->need_resizing)
+    {
+        barrier_cross(&level->resize_barrier,level_resize,level,iter->thread_id);
+    }
+#endif
+
+#ifndef LEVEL_BUCKET_LOCK
+    // A retired level keeps the lock words in its buckets, but its lock array is freed by the resizing
+    if (iter->resize_epoch != level->level_resize)
+    {
+        uint64_t i;
+        for (i = 0; i < 2; i++)
+        {
+            if (iter->buckets[i] != level->buckets[0] && iter->buckets[i] != level->buckets[1])
+                iter->locks[i] = NULL;
+        }
+        iter->resize_epoch = level->level_resize;
+    }
+#endif
+
+    for (; iter->level_num < 2; iter->level_num++, iter->bucket = 0)
+    {
+        level_bucket *buckets = iter->buckets[iter->level_num];
+#ifndef LEVEL_BUCKET_LOCK
+        level_locks *locks = iter->locks[iter->level_num];
+#endif
+        uint64_t bucket_num = iter->bucket_num[iter->level_num];
+
+        for (; iter->bucket < bucket_num; iter->bucket++, iter->slot = 0)
+        {
+            if (iter->slot == 0 && iter->bucket + LEVEL_ITER_PREFETCH < bucket_num)
+                __builtin_prefetch(&buckets[iter->bucket + LEVEL_ITER_PREFETCH]);
+
+            level_bucket *bucket = &buckets[iter->bucket];
+            // A migrated bucket is read-only and is read without its lock
+            uint8_t migrated = LEVEL_LOCK_LIVE_BUCKET(bucket);
+            for (; iter->slot < ASSOC_NUM; iter->slot++)
             {
-                memcpy(level->buckets[0][s_idx].slot[j].key, key, KEY_LEN);
-                memcpy(level->buckets[0][s_idx].slot[j].value, value, VALUE_LEN);
-                level->buckets[0][s_idx].token[j] = 1;
-                level->buckets[1][idx].token[i] = 0;
-                spin_unlock(&level->level_locks[0][s_idx].s_lock[j]);
-                return i;
+                uint64_t j = iter->slot;
+                uint8_t found;
+
+#ifndef LEVEL_BUCKET_LOCK
+                if (locks)
+                    spin_lock(&locks[iter->bucket].s_lock[j]);
+#endif
+                found = GET_TOKEN(bucket->token, j);
+                if (found)
+                {
+                    memcpy(key, bucket->slot[j].key, KEY_LEN);
+                    memcpy(value, bucket->slot[j].value, VALUE_LEN);
+                }
+#ifndef LEVEL_BUCKET_LOCK
+                if (locks)
+                    spin_unlock(&locks[iter->bucket].s_lock[j]);
+#endif
+
+                if (found)
+                {
+                    if (!migrated)
+                        LEVEL_UNLOCK_BUCKET(bucket, 0);
+                    iter->slot++;
+                    return 0;
+                }
             }
-            spin_unlock(&level->level_locks[0][s_idx].s_lock[j]);
+            if (!migrated)
+                LEVEL_UNLOCK_BUCKET(bucket, 0);
         }
-        spin_unlock(&level->level_locks[1][idx].s_lock[i]);
     }
 
-    return -1;
+    return 1;
+}
+
+/*
+Function: level_iter_end()
+        End a scan; The last running scan frees the levels retired during scans
+*/
+void level_iter_end(level_iter *iter)
+{
+#ifdef LEVEL_ONLINE_RESIZE
+    // The levels are freed once no operation can read them either
+    if (__atomic_sub_fetch(&iter->level->iter_num, 1, __ATOMIC_SEQ_CST) == 0)
+    {
+        spin_lock(&iter->level->resize_lock);
+        level_reclaim(iter->level);
+        spin_unlock(&iter->level->resize_lock);
+    }
+#else
+    if (__atomic_sub_fetch(&iter->level->iter_num, 1, __ATOMIC_SEQ_CST) == 0)
+        level_free_retired(iter->level);
+#endif
+    iter->level = NULL;
 }
 
 /*
@@ -591,8 +2432,18 @@ Function: level_destroy()
 */
 void level_destroy(level_hash *level)
 {
-    free(level->buckets[0]);
-    free(level->buckets[1]);
+    level_block_free(level, level->buckets[0], pow(2, level->level_size) * sizeof(level_bucket));
+    level_block_free(level, level->buckets[1], pow(2, level->level_size - 1) * sizeof(level_bucket));
+#ifndef LEVEL_BUCKET_LOCK
+    level_block_free(level, level->level_locks[0], pow(2, level->level_size) * sizeof(level_locks));
+    level_block_free(level, level->level_locks[1], pow(2, level->level_size - 1) * sizeof(level_locks));
+#endif
+#ifdef LEVEL_ONLINE_RESIZE
+    if (level->interim_level_buckets)
+        level_block_free(level, level->interim_level_buckets, level->interim_bucket_num * sizeof(level_bucket));
+#endif
+    level_free_retired(level);
+    level_block_free(level, level->thread_stats, level->thread_num * sizeof(level_thread_stats));
     level = NULL;
 }
 
@@ -9,11 +9,22 @@
 #include "hash.h"
 #include <stdbool.h>
 #include "spinlock.h"
+#include "level_alloc.h"
 
 #define ASSOC_NUM 4                       // The number of slots in a bucket
 #define KEY_LEN 16                        // The maximum length of a key
 #define VALUE_LEN 16                      // The maximum length of a value
 #define READ_WRITE_NUM 200000000            // The total number of read and write operations in the workload
+#define LEVEL_BATCH_SIZE 32               // The number of keys whose buckets are prefetched together in level_query_batch()
+#define LEVEL_ITER_PREFETCH 8             // The number of buckets a scan prefetches ahead of its cursor
+#define LEVEL_SNAPSHOT_MAGIC 0x50414e534c56454cULL    // "LEVLSNAP", the first bytes of a snapshot file
+#ifdef LEVEL_ONLINE_RESIZE
+#define LEVEL_STATS_PROBE_NUM 7           // Lookups probe up to 6 buckets: two in each level and two in the interim level
+#else
+#define LEVEL_STATS_PROBE_NUM 5           // Lookups probe up to 4 buckets: two in each level
+#endif
+#define LEVEL_MIGRATE_STEP 4              // The number of interim buckets migrated by each insertion or deletion during an online resizing
+#define LEVEL_MIGRATE_RETRY 64            // The number of times a migration retries an item that fits nowhere before it gives up the bucket
 
 typedef struct entry{                     // A slot storing a key-value item 
     uint8_t key[KEY_LEN];
@@ -27,19 +38,121 @@ typedef struct barrier {
     int crossing;
 } barrier;
 
+/*  Compile-time options, enabled with -D in CFLAGS:
+    LEVEL_ALIGNED_BUCKET    Align each bucket to cache lines; the occupancy bitmap fills a header line, which leaves
+                            room for fingerprints, and the slots start at the next line; The allocator of the hash
+                            table is asked for blocks aligned to cache lines
+    LEVEL_BINARY_KEY        Treat each key as exactly KEY_LEN bytes, which may include 0x00: keys are hashed over
+                            all KEY_LEN bytes and compared with one 16-byte SSE2 compare instead of strcmp()
+    LEVEL_BUCKET_LOCK       Lock whole buckets with a lock word in the header of each bucket instead of the separate
+                            arrays of slot locks; The word doubles as the version checked by LEVEL_OPTIMISTIC_READ
+    LEVEL_ONLINE_RESIZE     Expand without stopping the threads: a new top level is published at once, the old bottom
+                            level becomes an interim level that lookups also probe, and insertions and deletions
+                            migrate it LEVEL_MIGRATE_STEP buckets at a time; A migration that finds no room for an
+                            item pauses the threads and rehashes the rest into another new level; The old levels
+                            are freed once no operation can still see them; Needs LEVEL_BUCKET_LOCK
+    LEVEL_OPTIMISTIC_READ   Serve lookups without locks: the writers of a bucket bump its version around each change,
+                            and a lookup reads the bucket, then checks that its version is unchanged or reads it again
+    LEVEL_STATS             Count the buckets probed by each lookup and the movements tried by insertions for
+                            level_get_stats(); The other statistics are always kept
+*/
+
+#if defined(LEVEL_BINARY_KEY) && KEY_LEN != 16
+#error "LEVEL_BINARY_KEY compares a key with one 16-byte load"
+#endif
+
+#if defined(LEVEL_ONLINE_RESIZE) && !defined(LEVEL_BUCKET_LOCK)
+#error "LEVEL_ONLINE_RESIZE marks the migrated buckets in their lock words, which needs LEVEL_BUCKET_LOCK"
+#endif
+
+#ifdef LEVEL_ALIGNED_BUCKET
+#define CACHE_LINE_SIZE 64
+
+typedef struct level_bucket               // A bucket aligned to cache lines
+{
+    uint32_t token;                       // Each bit in the last ASSOC_NUM bits indicates whether its corresponding slot is occupied
+#ifdef LEVEL_BUCKET_LOCK
+    uint32_t lock;                        // Odd while the bucket is locked, bumped to the next even version by a change
+#endif
+    entry slot[ASSOC_NUM] __attribute__((aligned(CACHE_LINE_SIZE)));    // The slots start at a new cache line behind the header
+} __attribute__((aligned(CACHE_LINE_SIZE))) level_bucket;
+
+// The slots of a bucket are locked separately, so the bits of the shared bitmap are set and cleared atomically
+#define GET_TOKEN(token, n) ((__atomic_load_n(&(token), __ATOMIC_ACQUIRE) >> (n)) & 1)
+#define SET_TOKEN(token, n, bit) ((bit) ? __atomic_fetch_or(&(token), 1U << (n), __ATOMIC_RELEASE) \
+                                        : __atomic_fetch_and(&(token), ~(1U << (n)), __ATOMIC_RELEASE))
+#else
 typedef struct level_bucket               // A bucket
 {
     uint8_t token[ASSOC_NUM];             // A token indicates whether its corresponding slot is empty, which can also be implemented using 1 bit
+#ifdef LEVEL_BUCKET_LOCK
+    uint32_t lock;                        // Odd while the bucket is locked, bumped to the next even version by a change
+#endif
     entry slot[ASSOC_NUM];
 } level_bucket;
 
+#define GET_TOKEN(token, n) ((token)[n])
+#define SET_TOKEN(token, n, bit) ((token)[n] = (bit))
+#endif
+
+#ifdef LEVEL_BUCKET_LOCK
+#define LEVEL_VERSION_WRITERS 1           // The lowest bit of a bucket lock word is set by the only writer of the bucket
+#define LEVEL_BUCKET_MIGRATED 0x80000000U // The highest bit is set once the items of an interim bucket are migrated
+#elif defined(LEVEL_OPTIMISTIC_READ)
+#define LEVEL_VERSION_WRITERS 0xff        // The low bits of a bucket version count the writers changing the bucket
+#define LEVEL_VERSION_STEP 0x100          // and the high bits count the finished changes
+#endif
+
 typedef struct level_locks{
     spinlock s_lock[ASSOC_NUM];
+#ifdef LEVEL_OPTIMISTIC_READ
+    uint32_t version;                     // The version of the bucket, checked by the lookups reading it without locks
+#endif
 } level_locks;
 
+typedef struct level_retired{             // A bottom level replaced by a resizing while scans were running
+    level_bucket *buckets;
+    uint64_t size;                        // The size of the bucket array in bytes
+#ifdef LEVEL_ONLINE_RESIZE
+    uint64_t epoch;                       // The epoch in which it was retired, freed once every thread has left it
+#endif
+    struct level_retired *next;
+} level_retired;
+
+typedef struct level_stats{               // The statistics of a level hash table, filled by level_get_stats()
+    uint64_t level_item_num[2];           // The numbers of items in the top and bottom levels
+    uint64_t level_slot_num[2];           // The numbers of slots in the top and bottom levels
+    uint64_t interim_item_num;            // The items not migrated yet by an online resizing, otherwise always 0
+    uint64_t occupancy[ASSOC_NUM + 1];    // occupancy[k]: the number of buckets holding k items, only filled by a bucket scan
+    uint64_t hit_probes[LEVEL_STATS_PROBE_NUM];   // hit_probes[k]: the lookups that found the key in the k-th bucket probed
+    uint64_t miss_probes[LEVEL_STATS_PROBE_NUM];  // miss_probes[k]: the lookups that missed after probing k buckets
+    uint64_t movement_tries[2];           // The same-level and bottom-to-top movements tried by insertions
+    uint64_t movement_successes[2];       // and how many of them made room for the new item
+    uint64_t expand_num;
+    uint64_t shrink_num;
+    uint64_t expand_ns;                   // The time spent in expanding and shrinking
+    uint64_t shrink_ns;
+    uint64_t bucket_bytes;                // The memory allocated for buckets, locks, logs and value cells
+    uint64_t lock_bytes;
+    uint64_t log_bytes;
+    uint64_t value_bytes;
+} level_stats;
+
+typedef struct level_thread_stats{        // The counters of one thread, on cache lines of their own
+    level_stats stats;                    // The item counts are the changes made by the thread since the last resizing
+#ifdef LEVEL_ONLINE_RESIZE
+    uint64_t epoch;                       // The epoch seen by the running operation of the thread, 0 between operations
+    uint64_t level_item_num[4];           // The changes of the item counts of each level, by level_resize at its creation modulo 4
+#endif
+} __attribute__((aligned(64))) level_thread_stats;
+
 typedef struct level_hash {               // A Level hash table
     level_bucket *buckets[2];             // The top level and bottom level in the Level hash table
+#ifndef LEVEL_BUCKET_LOCK
     level_locks* level_locks[2];          // Allocate a fine-grained lock for each slot
+#endif
+    level_alloc_policy alloc_policy;      // Where and how the buckets and locks are allocated by the default allocator
+    level_allocator allocator;            // Allocates and frees the buckets, locks and per-thread counters
 
     uint32_t thread_num;
     uint64_t addr_capacity;               // The number of buckets in the top level
@@ -47,11 +160,53 @@ typedef struct level_hash {               // A Level hash table
     uint64_t level_size;                  // level_size = log2(addr_capacity)
     uint8_t level_resize;                 // Indicate whether the Level hash table was resized, "1": Yes, "0": No;
     barrier resize_barrier;
-    bool need_resizing;
+    bool need_resizing;                   // Set to pause the threads for a resizing, or for a stuck migration with LEVEL_ONLINE_RESIZE
+    uint32_t iter_num;                    // The number of running scans, during which items are not moved between buckets
+    uint32_t mover_num;                   // The number of item movements in progress
+    level_retired *retired;               // The levels retired during scans, freed when the last scan ends
+    level_stats stats;                    // The item counts up to the last resizing and the resizing counters
+    level_thread_stats *thread_stats;     // The counters of each thread, summed up by level_get_stats()
+#ifdef LEVEL_ONLINE_RESIZE
+    level_bucket *interim_level_buckets;  // The old bottom level whose items are being migrated, or NULL
+    uint64_t interim_bucket_num;          // The number of buckets in the interim level
+    uint64_t migrate_cursor;              // level_resize in the top byte and the next interim bucket to be migrated
+    uint64_t migrate_done;                // The number of interim buckets migrated so far
+    uint64_t resize_begin;                // When the running resizing began, in nanoseconds
+    uint32_t table_seq;                   // Odd while a resizing replaces the levels, which are read under it
+    spinlock resize_lock;                 // Held to start or finish a resizing and to free retired levels
+    uint64_t epoch;                       // The global epoch, advanced whenever a level is retired
+#endif
     uint64_t f_seed;
     uint64_t s_seed;                      // Two randomized seeds for hash functions
 } level_hash;
 
+typedef struct level_snapshot_header{     // The first page of a snapshot file, followed by the top and bottom levels as they are in memory
+    uint64_t magic;
+    uint64_t layout;                      // The bucket size, KEY_LEN, VALUE_LEN and the options changing the buckets, which must match to open the file
+    uint64_t f_seed;
+    uint64_t s_seed;
+    uint64_t level_size;
+    uint64_t level_item_num[2];
+    uint64_t level_expand_time;           // level_resize of the hash table
+    uint64_t min_level_size;              // Unused, kept for the layout shared with the single-threaded variant
+    uint64_t level_offset[2];             // The file offsets of the top and bottom levels
+    uint64_t page_size;                   // The page size of the saving machine, to which the header and the levels are padded
+} level_snapshot_header;
+
+typedef struct level_iter{                // A cursor scanning all items of a level hash table, top level first
+    level_hash *level;
+    uint32_t thread_id;
+    uint8_t resize_epoch;                 // The value of level_resize seen by the last step
+    level_bucket *buckets[2];             // The top and bottom levels when the scan began
+#ifndef LEVEL_BUCKET_LOCK
+    level_locks *locks[2];                // Set to NULL once a level is retired by a resizing, which leaves it read-only
+#endif
+    uint64_t bucket_num[2];
+    uint64_t level_num;
+    uint64_t bucket;
+    uint64_t slot;                        // The next slot to visit
+} level_iter;
+
 typedef struct thread_queue{
     uint8_t key[KEY_LEN];
     uint8_t operation;                    // 0: read, 1: insert;
@@ -68,10 +223,16 @@ typedef struct sub_thread{
 
 level_hash *level_init(uint64_t level_size,size_t num_threads);     
 
+level_hash *level_init_policy(uint64_t level_size, size_t num_threads, const level_alloc_policy *policy);
+
+level_hash *level_init_ex(uint64_t level_size, size_t num_threads, const level_allocator *allocator);
+
 uint8_t level_insert(level_hash *level, uint8_t *key, uint8_t *value,uint32_t thread_id);          
 
 uint8_t level_query(level_hash *level, uint8_t *key, uint8_t *value,uint32_t thread_id);
 
+uint64_t level_query_batch(level_hash *level, uint8_t **keys, uint64_t n, uint8_t **values, uint8_t *results, uint32_t thread_id);
+
 uint8_t level_delete(level_hash *level, uint8_t*key,uint32_t thread_id);
 
 uint8_t level_update(level_hash *level, uint8_t *key, uint8_t *new_value,uint32_t thread_id);
@@ -82,10 +243,22 @@ uint8_t try_movement(level_hash *level, uint64_t idx, uint64_t level_num, uint8_
 
 int b2t_movement(level_hash *level, uint64_t idx);
 
+void level_iter_begin(level_hash *level, level_iter *iter, uint32_t thread_id);
+
+uint8_t level_iter_next(level_iter *iter, uint8_t *key, uint8_t *value);
+
+void level_iter_end(level_iter *iter);
+
 void level_destroy(level_hash *level);
 
+void level_get_stats(level_hash *level, level_stats *stats, uint8_t scan);
+
 void level_statistic(level_hash *level);
 
+uint8_t level_save(level_hash *level, const char *path);
+
+level_hash *level_open_snapshot(const char *path, size_t num_threads);
+
 void ycsb_thread_run(void* arg);
 
 void thread_insert(void* arg);
@@ -0,0 +1,129 @@
+/*  Test:
+    Fill the top and bottom levels while an online expanding is migrating, so that no interim item fits anywhere,
+    and check that the threads inserting meanwhile neither hang nor lose an item: the stuck migration must end in
+    a stop-the-world expanding; The static functions are reached by building the hash table into the test
+*/
+#include <unistd.h>
+#include "level_hashing.c"
+
+#define MIGRATE_TEST_THREADS 4
+#define MIGRATE_TEST_ITEMS 256            // The items inserted before the expanding, and by each thread after it
+#define MIGRATE_TEST_TIMEOUT 60           // A hang is reported by SIGALRM after that many seconds
+
+typedef struct migrate_test_thread{
+    level_hash *level;
+    uint32_t id;
+    uint64_t lost;
+} migrate_test_thread;
+
+/*
+Function: migrate_test_fill()
+        Put a filler item into every empty slot of a level, counted for thread 0 in the level created at
+        generation
+*/
+static uint64_t migrate_test_fill(level_hash *level, level_bucket *buckets, uint64_t bucket_num, uint8_t generation)
+{
+    uint64_t i, j, filled = 0;
+    uint8_t key[KEY_LEN];
+
+    for (i = 0; i < bucket_num; i++)
+    {
+        for (j = 0; j < ASSOC_NUM; j++)
+        {
+            if (GET_TOKEN(buckets[i].token, j))
+                continue;
+            memset(key, 0, KEY_LEN);
+            snprintf((char *)key, KEY_LEN, "f%u_%lu_%lu", generation, i, j);
+            memcpy(buckets[i].slot[j].key, key, KEY_LEN);
+            memcpy(buckets[i].slot[j].value, key, VALUE_LEN);
+            SET_TOKEN(buckets[i].token, j, 1);
+            filled++;
+        }
+    }
+    level->thread_stats[0].level_item_num[generation & 3] += filled;
+    return filled;
+}
+
+static void *migrate_test_insert(void *arg)
+{
+    migrate_test_thread *thread = arg;
+    uint8_t key[KEY_LEN], value[VALUE_LEN];
+    uint64_t i;
+
+    for (i = 0; i < MIGRATE_TEST_ITEMS; i++)
+    {
+        memset(key, 0, KEY_LEN);
+        snprintf((char *)key, KEY_LEN, "n%u_%lu", thread->id, i);
+        level_insert(thread->level, key, key, thread->id);
+    }
+    for (i = 0; i < MIGRATE_TEST_ITEMS; i++)
+    {
+        memset(key, 0, KEY_LEN);
+        snprintf((char *)key, KEY_LEN, "n%u_%lu", thread->id, i);
+        if (level_query(thread->level, key, value, thread->id) || memcmp(key, value, VALUE_LEN))
+            thread->lost++;
+    }
+    return NULL;
+}
+
+int main()
+{
+    level_hash *level = level_init(4, MIGRATE_TEST_THREADS);
+    migrate_test_thread threads[MIGRATE_TEST_THREADS];
+    pthread_t tids[MIGRATE_TEST_THREADS];
+    uint8_t key[KEY_LEN], value[VALUE_LEN];
+    uint64_t i, j, k, total, lost = 0;
+    level_stats stats;
+
+    alarm(MIGRATE_TEST_TIMEOUT);
+    for (i = 0; i < MIGRATE_TEST_ITEMS; i++)
+    {
+        memset(key, 0, KEY_LEN);
+        snprintf((char *)key, KEY_LEN, "k%lu", i);
+        level_insert(level, key, key, 0);
+    }
+    total = MIGRATE_TEST_ITEMS;
+
+    // The expanding leaves the old bottom level as the interim level, which no operation has migrated yet
+    level_resize(level, 0);
+    if (!level->interim_level_buckets)
+    {
+        printf("MIGRATE FAIL: no interim level\n");
+        return 1;
+    }
+    total += migrate_test_fill(level, level->buckets[0], level->addr_capacity, level->level_resize);
+    total += migrate_test_fill(level, level->buckets[1], level->addr_capacity / 2, level->level_resize - 1);
+
+    for (k = 0; k < MIGRATE_TEST_THREADS; k++)
+    {
+        threads[k].level = level;
+        threads[k].id = k;
+        threads[k].lost = 0;
+        pthread_create(&tids[k], NULL, migrate_test_insert, &threads[k]);
+    }
+    for (k = 0; k < MIGRATE_TEST_THREADS; k++)
+    {
+        pthread_join(tids[k], NULL);
+        lost += threads[k].lost;
+    }
+    total += MIGRATE_TEST_THREADS * MIGRATE_TEST_ITEMS;
+
+    for (i = 0; i < MIGRATE_TEST_ITEMS; i++)
+    {
+        memset(key, 0, KEY_LEN);
+        snprintf((char *)key, KEY_LEN, "k%lu", i);
+        if (level_query(level, key, value, 0) || memcmp(key, value, VALUE_LEN))
+            lost++;
+    }
+
+    level_get_stats(level, &stats, 0);
+    j = stats.level_item_num[0] + stats.level_item_num[1] + stats.interim_item_num;
+    if (lost || j != total || stats.expand_num < 2)
+    {
+        printf("MIGRATE FAIL: %lu items lost, %lu counted of %lu, %lu expandings\n", lost, j, total, stats.expand_num);
+        return 1;
+    }
+    printf("MIGRATE OK: %lu items, %lu expandings\n", total, stats.expand_num);
+    level_destroy(level);
+    return 0;
+}
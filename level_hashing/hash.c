@@ -154,3 +154,141 @@ uint64_t hash(const void *data, uint64_t length, uint64_t seed)
     }
     return string_key_hash_computation(data, length, seed, 0);
 }
+
+
+/*
+Function: hash_round() 
+        Mix one 8-byte lane of the key into an accumulator
+*/
+static inline uint64_t hash_round(uint64_t acc, uint64_t input)
+{
+    acc += input * NUMBER64_2;
+    acc = shifting_hash(acc, 31);
+    return acc * NUMBER64_1;
+}
+
+/*
+Function: hash_merge_round() 
+        Merge an accumulator into the hash value after the 32-byte stripes
+*/
+static inline uint64_t hash_merge_round(uint64_t hash, uint64_t acc)
+{
+    hash ^= hash_round(0, acc);
+    return hash * NUMBER64_1 + NUMBER64_4;
+}
+
+static inline uint64_t hash_avalanche(uint64_t hash)
+{
+    hash ^= hash >> 33;
+    hash *= NUMBER64_2;
+    hash ^= hash >> 29;
+    hash *= NUMBER64_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+/*
+Function: string_key_hash_pair_computation() 
+        Compute the hash values of a string key under two seeds in a single pass over the key;
+        The results are the same as calling string_key_hash_computation() once with each seed
+*/
+void string_key_hash_pair_computation(const void *data, uint64_t length, uint64_t f_seed, uint64_t s_seed, 
+    uint32_t align, uint64_t *f_hash, uint64_t *s_hash)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    const uint8_t *end = p + length;
+    uint64_t h1, h2;
+
+    if (length >= 32)
+    {
+        const uint8_t *const limitation = end - 32;
+        uint64_t v1 = f_seed + NUMBER64_1 + NUMBER64_2;
+        uint64_t v2 = f_seed + NUMBER64_2;
+        uint64_t v3 = f_seed + 0;
+        uint64_t v4 = f_seed - NUMBER64_1;
+        uint64_t w1 = s_seed + NUMBER64_1 + NUMBER64_2;
+        uint64_t w2 = s_seed + NUMBER64_2;
+        uint64_t w3 = s_seed + 0;
+        uint64_t w4 = s_seed - NUMBER64_1;
+
+        do
+        {
+            uint64_t k1 = hash_get64bits(p);
+            uint64_t k2 = hash_get64bits(p + 8);
+            uint64_t k3 = hash_get64bits(p + 16);
+            uint64_t k4 = hash_get64bits(p + 24);
+            v1 = hash_round(v1, k1);
+            w1 = hash_round(w1, k1);
+            v2 = hash_round(v2, k2);
+            w2 = hash_round(w2, k2);
+            v3 = hash_round(v3, k3);
+            w3 = hash_round(w3, k3);
+            v4 = hash_round(v4, k4);
+            w4 = hash_round(w4, k4);
+            p += 32;
+        } while (p <= limitation);
+
+        h1 = shifting_hash(v1, 1) + shifting_hash(v2, 7) + shifting_hash(v3, 12) + shifting_hash(v4, 18);
+        h1 = hash_merge_round(h1, v1);
+        h1 = hash_merge_round(h1, v2);
+        h1 = hash_merge_round(h1, v3);
+        h1 = hash_merge_round(h1, v4);
+
+        h2 = shifting_hash(w1, 1) + shifting_hash(w2, 7) + shifting_hash(w3, 12) + shifting_hash(w4, 18);
+        h2 = hash_merge_round(h2, w1);
+        h2 = hash_merge_round(h2, w2);
+        h2 = hash_merge_round(h2, w3);
+        h2 = hash_merge_round(h2, w4);
+    }
+    else
+    {
+        h1 = f_seed + NUMBER64_5;
+        h2 = s_seed + NUMBER64_5;
+    }
+
+    h1 += (uint64_t)length;
+    h2 += (uint64_t)length;
+
+    while (p + 8 <= end)
+    {
+        uint64_t k1 = hash_round(0, hash_get64bits(p));
+        h1 ^= k1;
+        h1 = shifting_hash(h1, 27) * NUMBER64_1 + NUMBER64_4;
+        h2 ^= k1;
+        h2 = shifting_hash(h2, 27) * NUMBER64_1 + NUMBER64_4;
+        p += 8;
+    }
+
+    if (p + 4 <= end)
+    {
+        uint64_t k1 = (uint64_t)(hash_get32bits(p)) * NUMBER64_1;
+        h1 ^= k1;
+        h1 = shifting_hash(h1, 23) * NUMBER64_2 + NUMBER64_3;
+        h2 ^= k1;
+        h2 = shifting_hash(h2, 23) * NUMBER64_2 + NUMBER64_3;
+        p += 4;
+    }
+
+    while (p < end)
+    {
+        uint64_t k1 = (*p) * NUMBER64_5;
+        h1 ^= k1;
+        h1 = shifting_hash(h1, 11) * NUMBER64_1;
+        h2 ^= k1;
+        h2 = shifting_hash(h2, 11) * NUMBER64_1;
+        p++;
+    }
+
+    *f_hash = hash_avalanche(h1);
+    *s_hash = hash_avalanche(h2);
+}
+
+void hash_pair(const void *data, uint64_t length, uint64_t f_seed, uint64_t s_seed, uint64_t *f_hash, uint64_t *s_hash)
+{
+    if ((((uint64_t)data) & 7) == 0)
+    {
+        string_key_hash_pair_computation(data, length, f_seed, s_seed, 1, f_hash, s_hash);
+        return;
+    }
+    string_key_hash_pair_computation(data, length, f_seed, s_seed, 0, f_hash, s_hash);
+}
@@ -9,4 +9,143 @@ Function: hash()
 */
 uint64_t hash(const void *data, uint64_t length, uint64_t seed);
 
+/*
+Function: hash_pair() 
+        Compute the hash values of a key under two seeds in a single pass;
+        The results are the same as calling hash() once with each seed
+*/
+void hash_pair(const void *data, uint64_t length, uint64_t f_seed, uint64_t s_seed, uint64_t *f_hash, uint64_t *s_hash);
+
+/*
+Function: hash_u64() 
+        Compute the hash value of a 64-bit integer key by mixing it with a seed;
+        The finalizer of murmur3 is used, which takes a few multiply and shift instructions
+*/
+static inline uint64_t hash_u64(uint64_t key, uint64_t seed)
+{
+    key ^= seed;
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return key;
+}
+
+#define HASH_WY_SECRET0 0xa0761d6478bd642fULL
+#define HASH_WY_SECRET1 0xe7037ed1a0b428dbULL
+
+/*
+Function: hash_wymix() 
+        Multiply two words into 128 bits and fold the halves together, the mixing step of wyhash
+*/
+static inline uint64_t hash_wymix(uint64_t a, uint64_t b)
+{
+    __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+static inline uint64_t hash_wyr8(const uint8_t *p) { uint64_t v; __builtin_memcpy(&v, p, 8); return v; }
+static inline uint64_t hash_wyr4(const uint8_t *p) { uint32_t v; __builtin_memcpy(&v, p, 4); return v; }
+
+/*
+Function: hash_wy() 
+        Compute the hash value of a key with wyhash: keys of up to 16 bytes are read with at most four 
+        overlapping loads and mixed by two multiplies; Longer keys take one multiply per 16 bytes, 
+        without the three-lane loop wyhash uses above 48 bytes
+*/
+static inline uint64_t hash_wy(const void *data, uint64_t length, uint64_t seed)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    uint64_t a, b;
+    seed ^= HASH_WY_SECRET0;
+    if (length <= 16)
+    {
+        if (length >= 4)
+        {
+            a = (hash_wyr4(p) << 32) | hash_wyr4(p + ((length >> 3) << 2));
+            b = (hash_wyr4(p + length - 4) << 32) | hash_wyr4(p + length - 4 - ((length >> 3) << 2));
+        }
+        else if (length > 0)
+        {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[length >> 1] << 8) | p[length - 1];
+            b = 0;
+        }
+        else
+            a = b = 0;
+    }
+    else
+    {
+        uint64_t i = length;
+        while (i > 16)
+        {
+            seed = hash_wymix(hash_wyr8(p) ^ HASH_WY_SECRET1, hash_wyr8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = hash_wyr8(p + i - 16);
+        b = hash_wyr8(p + i - 8);
+    }
+    __uint128_t r = (__uint128_t)(a ^ HASH_WY_SECRET1) * (b ^ seed);
+    return hash_wymix((uint64_t)r ^ HASH_WY_SECRET0 ^ length, (uint64_t)(r >> 64) ^ HASH_WY_SECRET1);
+}
+
+#ifdef __x86_64__
+#include <nmmintrin.h>
+
+/*
+Function: hash_crc_mix() 
+        Hash two words under a seed with four CRC32C instructions; CRC is linear, so two keys whose
+        difference lies in its kernel would collide under every seed: the words are first multiplied
+        by seeded odd constants, which is one-to-one but not linear, and the two 32-bit results are 
+        finished with the multiply-xorshift rounds of hash_u64()
+*/
+static inline __attribute__((target("sse4.2"))) uint64_t hash_crc_mix(uint64_t w0, uint64_t w1, uint64_t seed)
+{
+    uint64_t k = (seed ^ seed >> 29) * 0xbf58476d1ce4e5b9ULL | 1;    // The seeds may have many low zero bits
+    uint64_t a = (w0 ^ seed) * k;
+    uint64_t b = (w1 + seed) * 0x9e3779b97f4a7c15ULL;
+    a ^= a >> 32;
+    b ^= b >> 29;
+    uint64_t lo = _mm_crc32_u64(_mm_crc32_u64((uint32_t)seed, a), b);
+    uint64_t hi = _mm_crc32_u64(_mm_crc32_u64(seed >> 32, b), a);
+    uint64_t h = (hi << 32 | lo) ^ seed;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
 
+/*
+Function: hash_pair_crc16() 
+        Compute the hash values of a string key of at most 16 bytes under two seeds: the key is read as 
+        one 16-byte block, whose bytes from the terminating NUL on are cleared, so that it hashes the same 
+        whatever follows the terminator; Needs SSE4.2, and is inlined only when built with -msse4.2
+*/
+static inline __attribute__((target("sse4.2"))) void hash_pair_crc16(const void *data, uint64_t f_seed, uint64_t s_seed, 
+    uint64_t *f_hash, uint64_t *s_hash)
+{
+    __m128i block = _mm_loadu_si128((const __m128i *)data);
+    uint32_t nul = _mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_setzero_si128()));
+    char length = nul ? __builtin_ctz(nul) : 16;
+    __m128i keep = _mm_cmpgt_epi8(_mm_set1_epi8(length), _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+    block = _mm_and_si128(block, keep);
+    uint64_t w0 = _mm_cvtsi128_si64(block);
+    uint64_t w1 = _mm_cvtsi128_si64(_mm_unpackhi_epi64(block, block));
+    *f_hash = hash_crc_mix(w0, w1, f_seed);
+    *s_hash = hash_crc_mix(w0, w1, s_seed);
+}
+
+/*
+Function: hash_pair_crc16_binary() 
+        Compute the hash values of a binary key of exactly 16 bytes under two seeds, all of whose bytes are hashed
+*/
+static inline __attribute__((target("sse4.2"))) void hash_pair_crc16_binary(const void *data, uint64_t f_seed, uint64_t s_seed, 
+    uint64_t *f_hash, uint64_t *s_hash)
+{
+    uint64_t w0 = hash_wyr8((const uint8_t *)data);
+    uint64_t w1 = hash_wyr8((const uint8_t *)data + 8);
+    *f_hash = hash_crc_mix(w0, w1, f_seed);
+    *s_hash = hash_crc_mix(w0, w1, s_seed);
+}
+#endif
@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <string.h>
+#include "hash.h"
+/*  Test:
+    Check that the CRC32C backend separates keys whose difference lies in the kernel of CRC: the linear part
+    of the four CRC instructions maps 128 key bits to 64 hash bits, so such a difference always exists
+*/
+#ifdef __x86_64__
+#define HASH_TEST_LEVEL_SIZE 16           // The buckets of a level with 2^16 top-level buckets are compared
+
+/*
+Function: crc_linear() 
+        The CRC part of hash_crc_mix() without the seed, which is linear in the two words
+*/
+static __attribute__((target("sse4.2"))) uint64_t crc_linear(uint64_t w0, uint64_t w1)
+{
+    return _mm_crc32_u64(_mm_crc32_u64(0, w1), w0) << 32 | _mm_crc32_u64(_mm_crc32_u64(0, w0), w1);
+}
+
+/*
+Function: crc_kernel() 
+        Find a nonzero difference (d0, d1) with crc_linear(d0, d1) == 0 by Gaussian elimination 
+        over the images of the 128 unit vectors
+*/
+static int crc_kernel(uint64_t *d0, uint64_t *d1)
+{
+    uint64_t image[64], mask[64][2];
+    uint8_t used[64];
+    int i, bit;
+
+    memset(used, 0, sizeof(used));
+    for (i = 0; i < 128; i++)
+    {
+        uint64_t v = i < 64 ? crc_linear(1ULL << i, 0) : crc_linear(0, 1ULL << (i - 64));
+        uint64_t m[2] = {i < 64 ? 1ULL << i : 0, i < 64 ? 0 : 1ULL << (i - 64)};
+        for (bit = 63; bit >= 0; bit--)
+        {
+            if (!(v >> bit & 1))
+                continue;
+            if (!used[bit])
+                break;
+            v ^= image[bit];
+            m[0] ^= mask[bit][0];
+            m[1] ^= mask[bit][1];
+        }
+        // The unit vector is a sum of the earlier ones under the map, so their difference is in the kernel
+        if (bit < 0)
+        {
+            *d0 = m[0];
+            *d1 = m[1];
+            return 0;
+        }
+        used[bit] = 1;
+        image[bit] = v;
+        mask[bit][0] = m[0];
+        mask[bit][1] = m[1];
+    }
+    return 1;
+}
+
+int main(void)
+{
+    uint64_t seeds[2] = {0x5bd1e995ULL << 17, 0x2545f4914f6cdd1dULL};
+    uint64_t half = 1ULL << (HASH_TEST_LEVEL_SIZE - 1);
+    uint8_t x[16], y[16];
+    uint64_t d0, d1, w;
+    int s, failed = 0;
+
+    if (crc_kernel(&d0, &d1) || crc_linear(d0, d1))
+    {
+        printf("No kernel vector of CRC is found\n");
+        return 1;
+    }
+    for (s = 0; s < 16; s++)
+        x[s] = s * 37 + 11;
+    memcpy(&w, x, 8);
+    w ^= d0;
+    memcpy(y, &w, 8);
+    memcpy(&w, x + 8, 8);
+    w ^= d1;
+    memcpy(y + 8, &w, 8);
+
+    for (s = 0; s < 2; s++)
+    {
+        uint64_t fx, sx, fy, sy;
+        hash_pair_crc16_binary(x, seeds[s], seeds[1 - s], &fx, &sx);
+        hash_pair_crc16_binary(y, seeds[s], seeds[1 - s], &fy, &sy);
+        if (fx % half == fy % half && sx % half == sy % half)
+        {
+            printf("The keys share their bucket pair under seed %d\n", s);
+            failed = 1;
+        }
+    }
+    printf(failed ? "The CRC32C backend test fails\n" : "The CRC32C backend test succeeds\n");
+    return failed;
+}
+#else
+int main(void)
+{
+    printf("The CRC32C backend needs x86-64\n");
+    return 0;
+}
+#endif
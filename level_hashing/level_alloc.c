@@ -0,0 +1,133 @@
+#define _GNU_SOURCE
+#include "level_alloc.h"
+#include <sched.h>
+#include <sys/mman.h>
+#include <numa.h>
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+/*
+Function: level_alloc_page() 
+        Return the page size of a block under a policy; A block smaller than the huge pages of the policy
+        takes the next smaller pages, so that small blocks such as the per-thread counters are not rounded 
+        up to a whole huge page
+*/
+static uint64_t level_alloc_page(const level_alloc_policy *policy, uint64_t size)
+{
+    if (policy->page == LEVEL_PAGE_HUGE_1GB && size >= 1UL << 30)
+        return 1UL << 30;
+    if (policy->page != LEVEL_PAGE_DEFAULT && size >= 1UL << 21)
+        return 1UL << 21;
+    return 4096;
+}
+
+/*
+Function: level_alloc_size() 
+        Round a size up to the page size of a policy, which munmap() also needs for hugetlb mappings
+*/
+static uint64_t level_alloc_size(const level_alloc_policy *policy, uint64_t size)
+{
+    uint64_t page_size = level_alloc_page(policy, size);
+    return (size + page_size - 1) & ~(page_size - 1);
+}
+
+/*
+Function: level_map() 
+        Map zeroed memory aligned to alignment following an allocation policy; An alignment above the page 
+        size is met by mapping more base pages and unmapping the ends around the aligned block;
+        The placement is applied before the pages are touched, so it holds for all of them
+*/
+static void *level_map(const level_alloc_policy *policy, uint64_t size, uint64_t alignment)
+{
+    uint64_t page_size = level_alloc_page(policy, size);
+    uint64_t alloc_size = level_alloc_size(policy, size);
+    uint64_t extra = alignment > page_size ? alignment : 0;
+    void *addr = MAP_FAILED;
+
+    // The hugetlb pool is only used for blocks of whole huge pages of the policy
+    if (!extra && ((policy->page == LEVEL_PAGE_HUGE_2MB && page_size == 1UL << 21) 
+        || (policy->page == LEVEL_PAGE_HUGE_1GB && page_size == 1UL << 30)))
+    {
+        int huge_flag = page_size == 1UL << 21 ? MAP_HUGE_2MB : MAP_HUGE_1GB;
+        addr = mmap(NULL, alloc_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | huge_flag, -1, 0);
+    }
+    if (addr == MAP_FAILED)
+    {
+        addr = mmap(NULL, alloc_size + extra, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (addr == MAP_FAILED)
+            return NULL;
+        if (extra)
+        {
+            uint64_t head = (alignment - (uintptr_t)addr % alignment) % alignment;
+            if (head)
+                munmap(addr, head);
+            if (extra > head)
+                munmap((uint8_t *)addr + head + alloc_size, extra - head);
+            addr = (uint8_t *)addr + head;
+        }
+        if (page_size > 4096)
+            madvise(addr, alloc_size, MADV_HUGEPAGE);
+    }
+
+    if (policy->placement != LEVEL_ALLOC_LOCAL && numa_available() >= 0)
+    {
+        if (policy->placement == LEVEL_ALLOC_INTERLEAVE)
+            numa_interleave_memory(addr, alloc_size, numa_all_nodes_ptr);
+        else if (policy->placement == LEVEL_ALLOC_NODE)
+            numa_tonode_memory(addr, alloc_size, policy->node);
+        else if (policy->placement == LEVEL_ALLOC_CALLER_NODE)
+            numa_tonode_memory(addr, alloc_size, numa_node_of_cpu(sched_getcpu()));
+    }
+
+    return addr;
+}
+
+/*
+Function: level_alloc() 
+        Allocate zeroed memory following an allocation policy, aligned to its pages
+*/
+void *level_alloc(const level_alloc_policy *policy, uint64_t size)
+{
+    return level_map(policy, size, 0);
+}
+
+/*
+Function: level_free() 
+        Free memory allocated by level_alloc() with the same policy and size
+*/
+void level_free(const level_alloc_policy *policy, void *addr, uint64_t size)
+{
+    munmap(addr, level_alloc_size(policy, size));
+}
+
+static void *level_policy_alloc(void *ctx, uint64_t size, uint64_t alignment)
+{
+    return level_map(ctx, size, alignment);
+}
+
+static void level_policy_free(void *ctx, void *addr, uint64_t size)
+{
+    level_free(ctx, addr, size);
+}
+
+/*
+Function: level_allocator_policy() 
+        Fill an allocator that allocates zeroed memory with level_alloc() following a policy,
+        which must stay valid as long as the allocator is used
+*/
+void level_allocator_policy(level_allocator *allocator, const level_alloc_policy *policy)
+{
+    allocator->alloc = level_policy_alloc;
+    allocator->free = level_policy_free;
+    allocator->ctx = (void *)policy;
+    allocator->alignment = 0;
+    allocator->zeroed = 1;
+}
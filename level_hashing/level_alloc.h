@@ -0,0 +1,35 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LEVEL_ALLOC_LOCAL 0               // The pages are placed on the node of the thread first touching them
+#define LEVEL_ALLOC_INTERLEAVE 1          // The pages are interleaved across all nodes
+#define LEVEL_ALLOC_NODE 2                // The pages are bound to a given node
+#define LEVEL_ALLOC_CALLER_NODE 3         // The pages are bound to the node of the thread allocating them
+
+#define LEVEL_PAGE_DEFAULT 0              // Base pages
+#define LEVEL_PAGE_THP 1                  // Transparent huge pages, requested with madvise
+#define LEVEL_PAGE_HUGE_2MB 2             // 2MB pages from the hugetlb pool, falling back to transparent huge pages if the pool is empty
+#define LEVEL_PAGE_HUGE_1GB 3             // 1GB pages from the hugetlb pool, falling back in the same way
+                                          // Blocks smaller than a huge page take base pages, or transparent huge pages from 2MB on
+
+typedef struct level_alloc_policy{        // Where and how the bucket and lock arrays are allocated
+    uint8_t placement;                    // One of LEVEL_ALLOC_*
+    uint8_t page;                         // One of LEVEL_PAGE_*
+    int node;                             // The node used by LEVEL_ALLOC_NODE
+} level_alloc_policy;
+
+typedef struct level_allocator{           // Allocates and frees the bucket arrays and the other large blocks of a hash table
+    void *(*alloc)(void *ctx, uint64_t size, uint64_t alignment);  // Return a block of size bytes aligned to alignment, or NULL
+    void (*free)(void *ctx, void *addr, uint64_t size);            // Take back a block with the size it was allocated with
+    void *ctx;                            // Passed to alloc and free, e.g., an arena or a pool of pre-faulted blocks
+    uint64_t alignment;                   // The alignment asked for each block, raised to the alignment of the buckets
+    uint8_t zeroed;                       // 1 if alloc returns zeroed memory, otherwise the hash table clears each block
+} level_allocator;
+
+void *level_alloc(const level_alloc_policy *policy, uint64_t size);
+
+void level_free(const level_alloc_policy *policy, void *addr, uint64_t size);
+
+void level_allocator_policy(level_allocator *allocator, const level_alloc_policy *policy);
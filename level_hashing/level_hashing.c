@@ -1,179 +1,1451 @@
 #include "level_hashing.h"
-#include "numa.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// The reference to the value stored in a slot, which is returned by the queries
+#ifdef LEVEL_INTEGER_KEY
+#define VALUE_REF(slot) (&(slot).value)
+#else
+#define VALUE_REF(slot) ((slot).value)
+#endif
+
+// Count an event of a lookup or an insertion in the statistics
+#ifdef LEVEL_STATS
+#define LEVEL_STATS_ADD(level, counter) ((level)->stats.counter ++)
+#else
+#define LEVEL_STATS_ADD(level, counter)
+#endif
+
+/*
+Function: level_time_ns() 
+        Read the monotonic clock in nanoseconds, to time the resizings
+*/
+static inline uint64_t level_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#ifdef LEVEL_INTEGER_KEY
+/*
+Function: FS_HASH() 
+        Compute both hash values of an integer key by mixing it with the two seeds
+*/
+void FS_HASH(level_hash *level, level_key_t key, uint64_t *f_hash, uint64_t *s_hash) {
+    *f_hash = hash_u64(key, level->f_seed);
+    *s_hash = hash_u64(key, level->s_seed);
+}
+#else
+// The hash backend of a hash table, a constant that selects the inlined kernel if fixed at compile time
+#ifdef LEVEL_HASH_BACKEND
+#define LEVEL_HASH_OF(level) (LEVEL_HASH_BACKEND)
+#else
+#define LEVEL_HASH_OF(level) ((level)->hash_backend)
+#endif
+
+// The number of bytes a string key is hashed over: all KEY_LEN bytes of a binary key, or the bytes before the terminator
+#ifdef LEVEL_BINARY_KEY
+#define LEVEL_KEY_LENGTH(key) KEY_LEN
+#else
+#define LEVEL_KEY_LENGTH(key) strlen((const char *)(key))
+#endif
+
+/*
+Function: level_hash_pair() 
+        Compute the hash values of a string key under two seeds with a hash backend
+*/
+static inline void level_hash_pair(uint8_t backend, const uint8_t *key, uint64_t f_seed, uint64_t s_seed, 
+    uint64_t *f_hash, uint64_t *s_hash)
+{
+    switch (backend)
+    {
+    case LEVEL_HASH_WY:
+    {
+        uint64_t length = LEVEL_KEY_LENGTH(key);
+        *f_hash = hash_wy(key, length, f_seed);
+        *s_hash = hash_wy(key, length, s_seed);
+        return;
+    }
+#ifdef __x86_64__
+    case LEVEL_HASH_CRC16:
+#ifdef LEVEL_BINARY_KEY
+        hash_pair_crc16_binary(key, f_seed, s_seed, f_hash, s_hash);
+#else
+        hash_pair_crc16(key, f_seed, s_seed, f_hash, s_hash);
+#endif
+        return;
+#endif
+    default:
+        hash_pair((void *)key, LEVEL_KEY_LENGTH(key), f_seed, s_seed, f_hash, s_hash);
+    }
+}
+
+/*
+Function: F_HASH()
+        Compute the first hash value of a key-value item
+*/
+uint64_t F_HASH(level_hash *level, const uint8_t *key) {
+    uint64_t f_hash, s_hash;
+    level_hash_pair(LEVEL_HASH_OF(level), key, level->f_seed, level->s_seed, &f_hash, &s_hash);
+    return f_hash;
+}
+
+/*
+Function: S_HASH() 
+        Compute the second hash value of a key-value item
+*/
+uint64_t S_HASH(level_hash *level, const uint8_t *key) {
+    uint64_t f_hash, s_hash;
+    level_hash_pair(LEVEL_HASH_OF(level), key, level->f_seed, level->s_seed, &f_hash, &s_hash);
+    return s_hash;
+}
+
+/*
+Function: FS_HASH() 
+        Compute both hash values of a key-value item in a single pass over the key
+*/
+void FS_HASH(level_hash *level, level_key_t key, uint64_t *f_hash, uint64_t *s_hash) {
+    level_hash_pair(LEVEL_HASH_OF(level), key, level->f_seed, level->s_seed, f_hash, s_hash);
+}
+#endif
+
+/*
+Function: F_IDX() 
+        Compute the second hash location
+*/
+uint64_t F_IDX(uint64_t hashKey, uint64_t capacity) {
+    return hashKey % (capacity / 2);
+}
+
+/*
+Function: S_IDX() 
+        Compute the second hash location
+*/
+uint64_t S_IDX(uint64_t hashKey, uint64_t capacity) {
+    return hashKey % (capacity / 2) + capacity / 2;
+}
+
+/*
+Function: FP_HASH() 
+        Compute the one-byte fingerprint of a key from its first hash value;
+        The high byte is used since the bucket locations only depend on the low bits
+*/
+static inline uint8_t FP_HASH(uint64_t f_hash) {
+    return (uint8_t)(f_hash >> 56);
+}
+
+/*
+Function: level_match() 
+        Return a bitmap of the occupied slots in a bucket whose fingerprints are equal to fp;
+        The tokens and fingerprints of all slots are compared at once with SSE2
+*/
+static inline uint32_t level_match(level_bucket *bucket, uint8_t fp)
+{
+#if defined(LEVEL_ALIGNED_BUCKET) && defined(__SSE2__)
+    // The header line is read past fp[] safely, and the extra bytes are masked out by the occupancy bitmap
+    __m128i fps = _mm_loadu_si128((const __m128i *)bucket->fp);
+    uint32_t fp_mask = _mm_movemask_epi8(_mm_cmpeq_epi8(fps, _mm_set1_epi8((char)fp)));
+    return bucket->token & fp_mask;
+#elif defined(__SSE2__)
+    __m128i header = _mm_loadu_si128((const __m128i *)bucket->token);     // token[] and fp[] are adjacent
+    uint32_t token_mask = _mm_movemask_epi8(_mm_cmpeq_epi8(header, _mm_set1_epi8(1)));
+    uint32_t fp_mask = _mm_movemask_epi8(_mm_cmpeq_epi8(header, _mm_set1_epi8((char)fp)));
+    return token_mask & (fp_mask >> ASSOC_NUM) & ((1 << ASSOC_NUM) - 1);
+#else
+    uint32_t mask = 0;
+    uint64_t j;
+    for(j = 0; j < ASSOC_NUM; j ++){
+        if (GET_TOKEN(bucket->token, j) && bucket->fp[j] == fp)
+            mask |= 1 << j;
+    }
+    return mask;
+#endif
+}
+
+#ifndef LEVEL_INTEGER_KEY
+/*
+Function: level_key_equal() 
+        Compare two string keys; A binary key is compared as one 16-byte block with a single SSE2 compare
+*/
+static inline int level_key_equal(const uint8_t *a, const uint8_t *b)
+{
+#if defined(LEVEL_BINARY_KEY) && defined(__SSE2__)
+    __m128i diff = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)a), _mm_loadu_si128((const __m128i *)b));
+    return _mm_movemask_epi8(diff) == 0xffff;
+#elif defined(LEVEL_BINARY_KEY)
+    return memcmp(a, b, KEY_LEN) == 0;
+#else
+    return strcmp((const char *)a, (const char *)b) == 0;
+#endif
+}
+#endif
+
+/*
+Function: level_find() 
+        Find the slot storing the key in a bucket, return -1 if the key is not in this bucket;
+        The full key comparison only runs on the slots whose fingerprints match
+*/
+static inline int level_find(level_bucket *bucket, level_key_t key, uint8_t fp)
+{
+    uint32_t mask = level_match(bucket, fp);
+    while (mask) {
+        int j = __builtin_ctz(mask);
+#ifdef LEVEL_INTEGER_KEY
+        if (bucket->slot[j].key == key)
+#else
+        if (level_key_equal(bucket->slot[j].key, key))
+#endif
+            return j;
+        mask &= mask - 1;
+    }
+    return -1;
+}
+
+/*
+Function: level_empty_slot() 
+        Return the first empty slot in a bucket, or -1 if the bucket is full;
+        With LEVEL_ALIGNED_BUCKET, it is found with one tzcnt on the inverted occupancy bitmap
+*/
+static inline int level_empty_slot(level_bucket *bucket)
+{
+#ifdef LEVEL_ALIGNED_BUCKET
+    uint32_t empty = ~bucket->token & ((1U << ASSOC_NUM) - 1);
+    return empty ? __builtin_ctz(empty) : -1;
+#else
+    int j;
+    for(j = 0; j < ASSOC_NUM; j ++){
+        if (bucket->token[j] == 0)
+            return j;
+    }
+    return -1;
+#endif
+}
+
+/*
+Function: level_pick_slot() 
+        Pick an empty slot for an item between its two candidate buckets and set *bucket to the chosen one;
+        The less-loaded bucket, whose first empty slot comes earlier, is chosen and the first bucket wins a tie;
+        Return -1 if both buckets are full
+*/
+static inline int level_pick_slot(level_bucket **bucket, level_bucket *f_bucket, level_bucket *s_bucket)
+{
+    int f_slot = level_empty_slot(f_bucket);
+    int s_slot = level_empty_slot(s_bucket);
+
+    if (f_slot != -1 && (s_slot == -1 || f_slot <= s_slot))
+    {
+        *bucket = f_bucket;
+        return f_slot;
+    }
+    *bucket = s_bucket;
+    return s_slot;
+}
+
+/*
+Function: level_slot_fill() 
+        Write a key-value item with its fingerprint into the j-th slot of a bucket without touching the token;
+        With LEVEL_HASH_CACHE, the low bits of both hash values are kept in the slot as well
+*/
+static inline void level_slot_fill(level_bucket *bucket, uint64_t j, level_key_t key, level_value_t value,
+    uint64_t f_hash, uint64_t s_hash, uint8_t fp)
+{
+#ifdef LEVEL_INTEGER_KEY
+    bucket->slot[j].key = key;
+    bucket->slot[j].value = value;
+#else
+    memcpy(bucket->slot[j].key, key, KEY_LEN);
+#ifdef LEVEL_STABLE_VALUE
+    bucket->slot[j].value = value;        // The value is already in its cell
+#else
+    memcpy(bucket->slot[j].value, value, VALUE_LEN);
+#endif
+#endif
+    bucket->fp[j] = fp;
+#ifdef LEVEL_HASH_CACHE
+    bucket->f_hash[j] = (uint32_t)f_hash;
+    bucket->s_hash[j] = (uint32_t)s_hash;
+#endif
+}
+
+/*
+Function: level_slot_write() 
+        Write a key-value item into the j-th slot of a bucket and then set the token
+*/
+static inline void level_slot_write(level_bucket *bucket, uint64_t j, level_key_t key, level_value_t value,
+    uint64_t f_hash, uint64_t s_hash, uint8_t fp)
+{
+    level_slot_fill(bucket, j, key, value, f_hash, s_hash, fp);
+    SET_TOKEN(bucket->token, j, 1);
+}
+
+/*
+Function: level_slot_copy() 
+        Copy the item in the i-th slot of src_bucket, with its fingerprint (and cached hash bits), 
+        into the j-th slot of dst_bucket without touching the tokens
+*/
+static inline void level_slot_copy(level_bucket *dst_bucket, uint64_t j, level_bucket *src_bucket, uint64_t i)
+{
+    dst_bucket->slot[j] = src_bucket->slot[i];
+    dst_bucket->fp[j] = src_bucket->fp[i];
+#ifdef LEVEL_HASH_CACHE
+    dst_bucket->f_hash[j] = src_bucket->f_hash[i];
+    dst_bucket->s_hash[j] = src_bucket->s_hash[i];
+#endif
+}
+
+/*
+Function: level_slot_move() 
+        Move the item in the i-th slot of src_bucket into the j-th slot of dst_bucket;
+        The fingerprint (and the cached hash bits) travel with the item, so nothing is rehashed
+*/
+static inline void level_slot_move(level_bucket *dst_bucket, uint64_t j, level_bucket *src_bucket, uint64_t i)
+{
+    level_slot_copy(dst_bucket, j, src_bucket, i);
+    SET_TOKEN(dst_bucket->token, j, 1);
+    SET_TOKEN(src_bucket->token, i, 0);
+}
+
+/*
+Function: level_slot_hash() 
+        Get the two hash values of the item stored in the j-th slot of a bucket;
+        With LEVEL_HASH_CACHE, they are read from the slot instead of rehashing the key
+*/
+static inline void level_slot_hash(level_hash *level, level_bucket *bucket, uint64_t j, uint64_t *f_hash, uint64_t *s_hash)
+{
+#ifdef LEVEL_HASH_CACHE
+    *f_hash = bucket->f_hash[j];
+    *s_hash = bucket->s_hash[j];
+#else
+    FS_HASH(level, bucket->slot[j].key, f_hash, s_hash);
+#endif
+}
+
+#ifdef LEVEL_BOTTOM_HINT
+#define HINT_SHIFT(fp) (((fp) & 7) * 8)  // The position of the 8-bit counter of a fingerprint in a hint
+
+/*
+Function: level_hint_add()
+        Count an item stored into the idx-th bottom-level bucket in the hint of its first top-level bucket,
+        unless the bucket is not counted yet; A counter saturates at 255 and then only says that the bottom
+        level may hold the key
+*/
+static inline void level_hint_add(level_hash *level, uint64_t idx, uint64_t f_hash, uint8_t fp)
+{
+    if (idx >= level->hint_cursor)
+        return;
+    uint64_t *hint = &level->buckets[0][F_IDX(f_hash, level->addr_capacity)].hint;
+    if (((*hint >> HINT_SHIFT(fp)) & 255) != 255)
+        *hint += 1ULL << HINT_SHIFT(fp);
+}
+
+/*
+Function: level_hint_recount()
+        Set the counter of a fingerprint in the hint of a top-level bucket to the number of bottom-level items
+        it counts, found by a scan of the counted bottom-level buckets; Only needed for a saturated counter
+*/
+static void level_hint_recount(level_hash *level, uint64_t f_hash, uint8_t fp)
+{
+    uint64_t top_idx = F_IDX(f_hash, level->addr_capacity);
+    uint64_t idx, i, count = 0;
+
+    for (idx = 0; idx < level->hint_cursor; idx ++) {
+        level_bucket *bucket = &level->buckets[1][idx];
+        for(i = 0; i < ASSOC_NUM; i ++){
+            if (GET_TOKEN(bucket->token, i) && (bucket->fp[i] & 7) == (fp & 7))
+            {
+                uint64_t item_f_hash, item_s_hash;
+                level_slot_hash(level, bucket, i, &item_f_hash, &item_s_hash);
+                if (F_IDX(item_f_hash, level->addr_capacity) == top_idx)
+                    count ++;
+            }
+        }
+    }
+    uint64_t *hint = &level->buckets[0][top_idx].hint;
+    *hint = (*hint & ~(255ULL << HINT_SHIFT(fp))) | (count < 255 ? count : 255) << HINT_SHIFT(fp);
+}
+
+/*
+Function: level_hint_remove()
+        Uncount an item that has left the idx-th bottom-level bucket; A saturated counter is recounted
+        instead, so that the hints stay exact
+*/
+static inline void level_hint_remove(level_hash *level, uint64_t idx, uint64_t f_hash, uint8_t fp)
+{
+    if (idx >= level->hint_cursor)
+        return;
+    uint64_t *hint = &level->buckets[0][F_IDX(f_hash, level->addr_capacity)].hint;
+    if (((*hint >> HINT_SHIFT(fp)) & 255) != 255)
+        *hint -= 1ULL << HINT_SHIFT(fp);
+    else
+        level_hint_recount(level, f_hash, fp);
+}
+
+/*
+Function: level_hint_shift()
+        Recount an item moved from the src_idx-th into the j-th slot of the dst_idx-th bucket of a level
+        when the move crosses the hint cursor of the bottom level
+*/
+static inline void level_hint_shift(level_hash *level, uint64_t level_num, uint64_t dst_idx, uint64_t j, uint64_t src_idx)
+{
+    if (level_num == 0 || (dst_idx < level->hint_cursor) == (src_idx < level->hint_cursor))
+        return;
+    uint64_t f_hash, s_hash;
+    level_bucket *bucket = &level->buckets[1][dst_idx];
+    level_slot_hash(level, bucket, j, &f_hash, &s_hash);
+    if (dst_idx < level->hint_cursor)
+        level_hint_add(level, dst_idx, f_hash, bucket->fp[j]);
+    else
+        level_hint_remove(level, src_idx, f_hash, bucket->fp[j]);
+}
+
+/*
+Function: level_bottom_absent()
+        Return 1 if the hint of the first top-level bucket of a key shows that the bottom level does not hold it;
+        Return 0 while the bottom-level items are still being counted
+*/
+static inline uint8_t level_bottom_absent(level_hash *level, uint64_t f_hash, uint8_t fp)
+{
+    if (level->hint_cursor < level->addr_capacity / 2)
+        return 0;
+    return ((level->buckets[0][F_IDX(f_hash, level->addr_capacity)].hint >> HINT_SHIFT(fp)) & 255) == 0;
+}
+
+/*
+Function: level_hint_count()
+        Count the items of the bottom-level buckets from the hint cursor up to end_idx in the hints, and
+        clear the hints those buckets kept from their time in the top level, so that a bottom level never
+        holds stale hints; Called by level_migrate() as an expanding goes on, so that the hints of the new 
+        top level are filled without a pass over the whole bottom level
+*/
+static void level_hint_count(level_hash *level, uint64_t end_idx)
+{
+    uint64_t i;
+    while (level->hint_cursor < end_idx) {
+        uint64_t idx = level->hint_cursor ++;
+        level_bucket *bucket = &level->buckets[1][idx];
+        bucket->hint = 0;
+        for(i = 0; i < ASSOC_NUM; i ++){
+            if (GET_TOKEN(bucket->token, i))
+            {
+                uint64_t f_hash, s_hash;
+                level_slot_hash(level, bucket, i, &f_hash, &s_hash);
+                level_hint_add(level, idx, f_hash, bucket->fp[i]);
+            }
+        }
+    }
+}
+
+/*
+Function: level_hint_restart()
+        Set the number of bottom-level buckets counted in the hints when a resizing swaps the levels: none
+        when an expanding puts a new top level, whose hints are all zero, on the old top level, and all 
+        when a shrinking puts an empty bottom level under the old bottom level
+*/
+static inline void level_hint_restart(level_hash *level, uint64_t counted)
+{
+    level->hint_cursor = counted;
+}
+
+/*
+Function: level_hint_rebuild()
+        Recount the hints of all top-level buckets from the items in the bottom level at once
+*/
+static void level_hint_rebuild(level_hash *level)
+{
+    uint64_t idx;
+    for (idx = 0; idx < level->addr_capacity; idx ++)
+        level->buckets[0][idx].hint = 0;
+    level->hint_cursor = 0;
+    level_hint_count(level, level->addr_capacity / 2);
+}
+#else
+static inline void level_hint_add(level_hash *level, uint64_t idx, uint64_t f_hash, uint8_t fp) {}
+static inline void level_hint_remove(level_hash *level, uint64_t idx, uint64_t f_hash, uint8_t fp) {}
+static inline void level_hint_shift(level_hash *level, uint64_t level_num, uint64_t dst_idx, uint64_t j, uint64_t src_idx) {}
+static inline uint8_t level_bottom_absent(level_hash *level, uint64_t f_hash, uint8_t fp) { return 0; }
+static inline void level_hint_count(level_hash *level, uint64_t end_idx) {}
+static inline void level_hint_restart(level_hash *level, uint64_t counted) {}
+static inline void level_hint_rebuild(level_hash *level) {}
+#endif
+
+/*
+Function: level_block_alloc()
+        Allocate a bucket array or a chunk of value cells with the allocator of the hash table;
+        The block is cleared here unless the allocator returns zeroed memory
+*/
+static void *level_block_alloc(level_hash *level, uint64_t size)
+{
+    level_allocator *allocator = &level->allocator;
+    uint64_t alignment = allocator->alignment > __alignof__(level_bucket) ? allocator->alignment : __alignof__(level_bucket);
+    void *addr = allocator->alloc(allocator->ctx, size, alignment);
+    if (addr && !allocator->zeroed)
+        memset(addr, 0, size);
+    return addr;
+}
+
+static inline void level_block_free(level_hash *level, void *addr, uint64_t size)
+{
+    level->allocator.free(level->allocator.ctx, addr, size);
+}
+
+#ifdef LEVEL_STABLE_VALUE
+/*
+Function: level_value_cells()
+        Add a chunk of at least n value cells to the value arena and hand out its first n cells
+*/
+static uint8_t *level_value_cells(level_hash *level, uint64_t n)
+{
+    level_value_arena *arena = &level->values;
+    if (arena->chunk_num == arena->chunk_slots)
+    {
+        arena->chunk_slots = arena->chunk_slots ? arena->chunk_slots * 2 : 16;
+        arena->chunks = realloc(arena->chunks, arena->chunk_slots * sizeof(level_value_chunk));
+        if (!arena->chunks)
+        {
+            printf("The value allocation fails: 1\n");
+            exit(1);
+        }
+    }
+
+    level_value_chunk *chunk = &arena->chunks[arena->chunk_num];
+    chunk->cell_num = n > LEVEL_VALUE_CHUNK ? n : LEVEL_VALUE_CHUNK;
+    chunk->cells = level_block_alloc(level, chunk->cell_num * VALUE_LEN);
+    if (!chunk->cells)
+    {
+        printf("The value allocation fails: 2\n");
+        exit(1);
+    }
+    arena->chunk_num ++;
+    arena->used = n;
+    return chunk->cells;
+}
+
+/*
+Function: level_value_store()
+        Copy a new value into a cell of the value arena, reusing the cell of a deleted item first;
+        Return the cell, which is then stored in the slot in place of the value
+*/
+static inline uint8_t *level_value_store(level_hash *level, level_value_t value)
+{
+    level_value_arena *arena = &level->values;
+    uint8_t *cell = arena->free_cells;
+    if (cell)
+        memcpy(&arena->free_cells, cell, sizeof(uint8_t *));
+    else if (arena->chunk_num && arena->used < arena->chunks[arena->chunk_num - 1].cell_num)
+        cell = &arena->chunks[arena->chunk_num - 1].cells[VALUE_LEN * arena->used ++];
+    else
+        cell = level_value_cells(level, 1);
+    memcpy(cell, value, VALUE_LEN);
+    return cell;
+}
+
+/*
+Function: level_value_release()
+        Return the cell of a deleted item to the value arena
+*/
+static inline void level_value_release(level_hash *level, uint8_t *cell)
+{
+    memcpy(cell, &level->values.free_cells, sizeof(uint8_t *));
+    level->values.free_cells = cell;
+}
+#else
+static inline level_value_t level_value_store(level_hash *level, level_value_t value) { return value; }
+static inline void level_value_release(level_hash *level, level_value_t value) {}
+#endif
+
+
+void* alignedmalloc(size_t size) {
+  void* ret;
+  if (posix_memalign(&ret, 64, size))
+    return NULL;
+  return ret;
+}
+
+/*
+Function: generate_seeds() 
+        Generate two randomized seeds for hash functions
+*/
+void generate_seeds(level_hash *level)
+{
+    srand(time(NULL));
+    do
+    {
+        level->f_seed = rand();
+        level->s_seed = rand();
+        level->f_seed = level->f_seed << (rand() % 63);
+        level->s_seed = level->s_seed << (rand() % 63);
+    } while (level->f_seed == level->s_seed);
+}
+
+/*
+Function: level_init_state() 
+        Set the sizes of an empty level hash table and the default settings, but not its buckets or seeds
+*/
+static void level_init_state(level_hash *level, uint64_t level_size)
+{
+    level->level_size = level_size;
+    level->addr_capacity = pow(2, level_size);
+    level->total_capacity = pow(2, level_size) + pow(2, level_size - 1);
+    level->level_item_num[0] = 0;
+    level->level_item_num[1] = 0;
+    level->level_expand_time = 0;
+    level->resize_state = 0;
+    level->interim_level_buckets = NULL;
+    level->interim_bucket_num = 0;
+    level->interim_item_num = 0;
+    level->migrate_cursor = 0;
+    level->auto_resize = 1;
+    level->expand_load_factor = LEVEL_EXPAND_LOAD_FACTOR;
+    level->shrink_load_factor = LEVEL_SHRINK_LOAD_FACTOR;
+    level->min_level_size = level_size;
+    level->displace_depth = 1;
+#ifdef LEVEL_BOTTOM_HINT
+    level->hint_cursor = level->addr_capacity / 2;
+#endif
+#ifdef LEVEL_HASH_BACKEND
+    level->hash_backend = LEVEL_HASH_BACKEND;
+#else
+    level->hash_backend = LEVEL_HASH_XXH;
+#endif
+    memset(&level->stats, 0, sizeof(level_stats));
+#ifdef LEVEL_STABLE_VALUE
+    memset(&level->values, 0, sizeof(level_value_arena));
+#endif
+}
+
+/*
+Function: level_init_with() 
+        Initialize a level hash table whose buckets are allocated by an allocator,
+        or by level_alloc() following a policy if the allocator is NULL
+*/
+static level_hash *level_init_with(uint64_t level_size, const level_alloc_policy *policy, const level_allocator *allocator)
+{
+    level_hash *level = alignedmalloc(sizeof(level_hash));
+    if (!level)
+    {
+        printf("The level hash table initialization fails:1\n");
+        exit(1);
+    }
+
+    if (policy)
+        level->alloc_policy = *policy;
+    else
+        memset(&level->alloc_policy, 0, sizeof(level_alloc_policy));
+    if (allocator)
+        level->allocator = *allocator;
+    else
+        level_allocator_policy(&level->allocator, &level->alloc_policy);
+    if (!level->allocator.alloc || !level->allocator.free)
+    {
+        printf("The level hash table initialization fails:4\n");
+        exit(1);
+    }
+
+#ifdef LEVEL_HASH_CACHE
+    if (level_size > LEVEL_HASH_CACHE_MAX_SIZE)
+    {
+        printf("The level hash table initialization fails:3\n");
+        exit(1);
+    }
+#endif
+
+    level_init_state(level, level_size);
+    generate_seeds(level);
+    level->buckets[0] = (level_bucket*)level_block_alloc(level, pow(2, level_size) * sizeof(level_bucket));
+    level->buckets[1] = (level_bucket*)level_block_alloc(level, pow(2, level_size - 1) * sizeof(level_bucket));
+    
+    if (!level->buckets[0] || !level->buckets[1])
+    {
+        printf("The level hash table initialization fails:2\n");
+        exit(1);
+    }
+
+#ifdef LEVEL_INTEGER_KEY
+    printf("Level hashing: ASSOC_NUM %d, 64-bit integer keys and values \n", ASSOC_NUM);
+#else
+    printf("Level hashing: ASSOC_NUM %d, KEY_LEN %d, VALUE_LEN %d \n", ASSOC_NUM, KEY_LEN, VALUE_LEN);
+#endif
+    printf("The number of top-level buckets: %ld\n", level->addr_capacity);
+    printf("The number of all buckets: %ld\n", level->total_capacity);
+    printf("The number of all entries: %ld\n", level->total_capacity*ASSOC_NUM);
+    printf("The level hash table initialization succeeds!\n");
+    return level;
+}
+
+/*
+Function: level_init() 
+        Initialize a level hash table, whose buckets are placed on the node of the thread first touching them
+*/
+level_hash *level_init(uint64_t level_size)
+{
+    return level_init_policy(level_size, NULL);
+}
+
+/*
+Function: level_init_policy() 
+        Initialize a level hash table whose buckets are allocated following an allocation policy;
+        A NULL policy means base pages placed on the node of the thread first touching them
+*/
+level_hash *level_init_policy(uint64_t level_size, const level_alloc_policy *policy)
+{
+    return level_init_with(level_size, policy, NULL);
+}
+
+/*
+Function: level_init_ex() 
+        Initialize a level hash table whose buckets and value cells are allocated and freed by a given allocator,
+        which also takes back the old levels after each resizing, e.g., to recycle them;
+        A NULL allocator means level_alloc() with the default policy
+*/
+level_hash *level_init_ex(uint64_t level_size, const level_allocator *allocator)
+{
+    return level_init_with(level_size, NULL, allocator);
+}
+
+/*
+Function: level_size_for_items() 
+        Compute the smallest level_size whose hash table holds n items under the expanding threshold
+*/
+static uint64_t level_size_for_items(uint64_t n, double load_factor)
+{
+    uint64_t level_size = 2;
+    while ((pow(2, level_size) + pow(2, level_size - 1)) * ASSOC_NUM * load_factor < n)
+        level_size ++;
+    return level_size;
+}
+
+/*
+Function: level_init_for_items() 
+        Initialize a level hash table that holds n items without expanding
+*/
+level_hash *level_init_for_items(uint64_t n)
+{
+    return level_init(level_size_for_items(n, LEVEL_EXPAND_LOAD_FACTOR));
+}
+
+/*
+Function: level_set_resize_policy() 
+        Enable or disable auto-resizing and set its load factor thresholds;
+        The shrinking threshold must stay below half of the expanding threshold, since a shrinking
+        doubles the load factor and must not bring it back over the expanding threshold;
+        Return 1 and leave the policy unchanged if the thresholds are invalid
+*/
+uint8_t level_set_resize_policy(level_hash *level, uint8_t auto_resize, double expand_load_factor, double shrink_load_factor)
+{
+    if (expand_load_factor <= 0 || expand_load_factor > 1 || shrink_load_factor < 0 
+        || shrink_load_factor * 2 >= expand_load_factor || shrink_load_factor > 0.4)
+        return 1;
+    level->auto_resize = auto_resize;
+    level->expand_load_factor = expand_load_factor;
+    level->shrink_load_factor = shrink_load_factor;
+    return 0;
+}
+
+/*
+Function: level_set_displace_depth() 
+        Set the longest path of same-level movements an insertion searches for when its candidate buckets are full;
+        The default 1 moves one item to its alternative bucket like try_movement(), and 0 turns the movements off
+*/
+void level_set_displace_depth(level_hash *level, uint8_t depth)
+{
+    level->displace_depth = depth;
+}
+
+/*
+Function: level_hash_supported() 
+        Check whether a hash backend can be used by this build on this CPU; Integer keys are always 
+        mixed by hash_u64(), so they only take the default backend
+*/
+static uint8_t level_hash_supported(uint8_t backend)
+{
+    if (backend >= LEVEL_HASH_NUM)
+        return 0;
+#ifdef LEVEL_INTEGER_KEY
+    if (backend != LEVEL_HASH_XXH)
+        return 0;
+#endif
+#ifdef LEVEL_HASH_BACKEND
+    if (backend != LEVEL_HASH_BACKEND)
+        return 0;
+#endif
+    if (backend == LEVEL_HASH_CRC16)
+    {
+#ifdef __x86_64__
+        return __builtin_cpu_supports("sse4.2") != 0;
+#else
+        return 0;
+#endif
+    }
+    return 1;
+}
+
+/*
+Function: level_set_hash() 
+        Choose the hash backend of an empty hash table; Return 0 if it is set, 1 if the backend is not 
+        supported or the hash table already holds items, which would be placed by the old hash values
+*/
+uint8_t level_set_hash(level_hash *level, uint8_t backend)
+{
+    if (!level_hash_supported(backend) || level->level_item_num[0] + level->level_item_num[1] || level->resize_state)
+        return 1;
+    level->hash_backend = backend;
+    return 0;
+}
+
+/*
+Function: level_hash_cost() 
+        Measure the time a hash backend takes to compute both hash values of a key of key_len bytes, 
+        in nanoseconds per key, over LEVEL_HASH_COST_KEYS distinct keys; Return -1 if the backend is not supported
+*/
+double level_hash_cost(uint8_t backend, uint64_t key_len)
+{
+    if (!level_hash_supported(backend))
+        return -1;
+
+    level_hash level;
+    level.hash_backend = backend;
+    generate_seeds(&level);
+    level_key_t *keys = malloc(LEVEL_HASH_COST_KEYS * sizeof(level_key_t));
+#ifdef LEVEL_INTEGER_KEY
+    uint64_t k;
+    for (k = 0; k < LEVEL_HASH_COST_KEYS; k ++)
+        keys[k] = k * 0x9e3779b97f4a7c15ULL;
+#else
+    if (key_len > KEY_LEN - 1)
+        key_len = KEY_LEN - 1;
+    uint8_t *key_buf = calloc(LEVEL_HASH_COST_KEYS, KEY_LEN);
+    uint64_t k, i;
+    for (k = 0; k < LEVEL_HASH_COST_KEYS; k ++)
+    {
+        keys[k] = key_buf + k * KEY_LEN;
+        for (i = 0; i < key_len; i ++)
+            keys[k][i] = 'a' + (k >> (i % 4 * 4) & 15) + i % 3;
+    }
+#endif
+
+    uint64_t f_hash, s_hash, sum = 0;
+    for (k = 0; k < LEVEL_HASH_COST_KEYS; k ++)
+    {
+        FS_HASH(&level, keys[k], &f_hash, &s_hash);
+        sum += f_hash ^ s_hash;
+    }
+    uint64_t begin = level_time_ns();
+    for (k = 0; k < LEVEL_HASH_COST_KEYS; k ++)
+    {
+        FS_HASH(&level, keys[k], &f_hash, &s_hash);
+        sum += f_hash ^ s_hash;
+    }
+    uint64_t elapsed = level_time_ns() - begin;
+    __asm__ __volatile__("" : : "r"(sum));
+
+#ifndef LEVEL_INTEGER_KEY
+    free(key_buf);
+#endif
+    free(keys);
+    return (double)elapsed / LEVEL_HASH_COST_KEYS;
+}
+
+/*
+Function: level_load_factor() 
+        Return the ratio of stored items to all slots in the two levels
+*/
+static inline double level_load_factor(level_hash *level)
+{
+    uint64_t items = level->level_item_num[0] + level->level_item_num[1];
+    if (level->resize_state)
+        items += level->interim_item_num;
+    return (double)items / (level->total_capacity * ASSOC_NUM);
+}
+
+static uint8_t level_insert_item(level_hash *level, level_key_t key, level_value_t value, uint64_t f_hash, uint64_t s_hash, uint8_t fp);
+static uint8_t level_insert_displace(level_hash *level, level_key_t key, level_value_t value, uint64_t f_hash, uint64_t s_hash, uint8_t fp);
+
+/*
+Function: level_migrate()
+        Move the items in up to num interim buckets, from the migration cursor on, into the two levels;
+        The interim level is freed and the resizing ends once all of its buckets are moved
+*/
+static void level_migrate(level_hash *level, uint64_t num)
+{
+    uint64_t end_idx = level->migrate_cursor + num;
+    if (end_idx > level->interim_bucket_num)
+        end_idx = level->interim_bucket_num;
+
+    uint64_t old_idx, i;
+    for (old_idx = level->migrate_cursor; old_idx < end_idx; old_idx ++) {
+        level_bucket *old_bucket = &level->interim_level_buckets[old_idx];
+        for(i = 0; i < ASSOC_NUM; i ++){
+            if (GET_TOKEN(old_bucket->token, i))
+            {
+                uint64_t f_hash, s_hash;
+                level_slot_hash(level, old_bucket, i, &f_hash, &s_hash);
+
+                if (level->resize_state == 1)
+                {
+                    /*  The rehashed item is inserted into the less-loaded bucket between 
+                        the two hash locations in the new level
+                    */
+                    level_bucket *bucket;
+                    int j = level_pick_slot(&bucket, &level->buckets[0][F_IDX(f_hash, level->addr_capacity)], 
+                        &level->buckets[0][S_IDX(s_hash, level->addr_capacity)]);
+                    if (j != -1)
+                    {
+                        level_slot_move(bucket, j, old_bucket, i);
+                        level->level_item_num[0] ++;
+                        level->interim_item_num --;
+                        continue;
+                    }
+                }
+
+                /*  When shrinking, or when the new level has been filled by the insertions made 
+                    since the expanding began, the item is inserted as a new one
+                */
+                if(level_insert_item(level, old_bucket->slot[i].key, old_bucket->slot[i].value, 
+                    f_hash, s_hash, old_bucket->fp[i])){
+                        if (level->resize_state == 1)
+                            printf("The expanding fails: 3\n");
+                        else
+                            printf("The shrinking fails: 3\n");
+                        exit(1);   
+                }
+                SET_TOKEN(old_bucket->token, i, 0);
+                level->interim_item_num --;
+            }
+        }
+    }
+    level->migrate_cursor = end_idx;
+    // The bottom level of an expanding is counted in the hints at the pace of the migration, two buckets per interim bucket
+    if (level->resize_state == 1)
+        level_hint_count(level, level->addr_capacity / 2 * end_idx / level->interim_bucket_num);
+
+    if (level->migrate_cursor == level->interim_bucket_num)
+    {
+        level_block_free(level, level->interim_level_buckets, level->interim_bucket_num*sizeof(level_bucket));
+        level->interim_level_buckets = NULL;
+        level->interim_bucket_num = 0;
+        level->migrate_cursor = 0;
+        level->resize_state = 0;
+    }
+}
+
+/*
+Function: level_expand_prepare()
+        Put a new level on top of the old hash table and make the old bottom level the interim level,
+        whose items are then rehashed into the new level by level_migrate() or the expanding workers
+*/
+static void level_expand_prepare(level_hash *level)
+{
+    if (!level)
+    {
+        printf("The expanding fails: 1\n");
+        exit(1);
+    }
+#ifdef LEVEL_HASH_CACHE
+    if (level->level_size + 1 > LEVEL_HASH_CACHE_MAX_SIZE)
+    {
+        printf("The expanding fails: 4\n");
+        exit(1);
+    }
+#endif
+    // A resizing still in progress is finished first
+    if (level->resize_state)
+        level_migrate(level, level->interim_bucket_num);
+
+    level_bucket *newBuckets = (level_bucket*)level_block_alloc(level, pow(2, level->level_size + 1)*sizeof(level_bucket));
+    if (!newBuckets) {
+        printf("The expanding fails: 2\n");
+        exit(1);
+    }
+
+    level->resize_state = 1;
+    level->interim_level_buckets = level->buckets[1];
+    level->interim_bucket_num = pow(2, level->level_size - 1);
+    level->interim_item_num = level->level_item_num[1];
+    level->migrate_cursor = 0;
+    level->buckets[1] = level->buckets[0];
+    level->buckets[0] = newBuckets;
+    newBuckets = NULL;
+    
+    level->level_item_num[1] = level->level_item_num[0];
+    level->level_item_num[0] = 0;
+
+    level->level_size ++;
+    level->addr_capacity = pow(2, level->level_size);
+    level->total_capacity = pow(2, level->level_size) + pow(2, level->level_size - 1);
+    level->level_expand_time ++;
+    level->stats.expand_num ++;
+
+    // The old top level is now the bottom level, whose items are counted in the hints of the new top level by level_migrate()
+    level_hint_restart(level, 0);
+}
+
 /*
-Function: F_HASH()
-        Compute the first hash value of a key-value item
+Function: level_expand()
+        Expand a level hash table in place;
+        Put a new level on top of the old hash table and only rehash the
+        items in the bottom level of the old hash table;
+        With LEVEL_INCREMENTAL_RESIZE, the old bottom level becomes the interim level and
+        its items are migrated by the following insertions and deletions
 */
-uint64_t F_HASH(level_hash *level, const uint8_t *key) {
-    return (hash((void *)key, strlen(key), level->f_seed));
+void level_expand(level_hash *level) 
+{
+    uint64_t begin = level_time_ns();
+    level_expand_prepare(level);
+
+#ifndef LEVEL_INCREMENTAL_RESIZE
+    level_migrate(level, level->interim_bucket_num);
+#endif
+    level->stats.expand_ns += level_time_ns() - begin;
 }
 
+typedef struct expand_worker{             // A thread rehashing a range of interim buckets in level_expand_parallel()
+    pthread_t thread;
+    level_hash *level;
+    uint64_t begin_idx;
+    uint64_t end_idx;
+    uint64_t moved;                       // The number of items moved into the new level by this thread
+} expand_worker;
+
 /*
-Function: S_HASH() 
-        Compute the second hash value of a key-value item
+Function: level_claim_slot() 
+        Atomically take an empty slot for an item between its two candidate buckets, which other workers may take
+        slots in at the same time; The slot is marked occupied before its content is written
 */
-uint64_t S_HASH(level_hash *level, const uint8_t *key) {
-    return (hash((void *)key, strlen(key), level->s_seed));
+static inline int level_claim_slot(level_bucket **bucket, level_bucket *f_bucket, level_bucket *s_bucket)
+{
+    while (1) {
+        int j = level_pick_slot(bucket, f_bucket, s_bucket);
+        if (j == -1)
+            return -1;
+#ifdef LEVEL_ALIGNED_BUCKET
+        if (!(__atomic_fetch_or(&(*bucket)->token, 1U << j, __ATOMIC_ACQ_REL) & (1U << j)))
+            return j;
+#else
+        uint8_t expected = 0;
+        if (__atomic_compare_exchange_n(&(*bucket)->token[j], &expected, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            return j;
+#endif
+    }
 }
 
 /*
-Function: F_IDX() 
-        Compute the second hash location
+Function: expand_worker_run() 
+        Rehash the items of a range of interim buckets into the new level;
+        An item whose two new buckets are both full stays in the interim level and is moved after the workers finish
 */
-uint64_t F_IDX(uint64_t hashKey, uint64_t capacity) {
-    return hashKey % (capacity / 2);
+static void *expand_worker_run(void *arg)
+{
+    expand_worker *worker = arg;
+    level_hash *level = worker->level;
+
+    uint64_t old_idx, i;
+    for (old_idx = worker->begin_idx; old_idx < worker->end_idx; old_idx ++) {
+        level_bucket *old_bucket = &level->interim_level_buckets[old_idx];
+        for(i = 0; i < ASSOC_NUM; i ++){
+            if (GET_TOKEN(old_bucket->token, i))
+            {
+                uint64_t f_hash, s_hash;
+                level_slot_hash(level, old_bucket, i, &f_hash, &s_hash);
+
+                level_bucket *bucket;
+                int j = level_claim_slot(&bucket, &level->buckets[0][F_IDX(f_hash, level->addr_capacity)], 
+                    &level->buckets[0][S_IDX(s_hash, level->addr_capacity)]);
+                if (j != -1)
+                {
+                    level_slot_copy(bucket, j, old_bucket, i);
+                    SET_TOKEN(old_bucket->token, i, 0);
+                    worker->moved ++;
+                }
+            }
+        }
+    }
+    return NULL;
 }
 
 /*
-Function: S_IDX() 
-        Compute the second hash location
+Function: level_expand_parallel()
+        Expand a level hash table in place like level_expand(), rehashing the old bottom level with thread_num threads;
+        Each thread takes a contiguous range of the old bottom buckets, and the threads claim slots of the new
+        level atomically since their items can hash to the same new buckets
 */
-uint64_t S_IDX(uint64_t hashKey, uint64_t capacity) {
-    return hashKey % (capacity / 2) + capacity / 2;
+void level_expand_parallel(level_hash *level, uint32_t thread_num)
+{
+    uint64_t begin = level_time_ns();
+    level_expand_prepare(level);
+
+    if (thread_num > level->interim_bucket_num)
+        thread_num = level->interim_bucket_num;
+    if (thread_num > 1)
+    {
+        expand_worker *workers = malloc(thread_num * sizeof(expand_worker));
+        if (!workers) {
+            printf("The expanding fails: 5\n");
+            exit(1);
+        }
+
+        uint32_t t;
+        for (t = 0; t < thread_num; t ++) {
+            workers[t].level = level;
+            workers[t].begin_idx = level->interim_bucket_num * t / thread_num;
+            workers[t].end_idx = level->interim_bucket_num * (t + 1) / thread_num;
+            workers[t].moved = 0;
+            if (pthread_create(&workers[t].thread, NULL, expand_worker_run, &workers[t])) {
+                printf("The expanding fails: 5\n");
+                exit(1);
+            }
+        }
+        for (t = 0; t < thread_num; t ++) {
+            pthread_join(workers[t].thread, NULL);
+            level->level_item_num[0] += workers[t].moved;
+            level->interim_item_num -= workers[t].moved;
+        }
+        free(workers);
+    }
+
+    // The items left behind by the workers are moved here one by one
+    level_migrate(level, level->interim_bucket_num);
+    level->stats.expand_ns += level_time_ns() - begin;
 }
 
+typedef struct bulk_item{                 // An item of level_bulk_load() with its hash values, copied along as it is partitioned
+    uint64_t f_hash;
+    uint64_t s_hash;
+    entry item;
+} bulk_item;
 
-void* alignedmalloc(size_t size) {
-  void* ret;
-  posix_memalign(&ret, 64, size);
-  return ret;
+typedef struct bulk_loader{               // The state shared by the threads of level_bulk_load()
+    level_hash *level;
+    level_key_t *keys;
+    level_value_t *values;
+    uint64_t *hashes;                     // The two hash values of each input item, computed once by the first pass
+    uint32_t thread_num;
+    uint8_t pass;                         // 0: the first top-level buckets, 1: the second top-level buckets, 2: the bottom level
+    bulk_item *src;                       // The items left for this pass, or NULL for the input arrays
+    uint64_t src_num;
+    bulk_item *dst;                       // The items grouped by partition
+    uint64_t partition_num;
+    uint64_t *offsets;                    // offsets[t*partition_num + p]: where thread t puts its next item of partition p
+    uint64_t *partition_begin;            // Partition p takes dst[partition_begin[p], partition_begin[p+1])
+    uint64_t *partition_left;             // The items of partition p not placed end at partition_left[p]
+    uint64_t next_partition;              // The next partition to be taken by a thread
+#ifdef LEVEL_STABLE_VALUE
+    uint8_t *cells;                       // The value cells of the input items, reserved at once
+#endif
+} bulk_loader;
+
+typedef struct bulk_worker{               // A thread of level_bulk_load()
+    pthread_t thread;
+    bulk_loader *loader;
+    uint32_t id;
+    uint64_t placed[2];                   // The numbers of items placed into the top and bottom levels by this thread
+} bulk_worker;
+
+/*
+Function: bulk_bucket() 
+        The top-level bucket an item is placed into by the current pass, counted from the start of its half
+*/
+static inline uint64_t bulk_bucket(bulk_loader *loader, uint64_t f_hash, uint64_t s_hash)
+{
+    if (loader->pass == 0)
+        return F_IDX(f_hash, loader->level->addr_capacity);
+    return S_IDX(s_hash, loader->level->addr_capacity) - loader->level->addr_capacity / 2;
 }
 
 /*
-Function: generate_seeds() 
-        Generate two randomized seeds for hash functions
+Function: bulk_count_run() 
+        Count the items of each partition in the thread's range of the items left;
+        The first pass hashes the input items on the way
 */
-void generate_seeds(level_hash *level)
+static void *bulk_count_run(void *arg)
 {
-    srand(time(NULL));
-    do
-    {
-        level->f_seed = rand();
-        level->s_seed = rand();
-        level->f_seed = level->f_seed << (rand() % 63);
-        level->s_seed = level->s_seed << (rand() % 63);
-    } while (level->f_seed == level->s_seed);
+    bulk_worker *worker = arg;
+    bulk_loader *loader = worker->loader;
+    uint64_t *offsets = &loader->offsets[worker->id * loader->partition_num];
+    uint64_t k;
+
+    for (k = loader->src_num * worker->id / loader->thread_num; k < loader->src_num * (worker->id + 1) / loader->thread_num; k ++) {
+        uint64_t *hash;
+        if (loader->src == NULL)
+        {
+            // The hashes array is freed once the items are copied out of the caller's keys
+            hash = &loader->hashes[2 * k];
+            FS_HASH(loader->level, loader->keys[k], &hash[0], &hash[1]);
+        }
+        else
+            hash = &loader->src[k].f_hash;
+        offsets[bulk_bucket(loader, hash[0], hash[1]) / LEVEL_BULK_PARTITION] ++;
+    }
+    return NULL;
 }
 
 /*
-Function: level_init() 
-        Initialize a level hash table
+Function: bulk_scatter_run() 
+        Copy the items in the thread's range of the items left into their partitions
 */
-level_hash *level_init(uint64_t level_size)
+static void *bulk_scatter_run(void *arg)
 {
-    level_hash *level = alignedmalloc(sizeof(level_hash));
-    if (!level)
-    {
-        printf("The level hash table initialization fails:1\n");
-        exit(1);
+    bulk_worker *worker = arg;
+    bulk_loader *loader = worker->loader;
+    uint64_t *offsets = &loader->offsets[worker->id * loader->partition_num];
+    uint64_t k;
+
+    for (k = loader->src_num * worker->id / loader->thread_num; k < loader->src_num * (worker->id + 1) / loader->thread_num; k ++) {
+        if (loader->src)
+        {
+            bulk_item *item = &loader->src[k];
+            loader->dst[offsets[bulk_bucket(loader, item->f_hash, item->s_hash) / LEVEL_BULK_PARTITION] ++] = *item;
+            continue;
+        }
+
+        uint64_t *hash = &loader->hashes[2 * k];
+        bulk_item *item = &loader->dst[offsets[bulk_bucket(loader, hash[0], hash[1]) / LEVEL_BULK_PARTITION] ++];
+        item->f_hash = hash[0];
+        item->s_hash = hash[1];
+#ifdef LEVEL_INTEGER_KEY
+        item->item.key = loader->keys[k];
+        item->item.value = loader->values[k];
+#else
+        memcpy(item->item.key, loader->keys[k], KEY_LEN);
+#ifdef LEVEL_STABLE_VALUE
+        item->item.value = &loader->cells[k * VALUE_LEN];
+#endif
+        memcpy(item->item.value, loader->values[k], VALUE_LEN);
+#endif
     }
+    return NULL;
+}
 
-    level->level_size = level_size;
-    level->addr_capacity = pow(2, level_size);
-    level->total_capacity = pow(2, level_size) + pow(2, level_size - 1);
-    generate_seeds(level);
-    level->buckets[0] = (level_bucket*)numa_alloc_onnode(pow(2, level_size) * sizeof(level_bucket), 2);
-    level->buckets[1] = (level_bucket*)numa_alloc_onnode(pow(2, level_size - 1) * sizeof(level_bucket), 2);
-    level->level_item_num[0] = 0;
-    level->level_item_num[1] = 0;
-    level->level_expand_time = 0;
-    level->resize_state = 0;
-    
-    if (!level->buckets[0] || !level->buckets[1])
+/*
+Function: bulk_fill_run() 
+        Place the items of the partitions taken by the thread into their top-level buckets of this pass;
+        A partition owns the range of LEVEL_BULK_PARTITION buckets its items hash to, so the writes need 
+        no atomics and stay within a cache-sized range; The items that do not fit are kept for the next pass
+*/
+static void *bulk_fill_run(void *arg)
+{
+    bulk_worker *worker = arg;
+    bulk_loader *loader = worker->loader;
+    level_hash *level = loader->level;
+    level_bucket *buckets = loader->pass == 0 ? level->buckets[0] : &level->buckets[0][level->addr_capacity / 2];
+    uint64_t p, k;
+
+    while ((p = __atomic_fetch_add(&loader->next_partition, 1, __ATOMIC_RELAXED)) < loader->partition_num) {
+        uint64_t left = loader->partition_begin[p];
+        for (k = loader->partition_begin[p]; k < loader->partition_begin[p + 1]; k ++) {
+            bulk_item *item = &loader->dst[k];
+            level_bucket *bucket = &buckets[bulk_bucket(loader, item->f_hash, item->s_hash)];
+            int j = level_empty_slot(bucket);
+            if (j != -1)
+            {
+                level_slot_write(bucket, j, item->item.key, item->item.value, 
+                    item->f_hash, item->s_hash, FP_HASH(item->f_hash));
+                worker->placed[0] ++;
+            }else
+                loader->dst[left ++] = *item;
+        }
+        loader->partition_left[p] = left;
+    }
+    return NULL;
+}
+
+/*
+Function: bulk_spill_run() 
+        Place the items in the thread's range of the items left into their bottom-level buckets;
+        Few items get here, so they are not partitioned and the slots are claimed atomically;
+        The items that still do not fit are moved to the front of the range for the displacement path
+*/
+static void *bulk_spill_run(void *arg)
+{
+    bulk_worker *worker = arg;
+    bulk_loader *loader = worker->loader;
+    level_hash *level = loader->level;
+    uint64_t k;
+    uint64_t begin = loader->src_num * worker->id / loader->thread_num, left = begin;
+
+    for (k = begin; k < loader->src_num * (worker->id + 1) / loader->thread_num; k ++) {
+        bulk_item *item = &loader->src[k];
+        level_bucket *bucket;
+        int j = level_claim_slot(&bucket, &level->buckets[1][F_IDX(item->f_hash, level->addr_capacity / 2)], 
+            &level->buckets[1][S_IDX(item->s_hash, level->addr_capacity / 2)]);
+        if (j != -1)
+        {
+            level_slot_fill(bucket, j, item->item.key, item->item.value, 
+                item->f_hash, item->s_hash, FP_HASH(item->f_hash));
+            worker->placed[1] ++;
+        }else
+            loader->src[left ++] = *item;
+    }
+    loader->partition_left[worker->id] = left;
+    return NULL;
+}
+
+/*
+Function: bulk_run() 
+        Run one step of level_bulk_load() on all threads and wait for them
+*/
+static void bulk_run(bulk_worker *workers, uint32_t thread_num, void *(*run)(void *))
+{
+    uint32_t t;
+    if (thread_num == 1)
     {
-        printf("The level hash table initialization fails:2\n");
-        exit(1);
+        run(&workers[0]);
+        return;
     }
+    for (t = 0; t < thread_num; t ++) {
+        if (pthread_create(&workers[t].thread, NULL, run, &workers[t])) {
+            printf("The bulk loading fails: 2\n");
+            exit(1);
+        }
+    }
+    for (t = 0; t < thread_num; t ++)
+        pthread_join(workers[t].thread, NULL);
+}
 
-    printf("Level hashing: ASSOC_NUM %d, KEY_LEN %d, VALUE_LEN %d \n", ASSOC_NUM, KEY_LEN, VALUE_LEN);
-    printf("The number of top-level buckets: %ld\n", level->addr_capacity);
-    printf("The number of all buckets: %ld\n", level->total_capacity);
-    printf("The number of all entries: %ld\n", level->total_capacity*ASSOC_NUM);
-    printf("The level hash table initialization succeeds!\n");
-    return level;
+/*
+Function: bulk_fill_pass() 
+        Radix-partition the items left by top-level bucket and place them into the buckets of this pass;
+        The items not placed are gathered at the front of dst, and src_num is set to their number
+*/
+static void bulk_fill_pass(bulk_loader *loader, bulk_worker *workers)
+{
+    uint64_t p, k, offset = 0;
+    uint32_t t;
+
+    memset(loader->offsets, 0, (uint64_t)loader->thread_num * loader->partition_num * sizeof(uint64_t));
+    bulk_run(workers, loader->thread_num, bulk_count_run);
+
+    // Turn the counts into the offsets where each thread puts the items of each partition
+    for (p = 0; p < loader->partition_num; p ++) {
+        loader->partition_begin[p] = offset;
+        for (t = 0; t < loader->thread_num; t ++) {
+            uint64_t count = loader->offsets[t * loader->partition_num + p];
+            loader->offsets[t * loader->partition_num + p] = offset;
+            offset += count;
+        }
+    }
+    loader->partition_begin[loader->partition_num] = offset;
+
+    bulk_run(workers, loader->thread_num, bulk_scatter_run);
+    loader->next_partition = 0;
+    bulk_run(workers, loader->thread_num, bulk_fill_run);
+
+    loader->src_num = 0;
+    for (p = 0; p < loader->partition_num; p ++) {
+        for (k = loader->partition_begin[p]; k < loader->partition_left[p]; k ++)
+            loader->dst[loader->src_num ++] = loader->dst[k];
+    }
 }
 
 /*
-Function: level_expand()
-        Expand a level hash table in place;
-        Put a new level on top of the old hash table and only rehash the
-        items in the bottom level of the old hash table;
+Function: level_bulk_load() 
+        Build a level hash table holding the n items keys[i]/values[i], whose keys must be distinct, with thread_num threads;
+        The table is sized for n items up front; The items are radix-partitioned by their first top-level bucket 
+        and each partition fills its own range of buckets, then the items left are partitioned again by their
+        second top-level bucket; The few items left after that go to the bottom level, and only the items
+        whose candidate buckets are all full take the displacement path of level_insert()
 */
-void level_expand(level_hash *level) 
+level_hash *level_bulk_load(level_key_t *keys, level_value_t *values, uint64_t n, uint32_t thread_num)
 {
-    if (!level)
+    level_hash *level = level_init_for_items(n);
+    bulk_loader loader;
+    uint64_t k;
+    uint32_t t;
+
+    if (thread_num == 0)
+        thread_num = 1;
+    loader.level = level;
+    loader.keys = keys;
+    loader.values = values;
+#ifdef LEVEL_STABLE_VALUE
+    loader.cells = level_value_cells(level, n);
+#endif
+    loader.thread_num = thread_num;
+    loader.partition_num = (level->addr_capacity / 2 + LEVEL_BULK_PARTITION - 1) / LEVEL_BULK_PARTITION;
+    loader.offsets = malloc((uint64_t)thread_num * loader.partition_num * sizeof(uint64_t));
+    loader.partition_begin = malloc((loader.partition_num + 1) * sizeof(uint64_t));
+    loader.partition_left = malloc((loader.partition_num > thread_num ? loader.partition_num : thread_num) * sizeof(uint64_t));
+    loader.hashes = malloc(2 * n * sizeof(uint64_t) + 1);
+    bulk_item *items = malloc(n * sizeof(bulk_item) + 1);
+    bulk_worker *workers = calloc(thread_num, sizeof(bulk_worker));
+    if (!loader.offsets || !loader.partition_begin || !loader.partition_left || !loader.hashes || !items || !workers)
     {
-        printf("The expanding fails: 1\n");
+        printf("The bulk loading fails: 1\n");
         exit(1);
     }
-    level->resize_state = 1;
-    level->addr_capacity = pow(2, level->level_size + 1);
-    level_bucket *newBuckets = (level_bucket*)numa_alloc_onnode(level->addr_capacity*sizeof(level_bucket),2);
-    if (!newBuckets) {
-        printf("The expanding fails: 2\n");
+    for (t = 0; t < thread_num; t ++) {
+        workers[t].loader = &loader;
+        workers[t].id = t;
+    }
+
+    loader.pass = 0;
+    loader.src = NULL;
+    loader.src_num = n;
+    loader.dst = items;
+    bulk_fill_pass(&loader, workers);
+    free(loader.hashes);
+
+    // The items left by the first pass are partitioned again into a buffer of their size
+    loader.pass = 1;
+    loader.src = items;
+    loader.dst = malloc(loader.src_num * sizeof(bulk_item) + 1);
+    if (!loader.dst)
+    {
+        printf("The bulk loading fails: 1\n");
         exit(1);
     }
-    uint64_t new_level_item_num = 0;
-    
-    uint64_t old_idx;
-    for (old_idx = 0; old_idx < pow(2, level->level_size - 1); old_idx ++) {
-        uint64_t i, j;
-        for(i = 0; i < ASSOC_NUM; i ++){
-            if (level->buckets[1][old_idx].token[i] == 1)
-            {
-                uint8_t *key = level->buckets[1][old_idx].slot[i].key;
-                uint8_t *value = level->buckets[1][old_idx].slot[i].value;
+    bulk_fill_pass(&loader, workers);
+    free(items);
+    items = loader.dst;
 
-                uint64_t f_idx = F_IDX(F_HASH(level, key), level->addr_capacity);
-                uint64_t s_idx = S_IDX(S_HASH(level, key), level->addr_capacity);
+    loader.pass = 2;
+    loader.src = items;
+    bulk_run(workers, thread_num, bulk_spill_run);
+    // The spilled items are counted at once instead of by the threads, before the displacement path counts its own
+    level_hint_rebuild(level);
 
-                uint8_t insertSuccess = 0;
-                for(j = 0; j < ASSOC_NUM; j ++){                            
-                    /*  The rehashed item is inserted into the less-loaded bucket between 
-                        the two hash locations in the new level
-                    */
-                    if (newBuckets[f_idx].token[j] == 0)
-                    {
-                        memcpy(newBuckets[f_idx].slot[j].key, key, KEY_LEN);
-                        memcpy(newBuckets[f_idx].slot[j].value, value, VALUE_LEN);
-                        newBuckets[f_idx].token[j] = 1;
-                        insertSuccess = 1;
-                        new_level_item_num ++;
-                        break;
-                    }
-                    if (newBuckets[s_idx].token[j] == 0)
-                    {
-                        memcpy(newBuckets[s_idx].slot[j].key, key, KEY_LEN);
-                        memcpy(newBuckets[s_idx].slot[j].value, value, VALUE_LEN);
-                        newBuckets[s_idx].token[j] = 1;
-                        insertSuccess = 1;
-                        new_level_item_num ++;
-                        break;
-                    }
-                }
-                if(!insertSuccess){
-                    printf("The expanding fails: 3\n");
-                    exit(1);                    
-                }
-                
-                level->buckets[1][old_idx].token[i] = 0;
-            }
+    for (t = 0; t < thread_num; t ++) {
+        level->level_item_num[0] += workers[t].placed[0];
+        level->level_item_num[1] += workers[t].placed[1];
+    }
+
+    for (t = 0; t < thread_num; t ++) {
+        for (k = loader.src_num * t / thread_num; k < loader.partition_left[t]; k ++) {
+            bulk_item *item = &items[k];
+            while (level_insert_item(level, item->item.key, item->item.value, item->f_hash, item->s_hash, FP_HASH(item->f_hash)))
+                level_expand(level);
         }
     }
+    if (level->resize_state)
+        level_migrate(level, level->interim_bucket_num);
 
-    level->level_size ++;
-    level->total_capacity = pow(2, level->level_size) + pow(2, level->level_size - 1);
+    free(workers);
+    free(items);
+    free(loader.partition_left);
+    free(loader.partition_begin);
+    free(loader.offsets);
+    return level;
+}
 
-    //free(level->buckets[1]);
-    numa_free(level->buckets[1],pow(2,(level->level_size-2))*sizeof(level_bucket));
-    level->buckets[1] = level->buckets[0];
-    level->buckets[0] = newBuckets;
-    newBuckets = NULL;
-    
-    level->level_item_num[1] = level->level_item_num[0];
-    level->level_item_num[0] = new_level_item_num;
-    level->level_expand_time ++;
-    level->resize_state = 0;
+/*
+Function: level_reserve() 
+        Expand the hash table until it holds n items under the expanding threshold, 
+        and keep auto-resizing from shrinking it below that size
+*/
+void level_reserve(level_hash *level, uint64_t n)
+{
+    uint64_t level_size = level_size_for_items(n, level->expand_load_factor);
+    while (level->level_size < level_size)
+        level_expand(level);
+    if (level->resize_state)
+        level_migrate(level, level->interim_bucket_num);
+    if (level->min_level_size < level_size)
+        level->min_level_size = level_size;
 }
 
 /*
@@ -181,8 +1453,11 @@ Function: level_shrink()
         Shrink a level hash table in place;
         Put a new level at the bottom of the old hash table and only rehash the
         items in the top level of the old hash table;
+        With LEVEL_INCREMENTAL_RESIZE, the old top level becomes the interim level and
+        its items are migrated by the following insertions and deletions;
+        Return 1 without shrinking if the items would not fit in the shrunk table
 */
-void level_shrink(level_hash *level)
+uint8_t level_shrink(level_hash *level)
 {
     if (!level)
     {
@@ -190,16 +1465,29 @@ void level_shrink(level_hash *level)
         exit(1);
     }
 
-    // The shrinking is performed only when the hash table has very few items.
-    if(level->level_item_num[0] + level->level_item_num[1] > level->total_capacity*ASSOC_NUM*0.4){
+    uint64_t begin = level_time_ns();
+    // A resizing still in progress is finished first
+    if (level->resize_state)
+        level_migrate(level, level->interim_bucket_num);
+
+    /*  The shrinking is performed only when the hash table has very few items,
+        and the bottom level keeps at least two buckets
+    */
+    if(level->level_item_num[0] + level->level_item_num[1] > level->total_capacity*ASSOC_NUM*0.4 || level->level_size <= 2){
+        return 1;
+    }
+
+    level_bucket *newBuckets = (level_bucket*)level_block_alloc(level, pow(2, level->level_size - 2)*sizeof(level_bucket));
+    if (!newBuckets) {
         printf("The shrinking fails: 2\n");
         exit(1);
     }
-
     level->resize_state = 2;
     level->level_size --;
-    level_bucket *newBuckets = (level_bucket*)numa_alloc_onnode(pow(2, level->level_size - 1)*sizeof(level_bucket),2);
-    level_bucket *interimBuckets = level->buckets[0];
+    level->interim_level_buckets = level->buckets[0];
+    level->interim_bucket_num = pow(2, level->level_size + 1);
+    level->interim_item_num = level->level_item_num[0];
+    level->migrate_cursor = 0;
     level->buckets[0] = level->buckets[1];
     level->buckets[1] = newBuckets;
     newBuckets = NULL;
@@ -209,26 +1497,67 @@ void level_shrink(level_hash *level)
 
     level->addr_capacity = pow(2, level->level_size);
     level->total_capacity = pow(2, level->level_size) + pow(2, level->level_size - 1);
+    level->level_expand_time = 0;
 
-    uint64_t old_idx, i;
-    for (old_idx = 0; old_idx < pow(2, level->level_size+1); old_idx ++) {
-        for(i = 0; i < ASSOC_NUM; i ++){
-            if (interimBuckets[old_idx].token[i] == 1)
-            {
-                if(level_insert(level, interimBuckets[old_idx].slot[i].key, interimBuckets[old_idx].slot[i].value)){
-                        printf("The shrinking fails: 3\n");
-                        exit(1);   
-                }
+    // The new top level was a bottom level, which keeps its hints cleared
+    level_hint_restart(level, level->addr_capacity / 2);
 
-            interimBuckets[old_idx].token[i] = 0;
-            }
-        }
-    } 
+#ifndef LEVEL_INCREMENTAL_RESIZE
+    level_migrate(level, level->interim_bucket_num);
+#endif
+    level->stats.shrink_num ++;
+    level->stats.shrink_ns += level_time_ns() - begin;
+    return 0;
+}
 
-    //free(interimBuckets);
-    numa_free(interimBuckets,pow(2,level->level_size+1)*sizeof(level_bucket));
-    level->level_expand_time = 0;
-    level->resize_state = 0;
+/*
+Function: level_interim_find() 
+        Find a key in the interim level, which holds the items not migrated yet during a resizing;
+        Return the bucket storing the key and set *slot, or return NULL
+*/
+static inline level_bucket* level_interim_find(level_hash *level, level_key_t key, uint64_t f_hash, uint64_t s_hash, uint8_t fp, int *slot)
+{
+    level_bucket *bucket = &level->interim_level_buckets[F_IDX(f_hash, level->interim_bucket_num)];
+    *slot = level_find(bucket, key, fp);
+    if (*slot != -1)
+        return bucket;
+
+    bucket = &level->interim_level_buckets[S_IDX(s_hash, level->interim_bucket_num)];
+    *slot = level_find(bucket, key, fp);
+    if (*slot != -1)
+        return bucket;
+
+    return NULL;
+}
+
+/*
+Function: level_query_interim() 
+        Finish a lookup that has probed the given number of buckets in the two levels without finding the key:
+        search the interim level during a resizing, and count the buckets probed in the statistics
+*/
+static inline level_value_ref_t level_query_interim(level_hash *level, level_key_t key, uint64_t f_hash, uint64_t s_hash, 
+    uint8_t fp, uint64_t probes)
+{
+    if (level->resize_state)
+    {
+        level_bucket *bucket = &level->interim_level_buckets[F_IDX(f_hash, level->interim_bucket_num)];
+        int j = level_find(bucket, key, fp);
+        if (j != -1)
+        {
+            LEVEL_STATS_ADD(level, hit_probes[probes + 1]);
+            return VALUE_REF(bucket->slot[j]);
+        }
+        bucket = &level->interim_level_buckets[S_IDX(s_hash, level->interim_bucket_num)];
+        j = level_find(bucket, key, fp);
+        if (j != -1)
+        {
+            LEVEL_STATS_ADD(level, hit_probes[probes + 2]);
+            return VALUE_REF(bucket->slot[j]);
+        }
+        probes += 2;
+    }
+    LEVEL_STATS_ADD(level, miss_probes[probes]);
+    return NULL;
 }
 
 /*
@@ -236,29 +1565,32 @@ Function: level_dynamic_query()
         Lookup a key-value item in level hash table via danamic search scheme;
         First search the level with more items;
 */
-uint8_t* level_dynamic_query(level_hash *level, uint8_t *key)
+level_value_ref_t level_dynamic_query(level_hash *level, level_key_t key)
 {
     
-    uint64_t f_hash = F_HASH(level, key);
-    uint64_t s_hash = S_HASH(level, key);
+    uint64_t f_hash, s_hash;
+    FS_HASH(level, key, &f_hash, &s_hash);
+    uint8_t fp = FP_HASH(f_hash);
 
-    uint64_t i, j, f_idx, s_idx;
-    if(level->level_item_num[0] > level->level_item_num[1]){
+    uint64_t i, f_idx, s_idx;
+    int j;
+    uint64_t level_num = level_bottom_absent(level, f_hash, fp) ? 1 : 2;
+    if(level->level_item_num[0] > level->level_item_num[1] || level_num == 1){
         f_idx = F_IDX(f_hash, level->addr_capacity);
         s_idx = S_IDX(s_hash, level->addr_capacity); 
 
-        for(i = 0; i < 2; i ++){
-            for(j = 0; j < ASSOC_NUM; j ++){
-                if (level->buckets[i][f_idx].token[j] == 1&&strcmp(level->buckets[i][f_idx].slot[j].key, key) == 0)
-                {
-                    return level->buckets[i][f_idx].slot[j].value;
-                }
+        for(i = 0; i < level_num; i ++){
+            j = level_find(&level->buckets[i][f_idx], key, fp);
+            if (j != -1)
+            {
+                LEVEL_STATS_ADD(level, hit_probes[2 * i + 1]);
+                return VALUE_REF(level->buckets[i][f_idx].slot[j]);
             }
-            for(j = 0; j < ASSOC_NUM; j ++){
-                if (level->buckets[i][s_idx].token[j] == 1&&strcmp(level->buckets[i][s_idx].slot[j].key, key) == 0)
-                {
-                    return level->buckets[i][s_idx].slot[j].value;
-                }
+            j = level_find(&level->buckets[i][s_idx], key, fp);
+            if (j != -1)
+            {
+                LEVEL_STATS_ADD(level, hit_probes[2 * i + 2]);
+                return VALUE_REF(level->buckets[i][s_idx].slot[j]);
             }
             f_idx = F_IDX(f_hash, level->addr_capacity / 2);
             s_idx = S_IDX(s_hash, level->addr_capacity / 2);
@@ -269,23 +1601,58 @@ uint8_t* level_dynamic_query(level_hash *level, uint8_t *key)
         s_idx = S_IDX(s_hash, level->addr_capacity/2);
 
         for(i = 2; i > 0; i --){
-            for(j = 0; j < ASSOC_NUM; j ++){
-                if (level->buckets[i-1][f_idx].token[j] == 1&&strcmp(level->buckets[i-1][f_idx].slot[j].key, key) == 0)
-                {
-                    return level->buckets[i-1][f_idx].slot[j].value;
-                }
+            j = level_find(&level->buckets[i-1][f_idx], key, fp);
+            if (j != -1)
+            {
+                LEVEL_STATS_ADD(level, hit_probes[2 * (2 - i) + 1]);
+                return VALUE_REF(level->buckets[i-1][f_idx].slot[j]);
             }
-            for(j = 0; j < ASSOC_NUM; j ++){
-                if (level->buckets[i-1][s_idx].token[j] == 1&&strcmp(level->buckets[i-1][s_idx].slot[j].key, key) == 0)
-                {
-                    return level->buckets[i-1][s_idx].slot[j].value;
-                }
+            j = level_find(&level->buckets[i-1][s_idx], key, fp);
+            if (j != -1)
+            {
+                LEVEL_STATS_ADD(level, hit_probes[2 * (2 - i) + 2]);
+                return VALUE_REF(level->buckets[i-1][s_idx].slot[j]);
             }
             f_idx = F_IDX(f_hash, level->addr_capacity);
             s_idx = S_IDX(s_hash, level->addr_capacity);
         }
     }
-    return NULL;
+
+    return level_query_interim(level, key, f_hash, s_hash, fp, 2 * level_num);
+}
+
+/*
+Function: level_static_search() 
+        Search a key whose hash values are already computed via static search scheme;
+*/
+static inline level_value_ref_t level_static_search(level_hash *level, level_key_t key, uint64_t f_hash, uint64_t s_hash)
+{
+    uint64_t f_idx = F_IDX(f_hash, level->addr_capacity);
+    uint64_t s_idx = S_IDX(s_hash, level->addr_capacity);
+    uint8_t fp = FP_HASH(f_hash);
+    
+    // The bottom level is skipped when the hint of the first top-level bucket rules the key out
+    uint64_t level_num = level_bottom_absent(level, f_hash, fp) ? 1 : 2;
+    uint64_t i;
+    int j;
+    for(i = 0; i < level_num; i ++){
+        j = level_find(&level->buckets[i][f_idx], key, fp);
+        if (j != -1)
+        {
+            LEVEL_STATS_ADD(level, hit_probes[2 * i + 1]);
+            return VALUE_REF(level->buckets[i][f_idx].slot[j]);
+        }
+        j = level_find(&level->buckets[i][s_idx], key, fp);
+        if (j != -1)
+        {
+            LEVEL_STATS_ADD(level, hit_probes[2 * i + 2]);
+            return VALUE_REF(level->buckets[i][s_idx].slot[j]);
+        }
+        f_idx = F_IDX(f_hash, level->addr_capacity / 2);
+        s_idx = S_IDX(s_hash, level->addr_capacity / 2);
+    }
+
+    return level_query_interim(level, key, f_hash, s_hash, fp, 2 * level_num);
 }
 
 /*
@@ -293,156 +1660,297 @@ Function: level_static_query()
         Lookup a key-value item in level hash table via static search scheme;
         Always first search the top level and then search the bottom level;
 */
-uint8_t* level_static_query(level_hash *level, uint8_t *key)
+level_value_ref_t level_static_query(level_hash *level, level_key_t key)
 {
-    uint64_t f_hash = F_HASH(level, key);
-    uint64_t s_hash = S_HASH(level, key);
-    uint64_t f_idx = F_IDX(f_hash, level->addr_capacity);
-    uint64_t s_idx = S_IDX(s_hash, level->addr_capacity);
-    
-    uint64_t i, j;
-    for(i = 0; i < 2; i ++){
-        for(j = 0; j < ASSOC_NUM; j ++){
-            if (level->buckets[i][f_idx].token[j] == 1&&strcmp(level->buckets[i][f_idx].slot[j].key, key) == 0)
-            {
-                return level->buckets[i][f_idx].slot[j].value;
-            }
+    uint64_t f_hash, s_hash;
+    FS_HASH(level, key, &f_hash, &s_hash);
+
+    return level_static_search(level, key, f_hash, s_hash);
+}
+
+/*
+Function: level_query_batch() 
+        Lookup n key-value items via static search scheme, values[i] is set to the value of keys[i] or NULL;
+        The keys are handled in groups of LEVEL_BATCH_SIZE: all keys of a group are hashed and their four 
+        candidate buckets are prefetched before any bucket is probed, so that the cache misses of 
+        different keys overlap instead of being taken one after another;
+        Return the number of keys found
+*/
+uint64_t level_query_batch(level_hash *level, level_key_t *keys, uint64_t n, level_value_ref_t *values)
+{
+    uint64_t f_hash[LEVEL_BATCH_SIZE], s_hash[LEVEL_BATCH_SIZE];
+    uint64_t found = 0;
+    uint64_t base, k, batch;
+
+    for (base = 0; base < n; base += batch) {
+        batch = n - base < LEVEL_BATCH_SIZE ? n - base : LEVEL_BATCH_SIZE;
+
+        for (k = 0; k < batch; k ++) {
+            FS_HASH(level, keys[base + k], &f_hash[k], &s_hash[k]);
+            __builtin_prefetch(&level->buckets[0][F_IDX(f_hash[k], level->addr_capacity)]);
+            __builtin_prefetch(&level->buckets[0][S_IDX(s_hash[k], level->addr_capacity)]);
+            __builtin_prefetch(&level->buckets[1][F_IDX(f_hash[k], level->addr_capacity / 2)]);
+            __builtin_prefetch(&level->buckets[1][S_IDX(s_hash[k], level->addr_capacity / 2)]);
         }
-        for(j = 0; j < ASSOC_NUM; j ++){
-            if (level->buckets[i][s_idx].token[j] == 1&&strcmp(level->buckets[i][s_idx].slot[j].key, key) == 0)
-            {
-                return level->buckets[i][s_idx].slot[j].value;
-            }
+
+        for (k = 0; k < batch; k ++) {
+            values[base + k] = level_static_search(level, keys[base + k], f_hash[k], s_hash[k]);
+            if (values[base + k])
+                found ++;
         }
-        f_idx = F_IDX(f_hash, level->addr_capacity / 2);
-        s_idx = S_IDX(s_hash, level->addr_capacity / 2);
     }
 
-    return NULL;
+    return found;
 }
 
-
 /*
-Function: level_delete() 
+Function: level_delete_item() 
         Remove a key-value item from level hash table;
         The function can be optimized by using the dynamic search scheme
 */
-uint8_t level_delete(level_hash *level, uint8_t *key)
+static uint8_t level_delete_item(level_hash *level, level_key_t key)
 {
-    uint64_t f_hash = F_HASH(level, key);
-    uint64_t s_hash = S_HASH(level, key);
+    uint64_t f_hash, s_hash;
+    FS_HASH(level, key, &f_hash, &s_hash);
     uint64_t f_idx = F_IDX(f_hash, level->addr_capacity);
     uint64_t s_idx = S_IDX(s_hash, level->addr_capacity);
+    uint8_t fp = FP_HASH(f_hash);
     
-    uint64_t i, j;
-    for(i = 0; i < 2; i ++){
-        for(j = 0; j < ASSOC_NUM; j ++){
-            if (level->buckets[i][f_idx].token[j] == 1&&strcmp(level->buckets[i][f_idx].slot[j].key, key) == 0)
-            {
-                level->buckets[i][f_idx].token[j] = 0;
-                level->level_item_num[i] --;
-                return 0;
-            }
+    uint64_t level_num = level_bottom_absent(level, f_hash, fp) ? 1 : 2;
+    uint64_t i;
+    int j;
+    for(i = 0; i < level_num; i ++){
+        j = level_find(&level->buckets[i][f_idx], key, fp);
+        if (j != -1)
+        {
+            level_value_release(level, level->buckets[i][f_idx].slot[j].value);
+            SET_TOKEN(level->buckets[i][f_idx].token, j, 0);
+            level->level_item_num[i] --;
+            if (i == 1)
+                level_hint_remove(level, f_idx, f_hash, fp);
+            return 0;
         }
-        for(j = 0; j < ASSOC_NUM; j ++){
-            if (level->buckets[i][s_idx].token[j] == 1&&strcmp(level->buckets[i][s_idx].slot[j].key, key) == 0)
-            {
-                level->buckets[i][s_idx].token[j] = 0;
-                level->level_item_num[i] --;
-                return 0;
-            }
+        j = level_find(&level->buckets[i][s_idx], key, fp);
+        if (j != -1)
+        {
+            level_value_release(level, level->buckets[i][s_idx].slot[j].value);
+            SET_TOKEN(level->buckets[i][s_idx].token, j, 0);
+            level->level_item_num[i] --;
+            if (i == 1)
+                level_hint_remove(level, s_idx, f_hash, fp);
+            return 0;
         }
         f_idx = F_IDX(f_hash, level->addr_capacity / 2);
         s_idx = S_IDX(s_hash, level->addr_capacity / 2);
     }
 
+    if (level->resize_state)
+    {
+        level_bucket *bucket = level_interim_find(level, key, f_hash, s_hash, fp, &j);
+        if (bucket)
+        {
+            level_value_release(level, bucket->slot[j].value);
+            SET_TOKEN(bucket->token, j, 0);
+            level->interim_item_num --;
+            return 0;
+        }
+    }
     return 1;
 }
 
+/*
+Function: level_delete() 
+        Remove a key-value item from level hash table;
+        With auto-resizing, the hash table is shrunk when its load factor falls below the shrinking threshold
+*/
+uint8_t level_delete(level_hash *level, level_key_t key)
+{
+    if (level->resize_state)
+        level_migrate(level, LEVEL_MIGRATE_STEP);
+
+    if (level_delete_item(level, key))
+        return 1;
+
+    if (level->auto_resize && level->resize_state == 0 && level->level_size > level->min_level_size
+        && level_load_factor(level) < level->shrink_load_factor)
+        level_shrink(level);
+    return 0;
+}
+
 /*
 Function: level_update() 
         Update the value of a key-value item in level hash table;
         The function can be optimized by using the dynamic search scheme
 */
-uint8_t level_update(level_hash *level, uint8_t *key, uint8_t *new_value)
+uint8_t level_update(level_hash *level, level_key_t key, level_value_t new_value)
 {
-    uint64_t f_hash = F_HASH(level, key);
-    uint64_t s_hash = S_HASH(level, key);
+    uint64_t f_hash, s_hash;
+    FS_HASH(level, key, &f_hash, &s_hash);
     uint64_t f_idx = F_IDX(f_hash, level->addr_capacity);
     uint64_t s_idx = S_IDX(s_hash, level->addr_capacity);
+    uint8_t fp = FP_HASH(f_hash);
     
-    uint64_t i, j;
-    for(i = 0; i < 2; i ++){
-        for(j = 0; j < ASSOC_NUM; j ++){
-            if (level->buckets[i][f_idx].token[j] == 1&&strcmp(level->buckets[i][f_idx].slot[j].key, key) == 0)
-            {
-                memcpy(level->buckets[i][f_idx].slot[j].value, new_value, VALUE_LEN);
-                return 0;
-            }
+    uint64_t level_num = level_bottom_absent(level, f_hash, fp) ? 1 : 2;
+    uint64_t i;
+    int j;
+    for(i = 0; i < level_num; i ++){
+        j = level_find(&level->buckets[i][f_idx], key, fp);
+        if (j != -1)
+        {
+#ifdef LEVEL_INTEGER_KEY
+            level->buckets[i][f_idx].slot[j].value = new_value;
+#else
+            memcpy(level->buckets[i][f_idx].slot[j].value, new_value, VALUE_LEN);
+#endif
+            return 0;
         }
-        for(j = 0; j < ASSOC_NUM; j ++){
-            if (level->buckets[i][s_idx].token[j] == 1&&strcmp(level->buckets[i][s_idx].slot[j].key, key) == 0)
-            {
-                memcpy(level->buckets[i][s_idx].slot[j].value, new_value, VALUE_LEN);
-                return 0;
-            }
+        j = level_find(&level->buckets[i][s_idx], key, fp);
+        if (j != -1)
+        {
+#ifdef LEVEL_INTEGER_KEY
+            level->buckets[i][s_idx].slot[j].value = new_value;
+#else
+            memcpy(level->buckets[i][s_idx].slot[j].value, new_value, VALUE_LEN);
+#endif
+            return 0;
         }
         f_idx = F_IDX(f_hash, level->addr_capacity / 2);
         s_idx = S_IDX(s_hash, level->addr_capacity / 2);
     }
 
+    if (level->resize_state)
+    {
+        level_bucket *bucket = level_interim_find(level, key, f_hash, s_hash, fp, &j);
+        if (bucket)
+        {
+#ifdef LEVEL_INTEGER_KEY
+            bucket->slot[j].value = new_value;
+#else
+            memcpy(bucket->slot[j].value, new_value, VALUE_LEN);
+#endif
+            return 0;
+        }
+    }
     return 1;
 }
 
 /*
-Function: level_insert() 
-        Insert a key-value item into level hash table;
+Function: level_insert_item() 
+        Insert a key-value item whose hash values and fingerprint are already known;
 */
-uint8_t level_insert(level_hash *level, uint8_t *key, uint8_t *value)
+static uint8_t level_insert_item(level_hash *level, level_key_t key, level_value_t value, uint64_t f_hash, uint64_t s_hash, uint8_t fp)
 {
-    uint64_t f_hash = F_HASH(level, key);
-    uint64_t s_hash = S_HASH(level, key);
     uint64_t f_idx = F_IDX(f_hash, level->addr_capacity);
     uint64_t s_idx = S_IDX(s_hash, level->addr_capacity);
 
-    uint64_t i, j;
-    int empty_location;
+    uint64_t i;
+    int j;
 
     for(i = 0; i < 2; i ++){
-        for(j = 0; j < ASSOC_NUM; j ++){        
-            /*  The new item is inserted into the less-loaded bucket between 
-                the two hash locations in each level           
-            */      
-            if (level->buckets[i][f_idx].token[j] == 0)
-            {
-                memcpy(level->buckets[i][f_idx].slot[j].key, key, KEY_LEN);
-                memcpy(level->buckets[i][f_idx].slot[j].value, value, VALUE_LEN);
-                level->buckets[i][f_idx].token[j] = 1;
-                level->level_item_num[i] ++;
-                return 0;
-            }
-            if (level->buckets[i][s_idx].token[j] == 0) 
-            {
-                memcpy(level->buckets[i][s_idx].slot[j].key, key, KEY_LEN);
-                memcpy(level->buckets[i][s_idx].slot[j].value, value, VALUE_LEN);
-                level->buckets[i][s_idx].token[j] = 1;
-                level->level_item_num[i] ++;
-                return 0;
-            }
+        /*  The new item is inserted into the less-loaded bucket between 
+            the two hash locations in each level           
+        */      
+        level_bucket *bucket;
+        j = level_pick_slot(&bucket, &level->buckets[i][f_idx], &level->buckets[i][s_idx]);
+        if (j != -1)
+        {
+            level_slot_write(bucket, j, key, value, f_hash, s_hash, fp);
+            level->level_item_num[i] ++;
+            if (i == 1)
+                level_hint_add(level, bucket - level->buckets[1], f_hash, fp);
+            return 0;
         }
         
         f_idx = F_IDX(f_hash, level->addr_capacity / 2);
         s_idx = S_IDX(s_hash, level->addr_capacity / 2);
     }
 
-    f_idx = F_IDX(f_hash, level->addr_capacity);
-    s_idx = S_IDX(s_hash, level->addr_capacity);
+    return level_insert_displace(level, key, value, f_hash, s_hash, fp);
+}
+
+typedef struct level_path_node{           // A bucket visited by level_displace_path()
+    uint64_t idx;
+    int32_t parent;                       // The node whose item would move into this bucket, -1 for a candidate bucket
+    uint8_t slot;                         // The slot of that item in the parent bucket
+    uint8_t depth;                        // The number of movements that free a slot in this bucket
+} level_path_node;
+
+/*
+Function: level_displace_path() 
+        Search breadth-first, within one level, for the shortest path of movements that frees a slot in one of 
+        the two full candidate buckets f_idx and s_idx of a new item, as in cuckoo hashing; The path is at most 
+        level->displace_depth movements long and at most LEVEL_DISPLACE_NODES buckets are visited; A bucket 
+        already on a path is not visited again through it, so the movements, carried out from the end of the 
+        path, always move an item into the slot freed just before;
+        Return the freed slot and set *idx to its bucket, or return -1 if no path is found
+*/
+static int level_displace_path(level_hash *level, uint64_t level_num, uint64_t f_idx, uint64_t s_idx, uint64_t *idx)
+{
+    level_path_node path[LEVEL_DISPLACE_NODES];
+    level_bucket *buckets = level->buckets[level_num];
+    uint64_t capacity = level->addr_capacity / (1 + level_num);
+    uint32_t head, tail = 0;
+    int32_t n;
+    uint64_t i;
+
+    path[tail ++] = (level_path_node){f_idx, -1, 0, 0};
+    path[tail ++] = (level_path_node){s_idx, -1, 0, 0};
+
+    for (head = 0; head < tail && path[head].depth < level->displace_depth; head ++) {
+        for(i = 0; i < ASSOC_NUM; i ++){
+            uint64_t f_hash, s_hash;
+            level_slot_hash(level, &buckets[path[head].idx], i, &f_hash, &s_hash);
+            uint64_t jdx = F_IDX(f_hash, capacity) == path[head].idx ? S_IDX(s_hash, capacity) : F_IDX(f_hash, capacity);
+
+            for (n = head; n != -1 && path[n].idx != jdx; n = path[n].parent)
+                ;
+            if (n != -1)
+                continue;
+
+            int j = level_empty_slot(&buckets[jdx]);
+            if (j != -1)
+            {
+                // Each item on the path moves into the slot freed by the movement after it
+                level_slot_move(&buckets[jdx], j, &buckets[path[head].idx], i);
+                level_hint_shift(level, level_num, jdx, j, path[head].idx);
+                j = i;
+                for (n = head; path[n].parent != -1; n = path[n].parent) {
+                    level_slot_move(&buckets[path[n].idx], j, &buckets[path[path[n].parent].idx], path[n].slot);
+                    level_hint_shift(level, level_num, path[n].idx, j, path[path[n].parent].idx);
+                    j = path[n].slot;
+                }
+                *idx = path[n].idx;
+                return j;
+            }
+            if (tail < LEVEL_DISPLACE_NODES)
+                path[tail ++] = (level_path_node){jdx, head, i, path[head].depth + 1};
+        }
+    }
+    return -1;
+}
+
+/*
+Function: level_insert_displace() 
+        Insert a key-value item whose four candidate buckets are all full, by moving items
+        within its level (up to displace_depth movements) or an item from the bottom level to the top level to make room;
+*/
+static uint8_t level_insert_displace(level_hash *level, level_key_t key, level_value_t value, uint64_t f_hash, uint64_t s_hash, uint8_t fp)
+{
+    uint64_t f_idx = F_IDX(f_hash, level->addr_capacity);
+    uint64_t s_idx = S_IDX(s_hash, level->addr_capacity);
+
+    uint64_t i, idx;
+    int empty_location;
     
     for(i = 0; i < 2; i++){
-        if(!try_movement(level, f_idx, i, key, value)){
-            return 0;
-        }
-        if(!try_movement(level, s_idx, i, key, value)){
+        LEVEL_STATS_ADD(level, movement_tries[0]);
+        empty_location = level_displace_path(level, i, f_idx, s_idx, &idx);
+        if(empty_location != -1){
+            LEVEL_STATS_ADD(level, movement_successes[0]);
+            level_slot_write(&level->buckets[i][idx], empty_location, key, value, f_hash, s_hash, fp);
+            level->level_item_num[i] ++;
+            if (i == 1)
+                level_hint_add(level, idx, f_hash, fp);
             return 0;
         }
 
@@ -451,21 +1959,23 @@ uint8_t level_insert(level_hash *level, uint8_t *key, uint8_t *value)
     }
     
     if(level->level_expand_time > 0){
+        LEVEL_STATS_ADD(level, movement_tries[1]);
         empty_location = b2t_movement(level, f_idx);
         if(empty_location != -1){
-            memcpy(level->buckets[1][f_idx].slot[empty_location].key, key, KEY_LEN);
-            memcpy(level->buckets[1][f_idx].slot[empty_location].value, value, VALUE_LEN);
-            level->buckets[1][f_idx].token[empty_location] = 1;
+            LEVEL_STATS_ADD(level, movement_successes[1]);
+            level_slot_write(&level->buckets[1][f_idx], empty_location, key, value, f_hash, s_hash, fp);
             level->level_item_num[1] ++;
+            level_hint_add(level, f_idx, f_hash, fp);
             return 0;
         }
 
+        LEVEL_STATS_ADD(level, movement_tries[1]);
         empty_location = b2t_movement(level, s_idx);
         if(empty_location != -1){
-            memcpy(level->buckets[1][s_idx].slot[empty_location].key, key, KEY_LEN);
-            memcpy(level->buckets[1][s_idx].slot[empty_location].value, value, VALUE_LEN);
-            level->buckets[1][s_idx].token[empty_location] = 1;
+            LEVEL_STATS_ADD(level, movement_successes[1]);
+            level_slot_write(&level->buckets[1][s_idx], empty_location, key, value, f_hash, s_hash, fp);
             level->level_item_num[1] ++;
+            level_hint_add(level, s_idx, f_hash, fp);
             return 0;
         }
     }
@@ -473,19 +1983,197 @@ uint8_t level_insert(level_hash *level, uint8_t *key, uint8_t *value)
     return 1;
 }
 
+/*
+Function: level_insert_expanding() 
+        Place an item whose key is known to be absent, expanding the hash table until it fits;
+        An item that still does not fit once the load factor is below half of the expanding threshold 
+        is not helped by more expandings, e.g., when too many keys share its buckets, so the expanding 
+        stops there; Return 0 if the item is inserted, 1 otherwise
+*/
+static uint8_t level_insert_expanding(level_hash *level, level_key_t key, level_value_t value, uint64_t f_hash, uint64_t s_hash, uint8_t fp)
+{
+    while (level_insert_item(level, key, value, f_hash, s_hash, fp))
+    {
+        if (level_load_factor(level) < level->expand_load_factor / 2)
+            return 1;
+        level_expand(level);
+    }
+    return 0;
+}
+
+/*
+Function: level_insert() 
+        Insert a key-value item into level hash table;
+        With auto-resizing, the hash table is expanded when the item does not fit or when
+        its load factor rises above the expanding threshold; Return 1 if the item does not fit 
+        even after the expandings allowed by level_insert_expanding()
+*/
+uint8_t level_insert(level_hash *level, level_key_t key, level_value_t value)
+{
+    if (level->resize_state)
+        level_migrate(level, LEVEL_MIGRATE_STEP);
+
+    uint64_t f_hash, s_hash;
+    FS_HASH(level, key, &f_hash, &s_hash);
+    uint8_t fp = FP_HASH(f_hash);
+    value = level_value_store(level, value);
+
+    if (!level->auto_resize)
+    {
+        uint8_t ret = level_insert_item(level, key, value, f_hash, s_hash, fp);
+        if (ret)
+            level_value_release(level, value);
+        return ret;
+    }
+
+    // With auto-resizing, the hash table is expanded until the item fits
+    if (level_insert_expanding(level, key, value, f_hash, s_hash, fp))
+    {
+        level_value_release(level, value);
+        return 1;
+    }
+
+    if (level->resize_state == 0 && level_load_factor(level) > level->expand_load_factor)
+        level_expand(level);
+    return 0;
+}
+
+/*
+Function: level_upsert_item() 
+        Insert a key-value item, or find it if the key is already there, in one pass over the four candidate buckets;
+        Each bucket is checked for the key and, while no free slot has been found yet, the less-loaded bucket 
+        of the level is remembered, so the item is placed as level_insert_item() would place it without a 
+        second probe; Only when all four buckets are full does the insertion fall back to the movements;
+        The value of an existing key is overwritten if overwrite is set;
+        Return 0 if the item is inserted, LEVEL_KEY_EXISTS if the key exists and 1 if the item does not fit
+*/
+static uint8_t level_upsert_item(level_hash *level, level_key_t key, level_value_t value, uint64_t f_hash, uint64_t s_hash, uint8_t fp,
+    uint8_t overwrite)
+{
+    uint64_t f_idx = F_IDX(f_hash, level->addr_capacity);
+    uint64_t s_idx = S_IDX(s_hash, level->addr_capacity);
+
+    level_bucket *bucket = NULL, *free_bucket = NULL;
+    uint64_t i, free_level = 0;
+    int j, free_slot = -1;
+
+    // The bottom level is only searched for a free slot when the hint rules the key out
+    uint64_t level_num = level_bottom_absent(level, f_hash, fp) ? 1 : 2;
+    for(i = 0; i < 2 && bucket == NULL; i ++){
+        j = i < level_num ? level_find(&level->buckets[i][f_idx], key, fp) : -1;
+        if (j != -1)
+            bucket = &level->buckets[i][f_idx];
+        else if (i < level_num)
+        {
+            j = level_find(&level->buckets[i][s_idx], key, fp);
+            if (j != -1)
+                bucket = &level->buckets[i][s_idx];
+        }
+
+        if (bucket == NULL && free_slot == -1)
+        {
+            free_slot = level_pick_slot(&free_bucket, &level->buckets[i][f_idx], &level->buckets[i][s_idx]);
+            free_level = i;
+        }
+        f_idx = F_IDX(f_hash, level->addr_capacity / 2);
+        s_idx = S_IDX(s_hash, level->addr_capacity / 2);
+    }
+
+    if (bucket == NULL && level->resize_state)
+        bucket = level_interim_find(level, key, f_hash, s_hash, fp, &j);
+
+    if (bucket)
+    {
+        if (overwrite)
+        {
+#ifdef LEVEL_INTEGER_KEY
+            bucket->slot[j].value = value;
+#else
+            memcpy(bucket->slot[j].value, value, VALUE_LEN);
+#endif
+        }
+        return LEVEL_KEY_EXISTS;
+    }
+
+    if (free_slot != -1)
+    {
+        level_slot_write(free_bucket, free_slot, key, value, f_hash, s_hash, fp);
+        level->level_item_num[free_level] ++;
+        if (free_level == 1)
+            level_hint_add(level, free_bucket - level->buckets[1], f_hash, fp);
+        return 0;
+    }
+    return level_insert_displace(level, key, value, f_hash, s_hash, fp);
+}
+
+/*
+Function: level_upsert_key() 
+        The common part of level_upsert() and level_insert_if_absent(), resizing like level_insert()
+*/
+static uint8_t level_upsert_key(level_hash *level, level_key_t key, level_value_t value, uint8_t overwrite)
+{
+    if (level->resize_state)
+        level_migrate(level, LEVEL_MIGRATE_STEP);
+
+    uint64_t f_hash, s_hash;
+    FS_HASH(level, key, &f_hash, &s_hash);
+    uint8_t fp = FP_HASH(f_hash);
+
+    value = level_value_store(level, value);
+
+    uint8_t ret = level_upsert_item(level, key, value, f_hash, s_hash, fp, overwrite);
+    // The value is only kept in a new item, an existing item has its own copy
+    if (ret == LEVEL_KEY_EXISTS || (ret && !level->auto_resize))
+        level_value_release(level, value);
+    if (!level->auto_resize || ret == LEVEL_KEY_EXISTS)
+        return ret;
+
+    // The key is known to be absent, so only the placement is retried
+    if (ret && level_insert_expanding(level, key, value, f_hash, s_hash, fp))
+    {
+        level_value_release(level, value);
+        return 1;
+    }
+
+    if (level->resize_state == 0 && level_load_factor(level) > level->expand_load_factor)
+        level_expand(level);
+    return 0;
+}
+
+/*
+Function: level_upsert() 
+        Insert a key-value item, or overwrite the value if the key is already in level hash table;
+        The key is hashed once and its candidate buckets are probed once;
+        Return 0 if the item is inserted, LEVEL_KEY_EXISTS if the value is overwritten and 1 if the item does not fit
+*/
+uint8_t level_upsert(level_hash *level, level_key_t key, level_value_t value)
+{
+    return level_upsert_key(level, key, value, 1);
+}
+
+/*
+Function: level_insert_if_absent() 
+        Insert a key-value item only if the key is not in level hash table yet;
+        The key is hashed once and its candidate buckets are probed once;
+        Return 0 if the item is inserted, LEVEL_KEY_EXISTS if the key exists and 1 if the item does not fit
+*/
+uint8_t level_insert_if_absent(level_hash *level, level_key_t key, level_value_t value)
+{
+    return level_upsert_key(level, key, value, 0);
+}
+
 /*
 Function: try_movement() 
         Try to move an item from the current bucket to its same-level alternative bucket;
+        Return the slot that is freed in the current bucket, or -1 if no item can be moved
 */
-uint8_t try_movement(level_hash *level, uint64_t idx, uint64_t level_num, uint8_t *key, uint8_t *value)
+int try_movement(level_hash *level, uint64_t idx, uint64_t level_num)
 {
-    uint64_t i, j, jdx;
+    uint64_t i, jdx;
 
     for(i = 0; i < ASSOC_NUM; i ++){
-        uint8_t *m_key = level->buckets[level_num][idx].slot[i].key;
-        uint8_t *m_value = level->buckets[level_num][idx].slot[i].value;
-        uint64_t f_hash = F_HASH(level, m_key);
-        uint64_t s_hash = S_HASH(level, m_key);
+        uint64_t f_hash, s_hash;
+        level_slot_hash(level, &level->buckets[level_num][idx], i, &f_hash, &s_hash);
         uint64_t f_idx = F_IDX(f_hash, level->addr_capacity/(1+level_num));
         uint64_t s_idx = S_IDX(s_hash, level->addr_capacity/(1+level_num));
         
@@ -494,26 +2182,17 @@ uint8_t try_movement(level_hash *level, uint64_t idx, uint64_t level_num, uint8_
         else
             jdx = f_idx;
 
-        for(j = 0; j < ASSOC_NUM; j ++){
-            if (level->buckets[level_num][jdx].token[j] == 0)
-            {
-                memcpy(level->buckets[level_num][jdx].slot[j].key, m_key, KEY_LEN);
-                memcpy(level->buckets[level_num][jdx].slot[j].value, m_value, VALUE_LEN);
-                level->buckets[level_num][jdx].token[j] = 1;
-                level->buckets[level_num][idx].token[i] = 0;
-                // The movement is finished and then the new item is inserted
-
-                memcpy(level->buckets[level_num][idx].slot[i].key, key, KEY_LEN);
-                memcpy(level->buckets[level_num][idx].slot[i].value, value, VALUE_LEN);
-                level->buckets[level_num][idx].token[i] = 1;
-                level->level_item_num[level_num] ++;
-                
-                return 0;
-            }
-        }       
+        int j = level_empty_slot(&level->buckets[level_num][jdx]);
+        if (j != -1)
+        {
+            level_slot_move(&level->buckets[level_num][jdx], j, &level->buckets[level_num][idx], i);
+            level_hint_shift(level, level_num, jdx, j, idx);
+            // The movement is finished and then the new item can be inserted into the i-th slot
+            return i;
+        }
     }
     
-    return 1;
+    return -1;
 }
 
 /*
@@ -522,53 +2201,346 @@ Function: b2t_movement()
 */
 int b2t_movement(level_hash *level, uint64_t idx)
 {
-    uint8_t *key, *value;
     uint64_t s_hash, f_hash;
     uint64_t s_idx, f_idx;
     
-    uint64_t i, j;
+    uint64_t i;
     for(i = 0; i < ASSOC_NUM; i ++){
-        key = level->buckets[1][idx].slot[i].key;
-        value = level->buckets[1][idx].slot[i].value;
-        f_hash = F_HASH(level, key);
-        s_hash = S_HASH(level, key);  
+        level_slot_hash(level, &level->buckets[1][idx], i, &f_hash, &s_hash);
         f_idx = F_IDX(f_hash, level->addr_capacity);
         s_idx = S_IDX(s_hash, level->addr_capacity);
     
-        for(j = 0; j < ASSOC_NUM; j ++){
-            if (level->buckets[0][f_idx].token[j] == 0)
-            {
-                memcpy(level->buckets[0][f_idx].slot[j].key, key, KEY_LEN);
-                memcpy(level->buckets[0][f_idx].slot[j].value, value, VALUE_LEN);
-                level->buckets[0][f_idx].token[j] = 1;
-                level->buckets[1][idx].token[i] = 0;
-                level->level_item_num[0] ++;
-                level->level_item_num[1] --;
-                return i;
-            }
-            else if (level->buckets[0][s_idx].token[j] == 0)
-            {
-                memcpy(level->buckets[0][s_idx].slot[j].key, key, KEY_LEN);
-                memcpy(level->buckets[0][s_idx].slot[j].value, value, VALUE_LEN);
-                level->buckets[0][s_idx].token[j] = 1;
-                level->buckets[1][idx].token[i] = 0;
-                level->level_item_num[0] ++;
-                level->level_item_num[1] --;
-                return i;
-            }
+        level_bucket *bucket;
+        int j = level_pick_slot(&bucket, &level->buckets[0][f_idx], &level->buckets[0][s_idx]);
+        if (j != -1)
+        {
+            level_slot_move(bucket, j, &level->buckets[1][idx], i);
+            level_hint_remove(level, idx, f_hash, bucket->fp[j]);
+            level->level_item_num[0] ++;
+            level->level_item_num[1] --;
+            return i;
         }
     }
 
     return -1;
 }
 
+/*
+Function: level_bucket_occupancy() 
+        Count the buckets of a level by the number of items they hold
+*/
+static void level_bucket_occupancy(level_bucket *buckets, uint64_t bucket_num, uint64_t *occupancy)
+{
+    uint64_t idx, i;
+    for (idx = 0; idx < bucket_num; idx ++) {
+        uint64_t items = 0;
+        for(i = 0; i < ASSOC_NUM; i ++)
+            items += GET_TOKEN(buckets[idx].token, i) != 0;
+        occupancy[items] ++;
+    }
+}
+
+/*
+Function: level_get_stats() 
+        Fill in the statistics of a level hash table; Only the counters and sizes are read, unless scan is set, 
+        in which case all buckets are scanned for the occupancy histogram as well
+*/
+void level_get_stats(level_hash *level, level_stats *stats, uint8_t scan)
+{
+    *stats = level->stats;
+    stats->level_item_num[0] = level->level_item_num[0];
+    stats->level_item_num[1] = level->level_item_num[1];
+    stats->level_slot_num[0] = level->addr_capacity * ASSOC_NUM;
+    stats->level_slot_num[1] = level->addr_capacity / 2 * ASSOC_NUM;
+    stats->interim_item_num = level->resize_state ? level->interim_item_num : 0;
+    stats->bucket_bytes = (level->total_capacity + level->interim_bucket_num) * sizeof(level_bucket);
+    stats->lock_bytes = 0;
+    stats->log_bytes = 0;
+    stats->value_bytes = 0;
+#ifdef LEVEL_STABLE_VALUE
+    uint64_t c;
+    for (c = 0; c < level->values.chunk_num; c ++)
+        stats->value_bytes += level->values.chunks[c].cell_num * VALUE_LEN;
+#endif
+
+    memset(stats->occupancy, 0, sizeof(stats->occupancy));
+    if (scan)
+    {
+        level_bucket_occupancy(level->buckets[0], level->addr_capacity, stats->occupancy);
+        level_bucket_occupancy(level->buckets[1], level->addr_capacity / 2, stats->occupancy);
+        if (level->resize_state)
+            level_bucket_occupancy(level->interim_level_buckets, level->interim_bucket_num, stats->occupancy);
+    }
+}
+
+/*
+Function: level_snapshot_layout() 
+        Describe the buckets, the key and value lengths and the hashing of this build, which a snapshot file 
+        must have been saved with
+*/
+static uint64_t level_snapshot_layout(void)
+{
+    uint64_t options = 0;
+#ifdef LEVEL_HASH_CACHE
+    options |= 1;
+#endif
+#ifdef LEVEL_INTEGER_KEY
+    options |= 2;
+#endif
+#ifdef LEVEL_ALIGNED_BUCKET
+    options |= 4;
+#endif
+#ifdef LEVEL_BOTTOM_HINT
+    options |= 8;
+#endif
+#ifdef LEVEL_BINARY_KEY
+    options |= 16;
+#endif
+#ifdef LEVEL_INTEGER_KEY
+    uint64_t key_len = sizeof(level_key_t), value_len = sizeof(level_value_t);
+#else
+    uint64_t key_len = KEY_LEN, value_len = VALUE_LEN;
+#endif
+    return (sizeof(level_bucket) & 0xffffff) | (uint64_t)ASSOC_NUM << 24 | (key_len & 0xfff) << 32 
+        | (value_len & 0xfff) << 44 | options << 56;
+}
+
+static inline uint64_t level_snapshot_pages(uint64_t size, uint64_t page_size)
+{
+    return (size + page_size - 1) & ~(page_size - 1);
+}
+
+#ifndef LEVEL_STABLE_VALUE
+/*
+Function: level_snapshot_write() 
+        Write a block to a snapshot file and pad it to whole pages; Return 1 if the write fails
+*/
+static uint8_t level_snapshot_write(FILE *file, const void *block, uint64_t size, uint64_t page_size)
+{
+    static const uint8_t zero[512];
+    uint64_t padding = level_snapshot_pages(size, page_size) - size, n;
+    if (size && fwrite(block, size, 1, file) != 1)
+        return 1;
+    for (; padding; padding -= n)
+    {
+        n = padding < sizeof(zero) ? padding : sizeof(zero);
+        if (fwrite(zero, n, 1, file) != 1)
+            return 1;
+    }
+    return 0;
+}
+#endif
+
+/*
+Function: level_save() 
+        Save a level hash table to a snapshot file, which level_open_snapshot() maps back without rehashing;
+        The file is written next to path and renamed over it once complete, so that a table opened from an 
+        older snapshot at path keeps its mapping; A resizing in progress is finished first;
+        Return 0 if the snapshot is saved, 1 otherwise
+*/
+uint8_t level_save(level_hash *level, const char *path)
+{
+#ifdef LEVEL_STABLE_VALUE
+    printf("The snapshot saving fails: 1\n");    // The slots only hold pointers to the value cells
+    return 1;
+#else
+    if (level->resize_state)
+        level_migrate(level, level->interim_bucket_num);
+
+    level_snapshot_header header;
+    memset(&header, 0, sizeof(level_snapshot_header));
+    header.magic = LEVEL_SNAPSHOT_MAGIC;
+    header.layout = level_snapshot_layout();
+    header.f_seed = level->f_seed;
+    header.s_seed = level->s_seed;
+    header.level_size = level->level_size;
+    header.level_item_num[0] = level->level_item_num[0];
+    header.level_item_num[1] = level->level_item_num[1];
+    header.level_expand_time = level->level_expand_time;
+    header.min_level_size = level->min_level_size;
+    uint64_t size[2] = {level->addr_capacity * sizeof(level_bucket), level->addr_capacity / 2 * sizeof(level_bucket)};
+    header.page_size = sysconf(_SC_PAGESIZE);
+    header.level_offset[0] = header.page_size;
+    header.level_offset[1] = header.level_offset[0] + level_snapshot_pages(size[0], header.page_size);
+    header.hash_backend = level->hash_backend;
+
+    char *tmp_path = malloc(strlen(path) + 5);
+    if (!tmp_path)
+    {
+        printf("The snapshot saving fails: 2\n");
+        return 1;
+    }
+    sprintf(tmp_path, "%s.tmp", path);
+    FILE *file = fopen(tmp_path, "wb");
+    if (!file)
+    {
+        printf("The snapshot saving fails: 3\n");
+        free(tmp_path);
+        return 1;
+    }
+
+    uint8_t failed = level_snapshot_write(file, &header, sizeof(level_snapshot_header), header.page_size)
+        || level_snapshot_write(file, level->buckets[0], size[0], header.page_size)
+        || level_snapshot_write(file, level->buckets[1], size[1], header.page_size)
+        || fflush(file) || fsync(fileno(file));
+    failed |= fclose(file) != 0;
+    if (failed || rename(tmp_path, path))
+    {
+        printf("The snapshot saving fails: 4\n");
+        unlink(tmp_path);
+        free(tmp_path);
+        return 1;
+    }
+    free(tmp_path);
+    return 0;
+#endif
+}
+
+/*
+Function: level_open_snapshot() 
+        Open a level hash table saved by level_save(); The levels are mapped from the file copy-on-write, 
+        so lookups are served right away from the page cache, while mutations copy the pages they touch 
+        and never reach the file; Return NULL if the file is not a snapshot of this build
+*/
+level_hash *level_open_snapshot(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        printf("The snapshot opening fails: 1\n");
+        return NULL;
+    }
+
+    level_snapshot_header header;
+    struct stat st;
+    if (pread(fd, &header, sizeof(level_snapshot_header), 0) != sizeof(level_snapshot_header) || fstat(fd, &st)
+        || header.magic != LEVEL_SNAPSHOT_MAGIC || header.layout != level_snapshot_layout()
+        || header.level_size < 2 || header.level_size > 62 || header.hash_backend > 255 || !level_hash_supported(header.hash_backend))
+    {
+        printf("The snapshot opening fails: 2\n");
+        close(fd);
+        return NULL;
+    }
+    uint64_t size[2] = {(1ULL << header.level_size) * sizeof(level_bucket), (1ULL << (header.level_size - 1)) * sizeof(level_bucket)};
+    // The levels are mapped at their offsets and unmapped by themselves, so they lie on pages of this machine
+    uint64_t page_size = sysconf(_SC_PAGESIZE);
+    if (!header.page_size || header.page_size & (header.page_size - 1) || header.page_size % page_size
+        || header.level_offset[0] != header.page_size 
+        || header.level_offset[1] != header.level_offset[0] + level_snapshot_pages(size[0], header.page_size)
+        || (uint64_t)st.st_size < header.level_offset[1] + level_snapshot_pages(size[1], header.page_size))
+    {
+        printf("The snapshot opening fails: 3\n");
+        close(fd);
+        return NULL;
+    }
+
+    uint64_t map_size = header.level_offset[1] + level_snapshot_pages(size[1], header.page_size);
+    uint8_t *map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        printf("The snapshot opening fails: 4\n");
+        return NULL;
+    }
+    // The header page is not needed any more, and each level is unmapped by itself once it is freed
+    munmap(map, header.page_size);
+    madvise(map + header.page_size, map_size - header.page_size, MADV_WILLNEED);
+
+    level_hash *level = alignedmalloc(sizeof(level_hash));
+    if (!level)
+    {
+        printf("The snapshot opening fails: 5\n");
+        exit(1);
+    }
+    // The default allocator frees a level with munmap() of whole base pages, which also unmaps a level of the file
+    memset(&level->alloc_policy, 0, sizeof(level_alloc_policy));
+    level_allocator_policy(&level->allocator, &level->alloc_policy);
+    level_init_state(level, header.level_size);
+    level->buckets[0] = (level_bucket*)(map + header.level_offset[0]);
+    level->buckets[1] = (level_bucket*)(map + header.level_offset[1]);
+    level->f_seed = header.f_seed;
+    level->s_seed = header.s_seed;
+    level->level_item_num[0] = header.level_item_num[0];
+    level->level_item_num[1] = header.level_item_num[1];
+    level->level_expand_time = header.level_expand_time;
+    level->min_level_size = header.min_level_size;
+    level->hash_backend = header.hash_backend;
+    return level;
+}
+
+/*
+Function: level_iter_begin() 
+        Begin a scan over all items: the top level, the bottom level and, during an incremental resizing, 
+        the interim level are walked bucket by bucket; The values may be updated during the scan, but 
+        an insertion or deletion may move items and invalidates the scan
+*/
+void level_iter_begin(level_hash *level, level_iter *iter)
+{
+    iter->level = level;
+    iter->level_num = 0;
+    iter->bucket = 0;
+    iter->slot = 0;
+}
+
+/*
+Function: level_iter_next() 
+        Get the next item of a scan, return 0 if there is one and 1 if the scan is finished;
+        The key and value point into the slot of the item
+*/
+uint8_t level_iter_next(level_iter *iter, level_key_t *key, level_value_ref_t *value)
+{
+    level_hash *level = iter->level;
+
+    for (; iter->level_num < 3; iter->level_num ++, iter->bucket = 0) {
+        level_bucket *buckets;
+        uint64_t bucket_num;
+        if (iter->level_num < 2)
+        {
+            buckets = level->buckets[iter->level_num];
+            bucket_num = iter->level_num == 0 ? level->addr_capacity : level->addr_capacity / 2;
+        }else
+        {
+            if (!level->resize_state)
+                break;
+            buckets = level->interim_level_buckets;
+            bucket_num = level->interim_bucket_num;
+        }
+
+        for (; iter->bucket < bucket_num; iter->bucket ++, iter->slot = 0) {
+            level_bucket *bucket = &buckets[iter->bucket];
+            if (iter->slot == 0 && iter->bucket + LEVEL_ITER_PREFETCH < bucket_num)
+                __builtin_prefetch(&buckets[iter->bucket + LEVEL_ITER_PREFETCH]);
+
+            for (; iter->slot < ASSOC_NUM; iter->slot ++) {
+                if (GET_TOKEN(bucket->token, iter->slot))
+                {
+                    *key = bucket->slot[iter->slot].key;
+                    *value = VALUE_REF(bucket->slot[iter->slot]);
+                    iter->slot ++;
+                    return 0;
+                }
+            }
+        }
+    }
+
+    return 1;
+}
+
 /*
 Function: level_destroy() 
         Destroy a level hash table
 */
 void level_destroy(level_hash *level)
 {
-    numa_free(level->buckets[0],pow(2,level->level_size)*sizeof(level_bucket));
-    numa_free(level->buckets[1],pow(2,level->level_size-1)*sizeof(level_bucket));
+    level_block_free(level, level->buckets[0],pow(2,level->level_size)*sizeof(level_bucket));
+    level_block_free(level, level->buckets[1],pow(2,level->level_size-1)*sizeof(level_bucket));
+    if (level->interim_level_buckets)
+        level_block_free(level, level->interim_level_buckets, level->interim_bucket_num*sizeof(level_bucket));
+#ifdef LEVEL_STABLE_VALUE
+    uint64_t c;
+    for (c = 0; c < level->values.chunk_num; c ++)
+        level_block_free(level, level->values.chunks[c].cells, level->values.chunks[c].cell_num * VALUE_LEN);
+    free(level->values.chunks);
+#endif
     level = NULL;
 }
\ No newline at end of file
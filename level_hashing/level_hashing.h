@@ -5,25 +5,180 @@
 #include <time.h>
 #include <ctype.h>
 #include <math.h>
+#include <pthread.h>
 #include "hash.h"
+#include "level_alloc.h"
 
-#define ASSOC_NUM 4                       // The number of slots in a bucket
+#ifdef LEVEL_INTEGER_KEY
+#define ASSOC_NUM 8                       // The number of slots in a bucket, should be no more than 8
+#else
+#define ASSOC_NUM 4                       // The number of slots in a bucket, should be no more than 8
 #define KEY_LEN 16                        // The maximum length of a key
 #define VALUE_LEN 16                      // The maximum length of a value
+#endif
+#ifdef LEVEL_BINARY_KEY
+#ifdef LEVEL_INTEGER_KEY
+#error "LEVEL_BINARY_KEY is for KEY_LEN-byte keys; integer keys are compared with one instruction already"
+#endif
+#if KEY_LEN != 16
+#error "LEVEL_BINARY_KEY compares a key with one 16-byte load"
+#endif
+#endif
+#ifdef LEVEL_STABLE_VALUE
+#ifdef LEVEL_INTEGER_KEY
+#error "LEVEL_STABLE_VALUE keeps string values out of the slots; integer values are copied out with one load"
+#endif
+#define LEVEL_VALUE_CHUNK 65536           // The number of value cells allocated at once
+#endif
+#define LEVEL_BATCH_SIZE 32               // The number of keys whose buckets are prefetched together in level_query_batch()
+#define LEVEL_MIGRATE_STEP 4              // The number of interim buckets migrated by each insertion or deletion during an incremental resizing
+#define LEVEL_EXPAND_LOAD_FACTOR 0.85     // By default, auto-resizing expands the hash table when its load factor rises above this
+#define LEVEL_SHRINK_LOAD_FACTOR 0.1      // and shrinks it when the load factor falls below this
+#define LEVEL_BULK_PARTITION 1024         // The number of top-level buckets filled by one partition in level_bulk_load()
+#define LEVEL_ITER_PREFETCH 8             // The number of buckets a scan prefetches ahead of its cursor
+#define LEVEL_DISPLACE_NODES 256          // The most buckets an insertion visits when it searches for a path of movements
+#define LEVEL_STATS_PROBE_NUM 7           // Lookups probe up to 6 buckets: two in each level and two in the interim level
+#define LEVEL_SNAPSHOT_MAGIC 0x50414e534c56454cULL    // "LEVLSNAP", the first bytes of a snapshot file
+#define LEVEL_HASH_XXH 0                  // Hash backends: the xxHash64-style function of hash(), for string keys of any length,
+#define LEVEL_HASH_WY 1                   // wyhash, which mixes keys of up to 16 bytes with two multiplies,
+#define LEVEL_HASH_CRC16 2                // and a CRC32C kernel reading the key as one 16-byte block, which needs SSE4.2
+#define LEVEL_HASH_NUM 3
+#define LEVEL_HASH_COST_KEYS 65536        // The number of keys hashed by level_hash_cost() to measure a backend
+#define LEVEL_KEY_EXISTS 2                // Returned by level_upsert() and level_insert_if_absent() when the key is already stored
+
+/*  Compile-time options, enabled with -D in CFLAGS:
+    LEVEL_HASH_CACHE        Keep the low 32 bits of both hash values in each slot, so that movements, expansion
+                            and shrinking find the alternative buckets of an item without rehashing its key
+    LEVEL_INTEGER_KEY       Use uint64_t keys and values instead of strings; keys are hashed with an integer mixer
+                            and compared with one instruction, and the 8 slots of a bucket take 128 bytes
+    LEVEL_ALIGNED_BUCKET    Align each bucket to cache lines; the occupancy bitmap and fingerprints (and the cached
+                            hash values) fill a header line and the slots start at the next line
+    LEVEL_INCREMENTAL_RESIZE  Spread the rehashing of an expanding or shrinking over the following insertions and
+                            deletions, which migrate LEVEL_MIGRATE_STEP buckets of the interim level each
+    LEVEL_BOTTOM_HINT       Keep in each top-level bucket a counting filter of the bottom-level items whose first
+                            top-level bucket it is, so that most lookups of absent keys skip the bottom level;
+                            A counter that reaches 255 is recounted by a scan of the bottom level whenever one of
+                            its items leaves, so the counters stay exact
+    LEVEL_STATS             Count the buckets probed by each lookup and the movements tried by insertions for
+                            level_get_stats(); The other statistics are always kept
+    LEVEL_BINARY_KEY        Treat each string key as exactly KEY_LEN bytes, which may include 0x00: keys are hashed over
+                            all KEY_LEN bytes and compared with one 16-byte SSE2 compare instead of strcmp()
+    LEVEL_HASH_BACKEND      Set to one of LEVEL_HASH_* to fix the hash backend at compile time, so that it is inlined into
+                            FS_HASH() instead of being dispatched on the backend chosen by level_set_hash()
+    LEVEL_STABLE_VALUE      Keep the values in cells of a value arena, which never move, and only a pointer to the cell
+                            in each slot; The references returned by the queries stay valid until the key is deleted
+*/
+#ifdef LEVEL_HASH_CACHE
+#define LEVEL_HASH_CACHE_MAX_SIZE 33      // The largest level_size whose bucket locations can be computed from 32-bit hash values
+#endif
+
+#ifdef LEVEL_INTEGER_KEY
+typedef uint64_t level_key_t;             // The type of the keys passed to the level hash table
+typedef uint64_t level_value_t;           // The type of the values passed to the level hash table
+typedef uint64_t* level_value_ref_t;      // The type of the queried values, referring to the value in a slot
+
+typedef struct entry{                     // A slot storing a key-value item 
+    uint64_t key;
+    uint64_t value;
+} entry;
+#else
+typedef uint8_t* level_key_t;
+typedef uint8_t* level_value_t;
+typedef uint8_t* level_value_ref_t;
 
 typedef struct entry{                     // A slot storing a key-value item 
     uint8_t key[KEY_LEN];
+#ifdef LEVEL_STABLE_VALUE
+    uint8_t *value;                       // The cell of the value arena holding the value
+#else
     uint8_t value[VALUE_LEN];
+#endif
 } entry;
+#endif
 
+#ifdef LEVEL_STABLE_VALUE
+typedef struct level_value_chunk{         // A block of VALUE_LEN-byte value cells
+    uint8_t *cells;
+    uint64_t cell_num;
+} level_value_chunk;
+
+typedef struct level_value_arena{         // The value cells of a level hash table with LEVEL_STABLE_VALUE
+    level_value_chunk *chunks;            // The chunks are only freed with the hash table, so a cell never moves
+    uint64_t chunk_num;
+    uint64_t chunk_slots;                 // The length of the chunks array
+    uint64_t used;                        // The number of cells handed out from the last chunk
+    uint8_t *free_cells;                  // The cells of deleted items, linked through their first bytes
+} level_value_arena;
+#endif
+
+#ifdef LEVEL_ALIGNED_BUCKET
+#define CACHE_LINE_SIZE 64
+
+typedef struct level_bucket               // A bucket aligned to cache lines
+{
+    uint32_t token;                       // Each bit in the last ASSOC_NUM bits indicates whether its corresponding slot is occupied
+    uint8_t fp[ASSOC_NUM];                // A one-byte fingerprint of the key in each slot
+#ifdef LEVEL_BOTTOM_HINT
+    uint64_t hint;                        // Only used in the top level: eight 8-bit counters of the bottom-level items
+                                          // whose first top-level bucket this is, indexed by the low 3 bits of their fingerprints
+#endif
+#ifdef LEVEL_HASH_CACHE
+    uint32_t f_hash[ASSOC_NUM];           // The low 32 bits of the two hash values of the key in each slot
+    uint32_t s_hash[ASSOC_NUM];
+#endif
+    entry slot[ASSOC_NUM] __attribute__((aligned(CACHE_LINE_SIZE)));    // The slots start at a new cache line behind the header
+} __attribute__((aligned(CACHE_LINE_SIZE))) level_bucket;
+
+#define GET_TOKEN(token, n) (((token) >> (n)) & 1)
+#define SET_TOKEN(token, n, bit) ((bit) ? ((token) |= (1U << (n))) : ((token) &= ~(1U << (n))))
+#else
 typedef struct level_bucket               // A bucket
 {
     uint8_t token[ASSOC_NUM];             // A token indicates whether its corresponding slot is empty, which can also be implemented using 1 bit
+    uint8_t fp[ASSOC_NUM];                // A one-byte fingerprint of the key in each slot, kept right behind the tokens so that both are matched with one SIMD load
+#ifdef LEVEL_BOTTOM_HINT
+    uint64_t hint;                        // Only used in the top level: eight 8-bit counters of the bottom-level items
+                                          // whose first top-level bucket this is, indexed by the low 3 bits of their fingerprints
+#endif
+#ifdef LEVEL_HASH_CACHE
+    uint32_t f_hash[ASSOC_NUM];           // The low 32 bits of the two hash values of the key in each slot
+    uint32_t s_hash[ASSOC_NUM];
+#endif
     entry slot[ASSOC_NUM];
 } level_bucket;
 
+#define GET_TOKEN(token, n) ((token)[n])
+#define SET_TOKEN(token, n, bit) ((token)[n] = (bit))
+#endif
+
+typedef struct level_stats{               // The statistics of a level hash table, filled by level_get_stats()
+    uint64_t level_item_num[2];           // The numbers of items in the top and bottom levels
+    uint64_t level_slot_num[2];           // The numbers of slots in the top and bottom levels
+    uint64_t interim_item_num;            // The number of items not migrated yet during a resizing
+    uint64_t occupancy[ASSOC_NUM + 1];    // occupancy[k]: the number of buckets holding k items, only filled by a bucket scan
+    uint64_t hit_probes[LEVEL_STATS_PROBE_NUM];   // hit_probes[k]: the lookups that found the key in the k-th bucket probed
+    uint64_t miss_probes[LEVEL_STATS_PROBE_NUM];  // miss_probes[k]: the lookups that missed after probing k buckets
+    uint64_t movement_tries[2];           // The same-level and bottom-to-top movements tried by insertions
+    uint64_t movement_successes[2];       // and how many of them made room for the new item
+    uint64_t expand_num;
+    uint64_t shrink_num;
+    uint64_t expand_ns;                   // The time spent in expanding and shrinking calls
+    uint64_t shrink_ns;
+    uint64_t bucket_bytes;                // The memory allocated for buckets, locks, logs and value cells
+    uint64_t lock_bytes;
+    uint64_t log_bytes;
+    uint64_t value_bytes;
+} level_stats;
+
 typedef struct level_hash {               // A Level hash table
     level_bucket *buckets[2];             // The top level and bottom level in the Level hash table
+    level_bucket *interim_level_buckets;  // Used during resizing: the old level whose items are being migrated into the two levels
+    uint64_t interim_bucket_num;          // The number of buckets in the interim level
+    uint64_t interim_item_num;            // The number of items not migrated yet
+    uint64_t migrate_cursor;              // The interim buckets before the cursor have been migrated
+#ifdef LEVEL_BOTTOM_HINT
+    uint64_t hint_cursor;                 // The bottom-level buckets before the cursor have their items counted in the hints
+#endif
     uint64_t level_item_num[2];           // The numbers of items stored in the top and bottom levels respectively
     uint64_t addr_capacity;               // The number of buckets in the top level
     uint64_t total_capacity;              // The number of all buckets in the Level hash table    
@@ -31,28 +186,98 @@ typedef struct level_hash {               // A Level hash table
     uint8_t level_expand_time;            // Indicate whether the Level hash table was expanded, ">1 or =1": Yes, "0": No;
     uint8_t resize_state;                 // Indicate the resizing state of the level hash table, ‘0’ means the hash table is not during resizing; 
                                           // ‘1’ means the hash table is being expanded; ‘2’ means the hash table is being shrunk.
+    level_alloc_policy alloc_policy;      // Where and how the buckets are allocated by the default allocator
+    level_allocator allocator;            // Allocates and frees the buckets and value cells
+    uint8_t auto_resize;                  // Indicate whether insertions and deletions expand and shrink the hash table by themselves,
+                                          // on by default and turned off by level_set_resize_policy()
+    double expand_load_factor;            // The load factors crossing which the hash table is expanded or shrunk
+    double shrink_load_factor;
+    uint64_t min_level_size;              // Auto-resizing never shrinks the hash table below this level_size
+    uint8_t displace_depth;               // The most same-level movements an insertion makes to free a slot, 1 by default
+    uint8_t hash_backend;                 // One of LEVEL_HASH_*, which computes the hash values of the string keys
+    level_stats stats;                    // The counters of the statistics, the rest is computed by level_get_stats()
+#ifdef LEVEL_STABLE_VALUE
+    level_value_arena values;             // The cells holding the values
+#endif
     uint64_t f_seed;
     uint64_t s_seed;                      // Two randomized seeds for hash functions
 } level_hash;
 
+typedef struct level_snapshot_header{     // The first page of a snapshot file, followed by the top and bottom levels as they are in memory
+    uint64_t magic;
+    uint64_t layout;                      // The bucket size, KEY_LEN, VALUE_LEN and the options changing the buckets or the hashing, which must match to open the file
+    uint64_t f_seed;
+    uint64_t s_seed;
+    uint64_t level_size;
+    uint64_t level_item_num[2];
+    uint64_t level_expand_time;
+    uint64_t min_level_size;
+    uint64_t level_offset[2];             // The file offsets of the top and bottom levels
+    uint64_t page_size;                   // The page size of the saving machine, to which the header and the levels are padded
+    uint64_t hash_backend;
+} level_snapshot_header;
+
+typedef struct level_iter{                // A cursor scanning all items of a level hash table
+    level_hash *level;
+    uint64_t level_num;                   // 0: the top level, 1: the bottom level, 2: the interim level during a resizing
+    uint64_t bucket;
+    uint64_t slot;                        // The next slot to visit
+} level_iter;
+
 level_hash *level_init(uint64_t level_size);     
 
-uint8_t level_insert(level_hash *level, uint8_t *key, uint8_t *value);          
+level_hash *level_init_policy(uint64_t level_size, const level_alloc_policy *policy);
+
+level_hash *level_init_ex(uint64_t level_size, const level_allocator *allocator);
+
+level_hash *level_init_for_items(uint64_t n);
 
-uint8_t* level_static_query(level_hash *level, uint8_t *key);
+uint8_t level_set_resize_policy(level_hash *level, uint8_t auto_resize, double expand_load_factor, double shrink_load_factor);
 
-uint8_t* level_dynamic_query(level_hash *level, uint8_t *key);
+void level_set_displace_depth(level_hash *level, uint8_t depth);
 
-uint8_t level_delete(level_hash *level, uint8_t*key);
+uint8_t level_set_hash(level_hash *level, uint8_t backend);
 
-uint8_t level_update(level_hash *level, uint8_t *key, uint8_t *new_value);
+double level_hash_cost(uint8_t backend, uint64_t key_len);
+
+uint8_t level_insert(level_hash *level, level_key_t key, level_value_t value);          
+
+uint8_t level_upsert(level_hash *level, level_key_t key, level_value_t value);
+
+uint8_t level_insert_if_absent(level_hash *level, level_key_t key, level_value_t value);
+
+level_value_ref_t level_static_query(level_hash *level, level_key_t key);
+
+level_value_ref_t level_dynamic_query(level_hash *level, level_key_t key);
+
+uint64_t level_query_batch(level_hash *level, level_key_t *keys, uint64_t n, level_value_ref_t *values);
+
+uint8_t level_delete(level_hash *level, level_key_t key);
+
+uint8_t level_update(level_hash *level, level_key_t key, level_value_t new_value);
 
 void level_expand(level_hash *level);
 
-void level_shrink(level_hash *level);
+void level_expand_parallel(level_hash *level, uint32_t thread_num);
 
-uint8_t try_movement(level_hash *level, uint64_t idx, uint64_t level_num, uint8_t *key, uint8_t *value);
+level_hash *level_bulk_load(level_key_t *keys, level_value_t *values, uint64_t n, uint32_t thread_num);
+
+void level_reserve(level_hash *level, uint64_t n);
+
+uint8_t level_shrink(level_hash *level);
+
+int try_movement(level_hash *level, uint64_t idx, uint64_t level_num);
 
 int b2t_movement(level_hash *level, uint64_t idx);
 
+void level_get_stats(level_hash *level, level_stats *stats, uint8_t scan);
+
+uint8_t level_save(level_hash *level, const char *path);
+
+level_hash *level_open_snapshot(const char *path);
+
+void level_iter_begin(level_hash *level, level_iter *iter);
+
+uint8_t level_iter_next(level_iter *iter, level_key_t *key, level_value_ref_t *value);
+
 void level_destroy(level_hash *level);
\ No newline at end of file
@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <string.h>
+#include "level_hashing.h"
+/*  Test:
+    Check that auto-resizing, which is on by default, grows a small hash table as items are inserted and shrinks it
+    back as they are deleted, and that level_insert() reports a full table once it is turned off
+*/
+#define RESIZE_TEST_LEVEL_SIZE 4          // The initial hash table holds 2^4 + 2^3 buckets
+#define RESIZE_TEST_ITEMS 100000          // Far more items than fit in the initial hash table
+
+#ifndef LEVEL_INTEGER_KEY
+static uint8_t resize_test_key[KEY_LEN];
+#endif
+
+/*
+Function: resize_test_make_key()
+        Return the key of the i-th item, which is also its value
+*/
+static level_key_t resize_test_make_key(uint64_t i)
+{
+#ifdef LEVEL_INTEGER_KEY
+    return i + 1;
+#else
+    memset(resize_test_key, 0, KEY_LEN);
+    snprintf((char *)resize_test_key, KEY_LEN, "%lu", i);
+    return resize_test_key;
+#endif
+}
+
+static double resize_test_load_factor(level_hash *level)
+{
+    return (double)(level->level_item_num[0] + level->level_item_num[1]) / (level->total_capacity * ASSOC_NUM);
+}
+
+int main()
+{
+    level_hash *level = level_init(RESIZE_TEST_LEVEL_SIZE);
+    level_stats stats;
+    uint64_t i;
+
+    for (i = 0; i < RESIZE_TEST_ITEMS; i++)
+    {
+        if (level_insert(level, resize_test_make_key(i), resize_test_make_key(i)))
+        {
+            printf("RESIZE FAIL: item %lu is not inserted at level_size %lu\n", i, level->level_size);
+            return 1;
+        }
+    }
+    level_get_stats(level, &stats, 0);
+    if (level->level_size <= RESIZE_TEST_LEVEL_SIZE || stats.expand_num == 0
+        || resize_test_load_factor(level) > LEVEL_EXPAND_LOAD_FACTOR)
+    {
+        printf("RESIZE FAIL: level_size %lu after %lu expandings\n", level->level_size, stats.expand_num);
+        return 1;
+    }
+    for (i = 0; i < RESIZE_TEST_ITEMS; i++)
+    {
+        if (level_static_query(level, resize_test_make_key(i)) == NULL)
+        {
+            printf("RESIZE FAIL: item %lu is lost by the expandings\n", i);
+            return 1;
+        }
+    }
+
+    for (i = 0; i < RESIZE_TEST_ITEMS; i++)
+    {
+        if (level_delete(level, resize_test_make_key(i)))
+        {
+            printf("RESIZE FAIL: item %lu is not deleted\n", i);
+            return 1;
+        }
+    }
+    level_get_stats(level, &stats, 0);
+    if (stats.shrink_num == 0 || level->level_size >= 8)
+    {
+        printf("RESIZE FAIL: level_size %lu after %lu shrinkings\n", level->level_size, stats.shrink_num);
+        return 1;
+    }
+    level_destroy(level);
+
+    // Without auto-resizing, the insertions fail once the initial hash table is full
+    level = level_init(RESIZE_TEST_LEVEL_SIZE);
+    level_set_resize_policy(level, 0, LEVEL_EXPAND_LOAD_FACTOR, LEVEL_SHRINK_LOAD_FACTOR);
+    for (i = 0; i < RESIZE_TEST_ITEMS; i++)
+    {
+        if (level_insert(level, resize_test_make_key(i), resize_test_make_key(i)))
+            break;
+    }
+    if (i == RESIZE_TEST_ITEMS || level->level_size != RESIZE_TEST_LEVEL_SIZE)
+    {
+        printf("RESIZE FAIL: %lu items inserted at level_size %lu without auto-resizing\n", i, level->level_size);
+        return 1;
+    }
+    level_destroy(level);
+
+    printf("RESIZE OK\n");
+    return 0;
+}
@@ -7,14 +7,21 @@ int main(int argc, char* argv[])
 {
     int level_size = atoi(argv[1]);                     // INPUT: the number of addressable buckets is 2^level_size
     int insert_num = atoi(argv[2]);                     // INPUT: the number of items to be inserted
+    int expand_threads = argc > 3 ? atoi(argv[3]) : 1;  // INPUT (optional): the number of threads rehashing items in an expanding
     
-    clock_t start_time,end_time;
+    struct timespec start_time, end_time;       // Wall-clock time, so that waiting and parallel expanding are counted
     double time_taken;
     double ops;   
 
     printf("Pre alloc memory:\n");
     //pre-allocate and format key and value arrays
-    uint8_t **keysOrValues = (uint8_t**)malloc((insert_num + 1 )* sizeof(uint8_t *));
+    level_key_t *keysOrValues = (level_key_t*)malloc((insert_num + 1 )* sizeof(level_key_t));
+#ifdef LEVEL_INTEGER_KEY
+    printf("Alloc memory done\n");
+    for (int i = 1; i < insert_num + 1; i++) {
+        keysOrValues[i] = i + 1;
+    }
+#else
     for (int i = 0; i < insert_num + 1; i++) {
         keysOrValues[i] = (uint8_t *)malloc(KEY_LEN * sizeof(uint8_t));
     }
@@ -23,11 +30,14 @@ int main(int argc, char* argv[])
     for (int i = 1; i < insert_num + 1; i++) {
         snprintf(keysOrValues[i], KEY_LEN, "%d", i + 1);
     }
+#endif
 
     level_hash *level = level_init(level_size);
     uint64_t inserted = 0, i = 0;
+    // Auto-resizing expands the table inside level_insert(), so it is turned off to time the expandings made below
+    level_set_resize_policy(level, 0, LEVEL_EXPAND_LOAD_FACTOR, LEVEL_SHRINK_LOAD_FACTOR);
 
-    start_time = clock();
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
     for (i = 1; i < insert_num + 1; i ++)
     {
         if (!level_insert(level, keysOrValues[i], keysOrValues[i]))                               
@@ -38,44 +48,47 @@ int main(int argc, char* argv[])
             // printf("Expanding: space utilization & total entries: %f  %ld\n", \
             //     (float)(level->level_item_num[0]+level->level_item_num[1])/(level->total_capacity*ASSOC_NUM), \
             //     level->total_capacity*ASSOC_NUM);
-            level_expand(level);
+            if (expand_threads > 1)
+                level_expand_parallel(level, expand_threads);
+            else
+                level_expand(level);
             level_insert(level, keysOrValues[i], keysOrValues[i]);
             inserted ++;
         }
     }
-    end_time = clock();
-    time_taken = (double)(end_time - start_time) / CLOCKS_PER_SEC;
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    time_taken = (end_time.tv_sec - start_time.tv_sec) + (end_time.tv_nsec - start_time.tv_nsec) / 1e9;
     ops = (double)insert_num / time_taken; 
     printf("%ld items are inserted ! takes %f sec, OPS %f \n", inserted ,time_taken ,ops);
 
     printf("The static search test begins ...\n");
-    start_time = clock();
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
     for (i = 1; i < insert_num + 1; i ++)
     {
-        uint8_t* get_value = level_static_query(level, keysOrValues[i]);
+        level_value_ref_t get_value = level_static_query(level, keysOrValues[i]);
         // if(memcmp(get_value,keysOrValues[i],KEY_LEN) != 0)
         //     printf("Search the key %s: ERROR! \n", keysOrValues[i]);
     }
-    end_time = clock();
-    time_taken = (double)(end_time - start_time) / CLOCKS_PER_SEC;
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    time_taken = (end_time.tv_sec - start_time.tv_sec) + (end_time.tv_nsec - start_time.tv_nsec) / 1e9;
     ops = (double)insert_num / time_taken; 
     printf("%ld items are static searched ! takes %f sec, OPS %f \n", inserted ,time_taken ,ops);
 
     printf("The dynamic search test begins ...\n");
-    start_time = clock();
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
     for (i = 1; i < insert_num + 1; i ++)
     {
-        uint8_t* get_value = level_dynamic_query(level, keysOrValues[i]);
+        level_value_ref_t get_value = level_dynamic_query(level, keysOrValues[i]);
         // if(memcmp(get_value,keysOrValues[i],KEY_LEN) != 0)
         //     printf("Search the key %s: ERROR! \n", keysOrValues[i]);
     }
-    end_time = clock();
-    time_taken = (double)(end_time - start_time) / CLOCKS_PER_SEC;
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    time_taken = (end_time.tv_sec - start_time.tv_sec) + (end_time.tv_nsec - start_time.tv_nsec) / 1e9;
     ops = (double)insert_num / time_taken; 
     printf("%ld items are dynamic searched! takes %f sec, OPS %f \n", inserted ,time_taken ,ops);
 
     printf("The update test begins ...\n");
-    start_time = clock();
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
     for (i = 1; i < insert_num + 1; i ++)
     {
         if(level_update(level, keysOrValues[i], keysOrValues[i])){
@@ -83,13 +96,13 @@ int main(int argc, char* argv[])
             // printf("Update the value of the key %s: ERROR! \n", keysOrValues[i]);
         }
     }
-    end_time = clock();
-    time_taken = (double)(end_time - start_time) / CLOCKS_PER_SEC;
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    time_taken = (end_time.tv_sec - start_time.tv_sec) + (end_time.tv_nsec - start_time.tv_nsec) / 1e9;
     ops = (double)insert_num / time_taken; 
     printf("%ld items are updated ! takes %f sec, OPS %f \n", inserted ,time_taken ,ops);
 
     printf("The deletion test begins ...\n");
-    start_time = clock();
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
     for (i = 1; i < insert_num + 1; i ++)
     {
         if(level_delete(level, keysOrValues[i])){
@@ -97,8 +110,8 @@ int main(int argc, char* argv[])
             exit(0);
         }
     }
-    end_time = clock();
-    time_taken = (double)(end_time - start_time) / CLOCKS_PER_SEC;
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    time_taken = (end_time.tv_sec - start_time.tv_sec) + (end_time.tv_nsec - start_time.tv_nsec) / 1e9;
     ops = (double)insert_num / time_taken; 
     printf("%ld items are deleted ! takes %f sec, OPS %f \n", inserted ,time_taken ,ops);
 
@@ -106,9 +119,11 @@ int main(int argc, char* argv[])
     level_destroy(level);
 
     // Free allocated memory
+#ifndef LEVEL_INTEGER_KEY
     for (int i = 0; i < insert_num + 1; i++) {
         free(keysOrValues[i]);
     }
+#endif
     free(keysOrValues);
 
     return 0;
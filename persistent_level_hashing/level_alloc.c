@@ -0,0 +1,56 @@
+#include "level_alloc.h"
+#include "pflush.h"
+#include ".../quartz/src/lib/pmalloc.h"   // path to pmalloc.h in Quartz
+
+static void *level_pmalloc(void *ctx, uint64_t size, uint64_t alignment)
+{
+    return pmalloc(size);
+}
+
+static void level_pfree(void *ctx, void *addr, uint64_t size)
+{
+    pfree(addr, size);
+}
+
+/*
+Function: level_allocator_pmalloc() 
+        Fill an allocator that allocates with pmalloc() in the emulated NVM;
+        The blocks are used as they come, as the hash table has always done with pmalloc()
+*/
+void level_allocator_pmalloc(level_allocator *allocator)
+{
+    allocator->alloc = level_pmalloc;
+    allocator->free = level_pfree;
+    allocator->ctx = NULL;
+    allocator->alignment = 0;
+    allocator->zeroed = 1;
+}
+
+/*
+Function: level_block_alloc() 
+        Allocate a block aligned to cache lines with an allocator; Unless the allocator returns 
+        zeroed memory, the block is cleared and flushed before it is used
+*/
+void *level_block_alloc(const level_allocator *allocator, uint64_t size)
+{
+    uint64_t alignment = allocator->alignment > 64 ? allocator->alignment : 64;
+    uint8_t *addr = allocator->alloc(allocator->ctx, size, alignment);
+    if (addr && !allocator->zeroed)
+    {
+        memset(addr, 0, size);
+        uint64_t offset;
+        for (offset = 0; offset < size; offset += 64)
+            pflush((uint64_t *)(addr + offset));
+        asm_mfence();
+    }
+    return addr;
+}
+
+/*
+Function: level_block_free() 
+        Free a block allocated by level_block_alloc() with the same allocator and size
+*/
+void level_block_free(const level_allocator *allocator, void *addr, uint64_t size)
+{
+    allocator->free(allocator->ctx, addr, size);
+}
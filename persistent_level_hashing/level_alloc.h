@@ -0,0 +1,18 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct level_allocator{           // Allocates and frees the bucket arrays, the log and the hash table itself
+    void *(*alloc)(void *ctx, uint64_t size, uint64_t alignment);  // Return a block of size bytes aligned to alignment, or NULL
+    void (*free)(void *ctx, void *addr, uint64_t size);            // Take back a block with the size it was allocated with
+    void *ctx;                            // Passed to alloc and free, e.g., an arena or a pool of pre-faulted blocks
+    uint64_t alignment;                   // The alignment asked for each block, raised to the cache line size
+    uint8_t zeroed;                       // 1 if alloc returns zeroed memory, otherwise the hash table clears and flushes each block
+} level_allocator;
+
+void level_allocator_pmalloc(level_allocator *allocator);
+
+void *level_block_alloc(const level_allocator *allocator, uint64_t size);
+
+void level_block_free(const level_allocator *allocator, void *addr, uint64_t size);
@@ -1,11 +1,37 @@
 #include "level_hashing.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// The number of bytes a key is hashed over: all KEY_LEN bytes of a binary key, or the bytes before the terminator
+#ifdef LEVEL_BINARY_KEY
+#define LEVEL_KEY_LENGTH(key) KEY_LEN
+#else
+#define LEVEL_KEY_LENGTH(key) strlen((const char *)(key))
+#endif
+
+/*
+Function: level_key_equal() 
+        Compare two keys; A binary key is compared as one 16-byte block with a single SSE2 compare
+*/
+static inline int level_key_equal(const uint8_t *a, const uint8_t *b)
+{
+#if defined(LEVEL_BINARY_KEY) && defined(__SSE2__)
+    __m128i diff = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)a), _mm_loadu_si128((const __m128i *)b));
+    return _mm_movemask_epi8(diff) == 0xffff;
+#elif defined(LEVEL_BINARY_KEY)
+    return memcmp(a, b, KEY_LEN) == 0;
+#else
+    return strcmp((const char *)a, (const char *)b) == 0;
+#endif
+}
 
 /*
 Function: F_HASH()
         Compute the first hash value of a key-value item
 */
 uint64_t F_HASH(level_hash *level, const uint8_t *key) {
-    return (hash((void *)key, strlen(key), level->f_seed));
+    return (hash((void *)key, LEVEL_KEY_LENGTH(key), level->f_seed));
 }
 
 /*
@@ -13,7 +39,7 @@ Function: S_HASH()
         Compute the second hash value of a key-value item
 */
 uint64_t S_HASH(level_hash *level, const uint8_t *key) {
-    return (hash((void *)key, strlen(key), level->s_seed));
+    return (hash((void *)key, LEVEL_KEY_LENGTH(key), level->s_seed));
 }
 
 /*
@@ -87,30 +113,73 @@ static inline void level_slot_flush(level_bucket* bucket, uint64_t j)
     pflush((uint64_t *)&bucket->token);
 }
 
+// Count an event of a lookup or an insertion in the statistics
+#ifdef LEVEL_STATS
+#define LEVEL_STATS_ADD(level, counter) ((level)->stats.counter ++)
+#else
+#define LEVEL_STATS_ADD(level, counter)
+#endif
+
+/*
+Function: level_time_ns() 
+        Read the monotonic clock in nanoseconds, to time the resizings
+*/
+static inline uint64_t level_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 /*
 Function: level_init() 
         Initialize a level hash table
 */
 level_hash *level_init(uint64_t level_size)
 {
-    level_hash *level = pmalloc(sizeof(level_hash));
+    return level_init_ex(level_size, NULL);
+}
+
+/*
+Function: level_init_ex() 
+        Initialize a level hash table whose buckets, log and header are allocated and freed by a given allocator,
+        which also takes back the old levels after each resizing, e.g., to recycle them;
+        A NULL allocator means pmalloc()
+*/
+level_hash *level_init_ex(uint64_t level_size, const level_allocator *allocator)
+{
+    level_allocator default_allocator;
+    if (!allocator)
+    {
+        level_allocator_pmalloc(&default_allocator);
+        allocator = &default_allocator;
+    }
+    if (!allocator->alloc || !allocator->free)
+    {
+        printf("The level hash table initialization fails:3\n");
+        exit(1);
+    }
+
+    level_hash *level = level_block_alloc(allocator, sizeof(level_hash));
     if (!level)
     {
         printf("The level hash table initialization fails:1\n");
         exit(1);
     }
+    level->allocator = *allocator;
 
     level->level_size = level_size;
     level->addr_capacity = pow(2, level_size);
     level->total_capacity = pow(2, level_size) + pow(2, level_size - 1);
     generate_seeds(level);
-    level->buckets[0] = pmalloc(pow(2, level_size)*sizeof(level_bucket));
-    level->buckets[1] = pmalloc(pow(2, level_size - 1)*sizeof(level_bucket));
+    level->buckets[0] = level_block_alloc(&level->allocator, pow(2, level_size)*sizeof(level_bucket));
+    level->buckets[1] = level_block_alloc(&level->allocator, pow(2, level_size - 1)*sizeof(level_bucket));
     level->interim_level_buckets = NULL;
     level->level_item_num[0] = 0;
     level->level_item_num[1] = 0;
     level->level_expand_time = 0;
     level->resize_state = 0;
+    memset(&level->stats, 0, sizeof(level_stats));
 
     if (!level->buckets[0] || !level->buckets[1])
     {
@@ -118,7 +187,7 @@ level_hash *level_init(uint64_t level_size)
         exit(1);
     }
 
-    level->log = log_create(1024);
+    level->log = log_create(1024, &level->allocator);
 
     uint64_t *ptr = (uint64_t *)&level;
     for(; ptr < (uint64_t *)&level + sizeof(level_hash); ptr += 8)
@@ -145,11 +214,12 @@ void level_expand(level_hash *level)
         printf("The expanding fails: 1\n");
         exit(1);
     }
+    uint64_t begin = level_time_ns();
     level->resize_state = 1;
     pflush((uint64_t *)&level->resize_state);
 
     level->addr_capacity = pow(2, level->level_size + 1);
-    level->interim_level_buckets = pmalloc(level->addr_capacity*sizeof(level_bucket));
+    level->interim_level_buckets = level_block_alloc(&level->allocator, level->addr_capacity*sizeof(level_bucket));
     if (!level->interim_level_buckets) {
         printf("The expanding fails: 2\n");
         exit(1);
@@ -213,7 +283,7 @@ void level_expand(level_hash *level)
             }
         }
     }
-    pfree(level->buckets[1], pow(2, level->level_size -1)*sizeof(level_bucket));
+    level_block_free(&level->allocator, level->buckets[1], pow(2, level->level_size -1)*sizeof(level_bucket));
     level->level_size ++;
     level->total_capacity = pow(2, level->level_size) + pow(2, level->level_size - 1);
 
@@ -224,6 +294,7 @@ void level_expand(level_hash *level)
     level->level_item_num[1] = level->level_item_num[0];
     level->level_item_num[0] = new_level_item_num;
     level->level_expand_time ++;
+    level->stats.expand_num ++;
 
     uint64_t *ptr = (uint64_t *)&level;
     for(; ptr < (uint64_t *)&level + sizeof(level_hash); ptr += 8)
@@ -231,6 +302,7 @@ void level_expand(level_hash *level)
 
     level->resize_state = 0;
     pflush((uint64_t *)&level->resize_state);
+    level->stats.expand_ns += level_time_ns() - begin;
 }
 
 /*
@@ -253,11 +325,16 @@ void level_shrink(level_hash *level)
         exit(1);
     }
 
+    uint64_t begin = level_time_ns();
     level->resize_state = 2;
     pflush((uint64_t *)&level->resize_state);
 
     level->level_size --;
-    level_bucket *newBuckets = pmalloc(pow(2, level->level_size - 1)*sizeof(level_bucket));
+    level_bucket *newBuckets = level_block_alloc(&level->allocator, pow(2, level->level_size - 1)*sizeof(level_bucket));
+    if (!newBuckets) {
+        printf("The shrinking fails: 4\n");
+        exit(1);
+    }
     level->interim_level_buckets = level->buckets[0];
     level->buckets[0] = level->buckets[1];
     level->buckets[1] = newBuckets;
@@ -290,9 +367,11 @@ void level_shrink(level_hash *level)
         }
     } 
 
-    pfree(level->interim_level_buckets, pow(2, level->level_size + 1)*sizeof(level_bucket));
+    level_block_free(&level->allocator, level->interim_level_buckets, pow(2, level->level_size + 1)*sizeof(level_bucket));
     level->resize_state = 0;
     pflush((uint64_t *)&level->resize_state);
+    level->stats.shrink_num ++;
+    level->stats.shrink_ns += level_time_ns() - begin;
 }
 
 /*
@@ -312,14 +391,16 @@ uint8_t* level_dynamic_query(level_hash *level, uint8_t *key)
 
         for(i = 0; i < 2; i ++){
             for(j = 0; j < ASSOC_NUM; j ++){
-                if (GET_BIT(level->buckets[i][f_idx].token, j) != 0&&strcmp(level->buckets[i][f_idx].slot[j].key, key) == 0)
+                if (GET_BIT(level->buckets[i][f_idx].token, j) != 0&&level_key_equal(level->buckets[i][f_idx].slot[j].key, key))
                 {
+                    LEVEL_STATS_ADD(level, hit_probes[2 * i + 1]);
                     return level->buckets[i][f_idx].slot[j].value;
                 }
             }
             for(j = 0; j < ASSOC_NUM; j ++){
-                if (GET_BIT(level->buckets[i][s_idx].token, j) != 0&&strcmp(level->buckets[i][s_idx].slot[j].key, key) == 0)
+                if (GET_BIT(level->buckets[i][s_idx].token, j) != 0&&level_key_equal(level->buckets[i][s_idx].slot[j].key, key))
                 {
+                    LEVEL_STATS_ADD(level, hit_probes[2 * i + 2]);
                     return level->buckets[i][s_idx].slot[j].value;
                 }
             }
@@ -333,14 +414,16 @@ uint8_t* level_dynamic_query(level_hash *level, uint8_t *key)
 
         for(i = 2; i > 0; i --){
             for(j = 0; j < ASSOC_NUM; j ++){
-                if (GET_BIT(level->buckets[i-1][f_idx].token, j) != 0&&strcmp(level->buckets[i-1][f_idx].slot[j].key, key) == 0)
+                if (GET_BIT(level->buckets[i-1][f_idx].token, j) != 0&&level_key_equal(level->buckets[i-1][f_idx].slot[j].key, key))
                 {
+                    LEVEL_STATS_ADD(level, hit_probes[2 * (2 - i) + 1]);
                     return level->buckets[i-1][f_idx].slot[j].value;
                 }
             }
             for(j = 0; j < ASSOC_NUM; j ++){
-                if (GET_BIT(level->buckets[i-1][s_idx].token, j) != 0&&strcmp(level->buckets[i-1][s_idx].slot[j].key, key) == 0)
+                if (GET_BIT(level->buckets[i-1][s_idx].token, j) != 0&&level_key_equal(level->buckets[i-1][s_idx].slot[j].key, key))
                 {
+                    LEVEL_STATS_ADD(level, hit_probes[2 * (2 - i) + 2]);
                     return level->buckets[i-1][s_idx].slot[j].value;
                 }
             }
@@ -348,6 +431,7 @@ uint8_t* level_dynamic_query(level_hash *level, uint8_t *key)
             s_idx = S_IDX(s_hash, level->addr_capacity);
         }
     }
+    LEVEL_STATS_ADD(level, miss_probes[4]);
     return NULL;
 }
 
@@ -366,14 +450,16 @@ uint8_t* level_static_query(level_hash *level, uint8_t *key)
     uint64_t i, j;
     for(i = 0; i < 2; i ++){
         for(j = 0; j < ASSOC_NUM; j ++){
-            if (GET_BIT(level->buckets[i][f_idx].token, j) != 0&&strcmp(level->buckets[i][f_idx].slot[j].key, key) == 0)
+            if (GET_BIT(level->buckets[i][f_idx].token, j) != 0&&level_key_equal(level->buckets[i][f_idx].slot[j].key, key))
             {
+                LEVEL_STATS_ADD(level, hit_probes[2 * i + 1]);
                 return level->buckets[i][f_idx].slot[j].value;
             }
         }
         for(j = 0; j < ASSOC_NUM; j ++){
-            if (GET_BIT(level->buckets[i][s_idx].token, j) != 0&&strcmp(level->buckets[i][s_idx].slot[j].key, key) == 0)
+            if (GET_BIT(level->buckets[i][s_idx].token, j) != 0&&level_key_equal(level->buckets[i][s_idx].slot[j].key, key))
             {
+                LEVEL_STATS_ADD(level, hit_probes[2 * i + 2]);
                 return level->buckets[i][s_idx].slot[j].value;
             }
         }
@@ -381,6 +467,7 @@ uint8_t* level_static_query(level_hash *level, uint8_t *key)
         s_idx = S_IDX(s_hash, level->addr_capacity / 2);
     }
 
+    LEVEL_STATS_ADD(level, miss_probes[4]);
     return NULL;
 }
 
@@ -400,7 +487,7 @@ uint8_t level_delete(level_hash *level, uint8_t *key)
     uint64_t i, j;
     for(i = 0; i < 2; i ++){
         for(j = 0; j < ASSOC_NUM; j ++){
-            if (GET_BIT(level->buckets[i][f_idx].token, j) != 0&&strcmp(level->buckets[i][f_idx].slot[j].key, key) == 0)
+            if (GET_BIT(level->buckets[i][f_idx].token, j) != 0&&level_key_equal(level->buckets[i][f_idx].slot[j].key, key))
             {
                 SET_BIT(level->buckets[i][f_idx].token, j, 0);
                 pflush((uint64_t *)&level->buckets[i][f_idx].token);
@@ -410,7 +497,7 @@ uint8_t level_delete(level_hash *level, uint8_t *key)
             }
         }
         for(j = 0; j < ASSOC_NUM; j ++){
-            if (GET_BIT(level->buckets[i][s_idx].token, j) != 0&&strcmp(level->buckets[i][s_idx].slot[j].key, key) == 0)
+            if (GET_BIT(level->buckets[i][s_idx].token, j) != 0&&level_key_equal(level->buckets[i][s_idx].slot[j].key, key))
             {
                 SET_BIT(level->buckets[i][s_idx].token, j, 0);
                 pflush((uint64_t *)&level->buckets[i][s_idx].token);
@@ -441,7 +528,7 @@ uint8_t level_update(level_hash *level, uint8_t *key, uint8_t *new_value)
     uint64_t i, j, k;
     for(i = 0; i < 2; i ++){
         for(j = 0; j < ASSOC_NUM; j ++){
-            if (GET_BIT(level->buckets[i][f_idx].token, j) != 0&&strcmp(level->buckets[i][f_idx].slot[j].key, key) == 0)
+            if (GET_BIT(level->buckets[i][f_idx].token, j) != 0&&level_key_equal(level->buckets[i][f_idx].slot[j].key, key))
             {
                 for(k = 0; k < ASSOC_NUM; k++){
                     if (GET_BIT(level->buckets[i][f_idx].token, k) == 0){        // Log-free update
@@ -479,7 +566,7 @@ uint8_t level_update(level_hash *level, uint8_t *key, uint8_t *new_value)
             }
         }
         for(j = 0; j < ASSOC_NUM; j ++){
-            if (GET_BIT(level->buckets[i][s_idx].token, j) != 0&&strcmp(level->buckets[i][s_idx].slot[j].key, key) == 0)
+            if (GET_BIT(level->buckets[i][s_idx].token, j) != 0&&level_key_equal(level->buckets[i][s_idx].slot[j].key, key))
             {
                 for(k = 0; k < ASSOC_NUM; k++){
                     if (GET_BIT(level->buckets[i][s_idx].token, k) == 0){        // Log-free update
@@ -576,10 +663,14 @@ uint8_t level_insert(level_hash *level, uint8_t *key, uint8_t *value)
     s_idx = S_IDX(s_hash, level->addr_capacity);
     
     for(i = 0; i < 2; i++){
+        LEVEL_STATS_ADD(level, movement_tries[0]);
         if(!try_movement(level, f_idx, i, key, value)){
+            LEVEL_STATS_ADD(level, movement_successes[0]);
             return 0;
         }
+        LEVEL_STATS_ADD(level, movement_tries[0]);
         if(!try_movement(level, s_idx, i, key, value)){
+            LEVEL_STATS_ADD(level, movement_successes[0]);
             return 0;
         }
 
@@ -588,8 +679,10 @@ uint8_t level_insert(level_hash *level, uint8_t *key, uint8_t *value)
     }
 
     if(level->level_expand_time > 0){
+        LEVEL_STATS_ADD(level, movement_tries[1]);
         empty_location = b2t_movement(level, f_idx);
         if(empty_location != -1){
+            LEVEL_STATS_ADD(level, movement_successes[1]);
             memcpy(level->buckets[1][f_idx].slot[empty_location].key, key, KEY_LEN);
             memcpy(level->buckets[1][f_idx].slot[empty_location].value, value, VALUE_LEN);            
             asm_mfence();
@@ -601,8 +694,10 @@ uint8_t level_insert(level_hash *level, uint8_t *key, uint8_t *value)
             return 0;
         }
 
+        LEVEL_STATS_ADD(level, movement_tries[1]);
         empty_location = b2t_movement(level, s_idx);
         if(empty_location != -1){
+            LEVEL_STATS_ADD(level, movement_successes[1]);
             memcpy(level->buckets[1][s_idx].slot[empty_location].key, key, KEY_LEN);
             memcpy(level->buckets[1][s_idx].slot[empty_location].value, value, VALUE_LEN);
             asm_mfence();
@@ -757,14 +852,96 @@ int b2t_movement(level_hash *level, uint64_t idx)
     return -1;
 }
 
+/*
+Function: level_get_stats() 
+        Fill in the statistics of a level hash table; Only the counters and sizes are read, unless scan is set, 
+        in which case all buckets are scanned for the occupancy histogram as well
+*/
+void level_get_stats(level_hash *level, level_stats *stats, uint8_t scan)
+{
+    uint64_t idx, i;
+
+    *stats = level->stats;
+    stats->level_item_num[0] = level->level_item_num[0];
+    stats->level_item_num[1] = level->level_item_num[1];
+    stats->level_slot_num[0] = level->addr_capacity * ASSOC_NUM;
+    stats->level_slot_num[1] = level->addr_capacity / 2 * ASSOC_NUM;
+    stats->interim_item_num = 0;
+    stats->bucket_bytes = level->total_capacity * sizeof(level_bucket);
+    stats->lock_bytes = 0;
+    stats->log_bytes = sizeof(level_log) + level->log->log_length * (sizeof(log_entry) + sizeof(log_entry_insert));
+    stats->value_bytes = 0;
+
+    memset(stats->occupancy, 0, sizeof(stats->occupancy));
+    if (scan)
+    {
+        for (idx = 0; idx < level->total_capacity; idx ++) {
+            level_bucket *bucket = idx < level->addr_capacity ? &level->buckets[0][idx] : &level->buckets[1][idx - level->addr_capacity];
+            uint64_t items = 0;
+            for(i = 0; i < ASSOC_NUM; i ++)
+                items += GET_BIT(bucket->token, i) != 0;
+            stats->occupancy[items] ++;
+        }
+    }
+}
+
+/*
+Function: level_iter_begin() 
+        Begin a scan over all items, walking the top level and then the bottom level bucket by bucket;
+        The values may be updated during the scan, but an insertion, deletion or resizing may move 
+        items and invalidates the scan
+*/
+void level_iter_begin(level_hash *level, level_iter *iter)
+{
+    iter->level = level;
+    iter->level_num = 0;
+    iter->bucket = 0;
+    iter->slot = 0;
+}
+
+/*
+Function: level_iter_next() 
+        Get the next item of a scan, return 0 if there is one and 1 if the scan is finished;
+        The key and value point into the slot of the item in NVM
+*/
+uint8_t level_iter_next(level_iter *iter, uint8_t **key, uint8_t **value)
+{
+    level_hash *level = iter->level;
+
+    for (; iter->level_num < 2; iter->level_num ++, iter->bucket = 0) {
+        level_bucket *buckets = level->buckets[iter->level_num];
+        uint64_t bucket_num = iter->level_num == 0 ? level->addr_capacity : level->addr_capacity / 2;
+
+        for (; iter->bucket < bucket_num; iter->bucket ++, iter->slot = 0) {
+            level_bucket *bucket = &buckets[iter->bucket];
+            if (iter->slot == 0 && iter->bucket + LEVEL_ITER_PREFETCH < bucket_num)
+                __builtin_prefetch(&buckets[iter->bucket + LEVEL_ITER_PREFETCH]);
+
+            for (; iter->slot < ASSOC_NUM; iter->slot ++) {
+                if (GET_BIT(bucket->token, iter->slot))
+                {
+                    *key = bucket->slot[iter->slot].key;
+                    *value = bucket->slot[iter->slot].value;
+                    iter->slot ++;
+                    return 0;
+                }
+            }
+        }
+    }
+
+    return 1;
+}
+
 /*
 Function: level_destroy() 
         Destroy a level hash table
 */
 void level_destroy(level_hash *level)
 {
-    pfree(level->buckets[0], pow(2, level->level_size)*sizeof(level_bucket));
-    pfree(level->buckets[1], pow(2, level->level_size - 1)*sizeof(level_bucket));
-    pfree(level->log, sizeof(level_log));
+    level_allocator allocator = level->allocator;
+    level_block_free(&allocator, level->buckets[0], pow(2, level->level_size)*sizeof(level_bucket));
+    level_block_free(&allocator, level->buckets[1], pow(2, level->level_size - 1)*sizeof(level_bucket));
+    log_destroy(level->log, &allocator);
+    level_block_free(&allocator, level, sizeof(level_hash));
     level = NULL;
 }
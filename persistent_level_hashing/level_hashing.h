@@ -10,6 +10,19 @@
 #include "log.h"
 
 #define ASSOC_NUM 4                       // The number of slots in a bucket, should be smaller than 32
+#define LEVEL_ITER_PREFETCH 8             // The number of buckets a scan prefetches ahead of its cursor
+#define LEVEL_STATS_PROBE_NUM 5           // Lookups probe up to 4 buckets: two in each level
+
+/*  Compile-time options, enabled with -D in CFLAGS:
+    LEVEL_BINARY_KEY        Treat each key as exactly KEY_LEN bytes, which may include 0x00: keys are hashed over
+                            all KEY_LEN bytes and compared with one 16-byte SSE2 compare instead of strcmp()
+    LEVEL_STATS             Count the buckets probed by each lookup and the movements tried by insertions for
+                            level_get_stats(); The other statistics are always kept
+*/
+
+#if defined(LEVEL_BINARY_KEY) && KEY_LEN != 16
+#error "LEVEL_BINARY_KEY compares a key with one 16-byte load"
+#endif
 
 // set the n-th bit to 0 or 1
 #define SET_BIT(token, n, bit) (bit ? (token|=(1<<n)) : (token&=~(1<<n)))
@@ -28,6 +41,25 @@ typedef struct level_bucket               // A bucket, put the tokens behind the
     uint32_t token;                       // each bit in the last ASSOC_NUM bits is used to indicate whether its corresponding slot is empty
 } level_bucket;                           // 128 byte; one bucket should be cache-line-aligned
 
+typedef struct level_stats{               // The statistics of a level hash table, filled by level_get_stats()
+    uint64_t level_item_num[2];           // The numbers of items in the top and bottom levels
+    uint64_t level_slot_num[2];           // The numbers of slots in the top and bottom levels
+    uint64_t interim_item_num;            // Always 0, since a resizing is finished by the call that begins it
+    uint64_t occupancy[ASSOC_NUM + 1];    // occupancy[k]: the number of buckets holding k items, only filled by a bucket scan
+    uint64_t hit_probes[LEVEL_STATS_PROBE_NUM];   // hit_probes[k]: the lookups that found the key in the k-th bucket probed
+    uint64_t miss_probes[LEVEL_STATS_PROBE_NUM];  // miss_probes[k]: the lookups that missed after probing k buckets
+    uint64_t movement_tries[2];           // The same-level and bottom-to-top movements tried by insertions
+    uint64_t movement_successes[2];       // and how many of them made room for the new item
+    uint64_t expand_num;
+    uint64_t shrink_num;
+    uint64_t expand_ns;                   // The time spent in expanding and shrinking calls
+    uint64_t shrink_ns;
+    uint64_t bucket_bytes;                // The memory allocated for buckets, locks, logs and value cells
+    uint64_t lock_bytes;
+    uint64_t log_bytes;
+    uint64_t value_bytes;
+} level_stats;
+
 typedef struct level_hash {               // A Level hash table
     level_bucket *buckets[2];             // The top level and bottom level in the Level hash table
     level_bucket *interim_level_buckets;  // Used during resizing;
@@ -42,10 +74,22 @@ typedef struct level_hash {               // A Level hash table
     uint64_t s_seed;                      // Two randomized seeds for hash functions
 
     level_log *log;                       // The log
+    level_allocator allocator;            // Allocates and frees the buckets, the log and this header
+    level_stats stats;                    // The counters of the statistics, which are not flushed since they 
+                                          // only describe the hash table while it is open
 } level_hash;
 
+typedef struct level_iter{                // A cursor scanning all items of a level hash table
+    level_hash *level;
+    uint64_t level_num;                   // 0: the top level, 1: the bottom level
+    uint64_t bucket;
+    uint64_t slot;                        // The next slot to visit
+} level_iter;
+
 level_hash *level_init(uint64_t level_size);     
 
+level_hash *level_init_ex(uint64_t level_size, const level_allocator *allocator);
+
 uint8_t level_insert(level_hash *level, uint8_t *key, uint8_t *value);          
 
 uint8_t* level_static_query(level_hash *level, uint8_t *key);
@@ -64,4 +108,10 @@ uint8_t try_movement(level_hash *level, uint64_t idx, uint64_t level_num, uint8_
 
 int b2t_movement(level_hash *level, uint64_t idx);
 
+void level_get_stats(level_hash *level, level_stats *stats, uint8_t scan);
+
+void level_iter_begin(level_hash *level, level_iter *iter);
+
+uint8_t level_iter_next(level_iter *iter, uint8_t **key, uint8_t **value);
+
 void level_destroy(level_hash *level);
\ No newline at end of file
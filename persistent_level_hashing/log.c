@@ -2,18 +2,18 @@
 
 /*
 Function: log_create() 
-        Create a log;
+        Create a log, whose entries are allocated with the allocator of the hash table;
 */
-level_log* log_create(uint64_t log_length)
+level_log* log_create(uint64_t log_length, const level_allocator *allocator)
 {
-    level_log* log = pmalloc(sizeof(level_log));
+    level_log* log = level_block_alloc(allocator, sizeof(level_log));
     if (!log)
     {
         printf("Log creation fails: 1\n");
         exit(1);
     }
 
-    log->entry = pmalloc(log_length*sizeof(log_entry));
+    log->entry = level_block_alloc(allocator, log_length*sizeof(log_entry));
     if (!log->entry)
     {
         printf("Log creation fails: 2");
@@ -23,7 +23,7 @@ level_log* log_create(uint64_t log_length)
     log->log_length = log_length;
     log->current = 0;
 
-    log->entry_insert = pmalloc(log_length*sizeof(log_entry_insert));
+    log->entry_insert = level_block_alloc(allocator, log_length*sizeof(log_entry_insert));
     if (!log->entry_insert)
     {
         printf("Log creation fails: 3");
@@ -35,6 +35,17 @@ level_log* log_create(uint64_t log_length)
     return log;
 }
 
+/*
+Function: log_destroy() 
+        Free a log created with the same allocator;
+*/
+void log_destroy(level_log *log, const level_allocator *allocator)
+{
+    level_block_free(allocator, log->entry, log->log_length*sizeof(log_entry));
+    level_block_free(allocator, log->entry_insert, log->log_length*sizeof(log_entry_insert));
+    level_block_free(allocator, log, sizeof(level_log));
+}
+
 /*
 Function: log_write() 
         Write a log entry;
@@ -6,7 +6,7 @@
 #include <ctype.h>
 #include <math.h>
 #include "pflush.h"
-#include ".../quartz/src/lib/pmalloc.h"   // path to pmalloc.h in Quartz
+#include "level_alloc.h"
 
 #define KEY_LEN 16                        // The maximum length of a key
 #define VALUE_LEN 15                      // The maximum length of a value
@@ -35,7 +35,9 @@ typedef struct level_log
     uint64_t current_insert;
 }level_log;
 
-level_log* log_create(uint64_t log_length);
+level_log* log_create(uint64_t log_length, const level_allocator *allocator);
+
+void log_destroy(level_log *log, const level_allocator *allocator);
 
 void log_write(level_log *log, uint8_t *key, uint8_t *value);
 
@@ -17,6 +17,7 @@ int main(int argc, char* argv[])
 
     for (i = 1; i < insert_num + 1; i ++)
     {
+        memset(key, 0, KEY_LEN);              // Clear the bytes behind the terminator, which are hashed with LEVEL_BINARY_KEY
         snprintf(key, KEY_LEN, "%ld", i);
         snprintf(value, VALUE_LEN, "%ld", i);
         if (!level_insert(level, key, value))                               
@@ -37,6 +38,7 @@ int main(int argc, char* argv[])
     printf("The static search test begins ...\n");
     for (i = 1; i < insert_num + 1; i ++)
     {
+        memset(key, 0, KEY_LEN);
         snprintf(key, KEY_LEN, "%ld", i);
         uint8_t* get_value = level_static_query(level, key);
         if(get_value == NULL)
@@ -46,6 +48,7 @@ int main(int argc, char* argv[])
     printf("The dynamic search test begins ...\n");
     for (i = 1; i < insert_num + 1; i ++)
     {
+        memset(key, 0, KEY_LEN);
         snprintf(key, KEY_LEN, "%ld", i);
         uint8_t* get_value = level_dynamic_query(level, key);
         if(get_value == NULL)
@@ -55,6 +58,7 @@ int main(int argc, char* argv[])
     printf("The update test begins ...\n");
     for (i = 1; i < insert_num + 1; i ++)
     {
+        memset(key, 0, KEY_LEN);
         snprintf(key, KEY_LEN, "%ld", i);
         snprintf(value, VALUE_LEN, "%ld", i*2);
         if(level_update(level, key, value))
@@ -64,6 +68,7 @@ int main(int argc, char* argv[])
     printf("The deletion test begins ...\n");
     for (i = 1; i < insert_num + 1; i ++)
     {
+        memset(key, 0, KEY_LEN);
         snprintf(key, KEY_LEN, "%ld", i);
         if(level_delete(level, key))
             printf("Delete the key %s: ERROR! \n", key);
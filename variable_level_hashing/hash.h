@@ -0,0 +1,17 @@
+#include <stdint.h>
+
+/*
+Function: hash() 
+        This function is used to compute the hash value of a string key;
+        For integer keys, two different and independent hash functions should be used. 
+        For example, Jenkins Hash is used for the first hash funciton, and murmur3 hash is used for
+        the second hash funciton.
+*/
+uint64_t hash(const void *data, uint64_t length, uint64_t seed);
+
+/*
+Function: hash_pair() 
+        Compute the hash values of a key under two seeds in a single pass;
+        The results are the same as calling hash() once with each seed
+*/
+void hash_pair(const void *data, uint64_t length, uint64_t f_seed, uint64_t s_seed, uint64_t *f_hash, uint64_t *s_hash);
@@ -0,0 +1,85 @@
+#include "kv_arena.h"
+
+/*
+Function: arena_create() 
+        Create an arena with the given initial capacity in bytes
+*/
+kv_arena* arena_create(uint64_t capacity)
+{
+    kv_arena *arena = malloc(sizeof(kv_arena));
+    if (!arena)
+    {
+        printf("The arena creation fails: 1\n");
+        exit(1);
+    }
+
+    if (capacity < ARENA_ALIGN)
+        capacity = ARENA_ALIGN;
+    arena->data = malloc(capacity);
+    if (!arena->data)
+    {
+        printf("The arena creation fails: 2\n");
+        exit(1);
+    }
+
+    arena->size = 0;
+    arena->capacity = capacity;
+    arena->dead = 0;
+    return arena;
+}
+
+/*
+Function: arena_alloc() 
+        Append a key-value item to the arena and return its offset;
+        The arena grows by doubling, which moves the data but keeps the offsets valid
+*/
+uint64_t arena_alloc(kv_arena *arena, const uint8_t *key, uint32_t key_len, const uint8_t *value, uint32_t value_len)
+{
+    uint64_t record_size = arena_record_size(key_len, value_len);
+
+    if (arena->size + record_size > arena->capacity)
+    {
+        uint64_t capacity = arena->capacity * 2;
+        while (arena->size + record_size > capacity)
+            capacity *= 2;
+
+        uint8_t *data = realloc(arena->data, capacity);
+        if (!data)
+        {
+            printf("The arena allocation fails\n");
+            exit(1);
+        }
+        arena->data = data;
+        arena->capacity = capacity;
+    }
+
+    uint64_t offset = arena->size;
+    kv_record *record = arena_record(arena, offset);
+    record->key_len = key_len;
+    record->value_len = value_len;
+    memcpy(record->data, key, key_len);
+    memcpy(record->data + key_len, value, value_len);
+
+    arena->size += record_size;
+    return offset;
+}
+
+/*
+Function: arena_free() 
+        Mark the record at an offset as dead; its bytes are reclaimed by the next compaction
+*/
+void arena_free(kv_arena *arena, uint64_t offset)
+{
+    kv_record *record = arena_record(arena, offset);
+    arena->dead += arena_record_size(record->key_len, record->value_len);
+}
+
+/*
+Function: arena_destroy() 
+        Destroy an arena
+*/
+void arena_destroy(kv_arena *arena)
+{
+    free(arena->data);
+    free(arena);
+}
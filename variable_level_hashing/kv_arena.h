@@ -0,0 +1,45 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define ARENA_ALIGN 8                     // Records start at 8-byte aligned offsets
+
+typedef struct kv_record{                 // A variable-length key-value item stored in the arena
+    uint32_t key_len;
+    uint32_t value_len;
+    uint8_t data[];                       // The key bytes followed by the value bytes
+} kv_record;
+
+typedef struct kv_arena{                  // An append-only arena holding the key-value items out of line
+    uint8_t *data;
+    uint64_t size;                        // The number of bytes in use, including dead records
+    uint64_t capacity;                    // The number of bytes allocated
+    uint64_t dead;                        // The number of bytes of records that were deleted or replaced
+} kv_arena;
+
+/*
+Function: arena_record_size() 
+        The number of arena bytes taken by a record with the given key and value lengths
+*/
+static inline uint64_t arena_record_size(uint32_t key_len, uint32_t value_len)
+{
+    return (sizeof(kv_record) + key_len + value_len + ARENA_ALIGN - 1) & ~(uint64_t)(ARENA_ALIGN - 1);
+}
+
+/*
+Function: arena_record() 
+        Get the record at an offset; the pointer is only valid until the next allocation in the arena
+*/
+static inline kv_record* arena_record(kv_arena *arena, uint64_t offset)
+{
+    return (kv_record *)(arena->data + offset);
+}
+
+kv_arena* arena_create(uint64_t capacity);
+
+uint64_t arena_alloc(kv_arena *arena, const uint8_t *key, uint32_t key_len, const uint8_t *value, uint32_t value_len);
+
+void arena_free(kv_arena *arena, uint64_t offset);
+
+void arena_destroy(kv_arena *arena);
@@ -0,0 +1,704 @@
+#include "level_hashing.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*
+Function: FS_HASH() 
+        Compute both hash values of a key-value item in a single pass over the key
+*/
+void FS_HASH(level_hash *level, const uint8_t *key, uint32_t key_len, uint64_t *f_hash, uint64_t *s_hash) {
+    hash_pair((void *)key, key_len, level->f_seed, level->s_seed, f_hash, s_hash);
+}
+
+/*
+Function: F_IDX() 
+        Compute the second hash location
+*/
+uint64_t F_IDX(uint64_t hashKey, uint64_t capacity) {
+    return hashKey % (capacity / 2);
+}
+
+/*
+Function: S_IDX() 
+        Compute the second hash location
+*/
+uint64_t S_IDX(uint64_t hashKey, uint64_t capacity) {
+    return hashKey % (capacity / 2) + capacity / 2;
+}
+
+/*
+Function: FP_HASH() 
+        Compute the one-byte fingerprint of a key from its first hash value;
+        The high byte is used since the bucket locations only depend on the low bits
+*/
+static inline uint8_t FP_HASH(uint64_t f_hash) {
+    return (uint8_t)(f_hash >> 56);
+}
+
+/*
+Function: level_match() 
+        Return a bitmap of the occupied slots in a bucket whose fingerprints are equal to fp;
+        The tokens and fingerprints of all slots are compared at once with SSE2
+*/
+static inline uint32_t level_match(level_bucket *bucket, uint8_t fp)
+{
+#ifdef __SSE2__
+    __m128i header = _mm_loadu_si128((const __m128i *)bucket->token);     // token[] and fp[] are adjacent
+    uint32_t token_mask = _mm_movemask_epi8(_mm_cmpeq_epi8(header, _mm_set1_epi8(1)));
+    uint32_t fp_mask = _mm_movemask_epi8(_mm_cmpeq_epi8(header, _mm_set1_epi8((char)fp)));
+    return token_mask & (fp_mask >> ASSOC_NUM) & ((1 << ASSOC_NUM) - 1);
+#else
+    uint32_t mask = 0;
+    uint64_t j;
+    for(j = 0; j < ASSOC_NUM; j ++){
+        if (bucket->token[j] == 1 && bucket->fp[j] == fp)
+            mask |= 1 << j;
+    }
+    return mask;
+#endif
+}
+
+/*
+Function: level_find() 
+        Find the slot referring to the key in a bucket, return -1 if the key is not in this bucket;
+        The arena is only read for the slots whose fingerprints match
+*/
+static inline int level_find(level_hash *level, level_bucket *bucket, const uint8_t *key, uint32_t key_len, uint8_t fp)
+{
+    uint32_t mask = level_match(bucket, fp);
+    while (mask) {
+        int j = __builtin_ctz(mask);
+        kv_record *record = arena_record(level->arena, bucket->slot[j].kv);
+        if (record->key_len == key_len && memcmp(record->data, key, key_len) == 0)
+            return j;
+        mask &= mask - 1;
+    }
+    return -1;
+}
+
+/*
+Function: level_slot_write() 
+        Write the arena offset of an item with its fingerprint and hash bits into the j-th slot of a bucket and then set the token
+*/
+static inline void level_slot_write(level_bucket *bucket, uint64_t j, uint64_t kv, uint64_t f_hash, uint64_t s_hash, uint8_t fp)
+{
+    bucket->slot[j].kv = kv;
+    bucket->fp[j] = fp;
+    bucket->f_hash[j] = (uint32_t)f_hash;
+    bucket->s_hash[j] = (uint32_t)s_hash;
+    bucket->token[j] = 1;
+}
+
+/*
+Function: level_slot_move() 
+        Move the item in the i-th slot of src_bucket into the j-th slot of dst_bucket;
+        Only the slot moves, the key-value item stays where it is in the arena
+*/
+static inline void level_slot_move(level_bucket *dst_bucket, uint64_t j, level_bucket *src_bucket, uint64_t i)
+{
+    level_slot_write(dst_bucket, j, src_bucket->slot[i].kv, src_bucket->f_hash[i], src_bucket->s_hash[i], src_bucket->fp[i]);
+    src_bucket->token[i] = 0;
+}
+
+/*
+Function: generate_seeds() 
+        Generate two randomized seeds for hash functions
+*/
+void generate_seeds(level_hash *level)
+{
+    srand(time(NULL));
+    do
+    {
+        level->f_seed = rand();
+        level->s_seed = rand();
+        level->f_seed = level->f_seed << (rand() % 63);
+        level->s_seed = level->s_seed << (rand() % 63);
+    } while (level->f_seed == level->s_seed);
+}
+
+/*
+Function: level_init() 
+        Initialize a level hash table
+*/
+level_hash *level_init(uint64_t level_size)
+{
+    level_hash *level = malloc(sizeof(level_hash));
+    if (!level)
+    {
+        printf("The level hash table initialization fails:1\n");
+        exit(1);
+    }
+
+    if (level_size > LEVEL_MAX_SIZE)
+    {
+        printf("The level hash table initialization fails:3\n");
+        exit(1);
+    }
+
+    level->level_size = level_size;
+    level->addr_capacity = pow(2, level_size);
+    level->total_capacity = pow(2, level_size) + pow(2, level_size - 1);
+    generate_seeds(level);
+    level->buckets[0] = calloc(pow(2, level_size), sizeof(level_bucket));
+    level->buckets[1] = calloc(pow(2, level_size - 1), sizeof(level_bucket));
+    level->arena = arena_create(level->total_capacity * ASSOC_NUM * 32);
+    level->level_item_num[0] = 0;
+    level->level_item_num[1] = 0;
+    level->level_expand_time = 0;
+    level->resize_state = 0;
+    
+    if (!level->buckets[0] || !level->buckets[1])
+    {
+        printf("The level hash table initialization fails:2\n");
+        exit(1);
+    }
+
+    printf("Variable-length level hashing: ASSOC_NUM %d\n", ASSOC_NUM);
+    printf("The number of top-level buckets: %ld\n", level->addr_capacity);
+    printf("The number of all buckets: %ld\n", level->total_capacity);
+    printf("The number of all entries: %ld\n", level->total_capacity*ASSOC_NUM);
+    printf("The level hash table initialization succeeds!\n");
+    return level;
+}
+
+/*
+Function: level_compact() 
+        Copy the live items into a new arena, in the order of the buckets, and drop the dead records;
+        It is done during resizing and only when dead records take more than ARENA_COMPACT_RATIO of the arena
+*/
+static void level_compact(level_hash *level)
+{
+    kv_arena *old_arena = level->arena;
+    if (old_arena->dead <= old_arena->size * ARENA_COMPACT_RATIO)
+        return;
+
+    kv_arena *new_arena = arena_create((old_arena->size - old_arena->dead) * 2);
+    uint64_t i, idx, j;
+    for (i = 0; i < 2; i ++) {
+        uint64_t bucket_num = level->addr_capacity / (1 + i);
+        for (idx = 0; idx < bucket_num; idx ++) {
+            level_bucket *bucket = &level->buckets[i][idx];
+            for (j = 0; j < ASSOC_NUM; j ++) {
+                if (bucket->token[j] == 1)
+                {
+                    kv_record *record = arena_record(old_arena, bucket->slot[j].kv);
+                    bucket->slot[j].kv = arena_alloc(new_arena, record->data, record->key_len, 
+                        record->data + record->key_len, record->value_len);
+                }
+            }
+        }
+    }
+
+    arena_destroy(old_arena);
+    level->arena = new_arena;
+}
+
+static uint8_t level_insert_item(level_hash *level, uint64_t kv, uint64_t f_hash, uint64_t s_hash, uint8_t fp);
+
+/*
+Function: level_expand()
+        Expand a level hash table in place;
+        Put a new level on top of the old hash table and only rehash the
+        items in the bottom level of the old hash table;
+*/
+void level_expand(level_hash *level) 
+{
+    if (!level)
+    {
+        printf("The expanding fails: 1\n");
+        exit(1);
+    }
+    if (level->level_size + 1 > LEVEL_MAX_SIZE)
+    {
+        printf("The expanding fails: 4\n");
+        exit(1);
+    }
+    level->resize_state = 1;
+    level->addr_capacity = pow(2, level->level_size + 1);
+    level_bucket *newBuckets = calloc(level->addr_capacity, sizeof(level_bucket));
+    if (!newBuckets) {
+        printf("The expanding fails: 2\n");
+        exit(1);
+    }
+    uint64_t new_level_item_num = 0;
+    
+    uint64_t old_idx;
+    for (old_idx = 0; old_idx < pow(2, level->level_size - 1); old_idx ++) {
+        uint64_t i, j;
+        for(i = 0; i < ASSOC_NUM; i ++){
+            if (level->buckets[1][old_idx].token[i] == 1)
+            {
+                uint64_t f_idx = F_IDX(level->buckets[1][old_idx].f_hash[i], level->addr_capacity);
+                uint64_t s_idx = S_IDX(level->buckets[1][old_idx].s_hash[i], level->addr_capacity);
+
+                uint8_t insertSuccess = 0;
+                for(j = 0; j < ASSOC_NUM; j ++){                            
+                    /*  The rehashed item is inserted into the less-loaded bucket between 
+                        the two hash locations in the new level
+                    */
+                    if (newBuckets[f_idx].token[j] == 0)
+                    {
+                        level_slot_move(&newBuckets[f_idx], j, &level->buckets[1][old_idx], i);
+                        insertSuccess = 1;
+                        new_level_item_num ++;
+                        break;
+                    }
+                    if (newBuckets[s_idx].token[j] == 0)
+                    {
+                        level_slot_move(&newBuckets[s_idx], j, &level->buckets[1][old_idx], i);
+                        insertSuccess = 1;
+                        new_level_item_num ++;
+                        break;
+                    }
+                }
+                if(!insertSuccess){
+                    printf("The expanding fails: 3\n");
+                    exit(1);                    
+                }
+            }
+        }
+    }
+
+    level->level_size ++;
+    level->total_capacity = pow(2, level->level_size) + pow(2, level->level_size - 1);
+
+    free(level->buckets[1]);
+    level->buckets[1] = level->buckets[0];
+    level->buckets[0] = newBuckets;
+    newBuckets = NULL;
+    
+    level->level_item_num[1] = level->level_item_num[0];
+    level->level_item_num[0] = new_level_item_num;
+    level->level_expand_time ++;
+
+    level_compact(level);
+    level->resize_state = 0;
+}
+
+/*
+Function: level_shrink()
+        Shrink a level hash table in place;
+        Put a new level at the bottom of the old hash table and only rehash the
+        items in the top level of the old hash table;
+*/
+void level_shrink(level_hash *level)
+{
+    if (!level)
+    {
+        printf("The shrinking fails: 1\n");
+        exit(1);
+    }
+
+    // The shrinking is performed only when the hash table has very few items.
+    if(level->level_item_num[0] + level->level_item_num[1] > level->total_capacity*ASSOC_NUM*0.4){
+        printf("The shrinking fails: 2\n");
+        exit(1);
+    }
+
+    level->resize_state = 2;
+    level->level_size --;
+    level_bucket *newBuckets = calloc(pow(2, level->level_size - 1), sizeof(level_bucket));
+    level_bucket *interimBuckets = level->buckets[0];
+    level->buckets[0] = level->buckets[1];
+    level->buckets[1] = newBuckets;
+    newBuckets = NULL;
+
+    level->level_item_num[0] = level->level_item_num[1];
+    level->level_item_num[1] = 0;
+
+    level->addr_capacity = pow(2, level->level_size);
+    level->total_capacity = pow(2, level->level_size) + pow(2, level->level_size - 1);
+
+    uint64_t old_idx, i;
+    for (old_idx = 0; old_idx < pow(2, level->level_size+1); old_idx ++) {
+        for(i = 0; i < ASSOC_NUM; i ++){
+            if (interimBuckets[old_idx].token[i] == 1)
+            {
+                // Only the slot is reinserted, the key-value item stays in the arena
+                if(level_insert_item(level, interimBuckets[old_idx].slot[i].kv, interimBuckets[old_idx].f_hash[i], 
+                    interimBuckets[old_idx].s_hash[i], interimBuckets[old_idx].fp[i])){
+                        printf("The shrinking fails: 3\n");
+                        exit(1);   
+                }
+
+            interimBuckets[old_idx].token[i] = 0;
+            }
+        }
+    } 
+
+    free(interimBuckets);
+    level->level_expand_time = 0;
+
+    level_compact(level);
+    level->resize_state = 0;
+}
+
+/*
+Function: level_value() 
+        Get the value of the item referred by the j-th slot of a bucket
+*/
+static inline uint8_t* level_value(level_hash *level, level_bucket *bucket, int j, uint32_t *value_len)
+{
+    kv_record *record = arena_record(level->arena, bucket->slot[j].kv);
+    if (value_len)
+        *value_len = record->value_len;
+    return record->data + record->key_len;
+}
+
+/*
+Function: level_dynamic_query() 
+        Lookup a key-value item in level hash table via danamic search scheme;
+        First search the level with more items;
+        The returned value is valid until the next insertion, update or resizing
+*/
+uint8_t* level_dynamic_query(level_hash *level, const uint8_t *key, uint32_t key_len, uint32_t *value_len)
+{
+    uint64_t f_hash, s_hash;
+    FS_HASH(level, key, key_len, &f_hash, &s_hash);
+    uint8_t fp = FP_HASH(f_hash);
+
+    uint64_t i, f_idx, s_idx;
+    int j;
+    if(level->level_item_num[0] > level->level_item_num[1]){
+        f_idx = F_IDX(f_hash, level->addr_capacity);
+        s_idx = S_IDX(s_hash, level->addr_capacity); 
+
+        for(i = 0; i < 2; i ++){
+            j = level_find(level, &level->buckets[i][f_idx], key, key_len, fp);
+            if (j != -1)
+            {
+                return level_value(level, &level->buckets[i][f_idx], j, value_len);
+            }
+            j = level_find(level, &level->buckets[i][s_idx], key, key_len, fp);
+            if (j != -1)
+            {
+                return level_value(level, &level->buckets[i][s_idx], j, value_len);
+            }
+            f_idx = F_IDX(f_hash, level->addr_capacity / 2);
+            s_idx = S_IDX(s_hash, level->addr_capacity / 2);
+        }
+    }
+    else{
+        f_idx = F_IDX(f_hash, level->addr_capacity/2);
+        s_idx = S_IDX(s_hash, level->addr_capacity/2);
+
+        for(i = 2; i > 0; i --){
+            j = level_find(level, &level->buckets[i-1][f_idx], key, key_len, fp);
+            if (j != -1)
+            {
+                return level_value(level, &level->buckets[i-1][f_idx], j, value_len);
+            }
+            j = level_find(level, &level->buckets[i-1][s_idx], key, key_len, fp);
+            if (j != -1)
+            {
+                return level_value(level, &level->buckets[i-1][s_idx], j, value_len);
+            }
+            f_idx = F_IDX(f_hash, level->addr_capacity);
+            s_idx = S_IDX(s_hash, level->addr_capacity);
+        }
+    }
+    return NULL;
+}
+
+/*
+Function: level_static_query() 
+        Lookup a key-value item in level hash table via static search scheme;
+        Always first search the top level and then search the bottom level;
+        The returned value is valid until the next insertion, update or resizing
+*/
+uint8_t* level_static_query(level_hash *level, const uint8_t *key, uint32_t key_len, uint32_t *value_len)
+{
+    uint64_t f_hash, s_hash;
+    FS_HASH(level, key, key_len, &f_hash, &s_hash);
+    uint64_t f_idx = F_IDX(f_hash, level->addr_capacity);
+    uint64_t s_idx = S_IDX(s_hash, level->addr_capacity);
+    uint8_t fp = FP_HASH(f_hash);
+    
+    uint64_t i;
+    int j;
+    for(i = 0; i < 2; i ++){
+        j = level_find(level, &level->buckets[i][f_idx], key, key_len, fp);
+        if (j != -1)
+        {
+            return level_value(level, &level->buckets[i][f_idx], j, value_len);
+        }
+        j = level_find(level, &level->buckets[i][s_idx], key, key_len, fp);
+        if (j != -1)
+        {
+            return level_value(level, &level->buckets[i][s_idx], j, value_len);
+        }
+        f_idx = F_IDX(f_hash, level->addr_capacity / 2);
+        s_idx = S_IDX(s_hash, level->addr_capacity / 2);
+    }
+
+    return NULL;
+}
+
+/*
+Function: level_delete() 
+        Remove a key-value item from level hash table;
+        Its record in the arena becomes dead and is reclaimed by a later compaction
+*/
+uint8_t level_delete(level_hash *level, const uint8_t *key, uint32_t key_len)
+{
+    uint64_t f_hash, s_hash;
+    FS_HASH(level, key, key_len, &f_hash, &s_hash);
+    uint64_t f_idx = F_IDX(f_hash, level->addr_capacity);
+    uint64_t s_idx = S_IDX(s_hash, level->addr_capacity);
+    uint8_t fp = FP_HASH(f_hash);
+    
+    uint64_t i;
+    int j;
+    for(i = 0; i < 2; i ++){
+        j = level_find(level, &level->buckets[i][f_idx], key, key_len, fp);
+        if (j != -1)
+        {
+            arena_free(level->arena, level->buckets[i][f_idx].slot[j].kv);
+            level->buckets[i][f_idx].token[j] = 0;
+            level->level_item_num[i] --;
+            return 0;
+        }
+        j = level_find(level, &level->buckets[i][s_idx], key, key_len, fp);
+        if (j != -1)
+        {
+            arena_free(level->arena, level->buckets[i][s_idx].slot[j].kv);
+            level->buckets[i][s_idx].token[j] = 0;
+            level->level_item_num[i] --;
+            return 0;
+        }
+        f_idx = F_IDX(f_hash, level->addr_capacity / 2);
+        s_idx = S_IDX(s_hash, level->addr_capacity / 2);
+    }
+
+    return 1;
+}
+
+/*
+Function: level_update_slot() 
+        Replace the value of the item referred by the j-th slot of a bucket;
+        The record is rewritten in place when the new value takes the same arena space, 
+        otherwise a new record is appended and the old one becomes dead
+*/
+static inline void level_update_slot(level_hash *level, level_bucket *bucket, int j, 
+    const uint8_t *key, uint32_t key_len, const uint8_t *new_value, uint32_t value_len)
+{
+    kv_record *record = arena_record(level->arena, bucket->slot[j].kv);
+    if (arena_record_size(key_len, value_len) == arena_record_size(key_len, record->value_len))
+    {
+        memcpy(record->data + key_len, new_value, value_len);
+        record->value_len = value_len;
+        return;
+    }
+
+    uint64_t old_kv = bucket->slot[j].kv;
+    bucket->slot[j].kv = arena_alloc(level->arena, key, key_len, new_value, value_len);
+    arena_free(level->arena, old_kv);
+}
+
+/*
+Function: level_update() 
+        Update the value of a key-value item in level hash table;
+        The function can be optimized by using the dynamic search scheme
+*/
+uint8_t level_update(level_hash *level, const uint8_t *key, uint32_t key_len, const uint8_t *new_value, uint32_t value_len)
+{
+    uint64_t f_hash, s_hash;
+    FS_HASH(level, key, key_len, &f_hash, &s_hash);
+    uint64_t f_idx = F_IDX(f_hash, level->addr_capacity);
+    uint64_t s_idx = S_IDX(s_hash, level->addr_capacity);
+    uint8_t fp = FP_HASH(f_hash);
+    
+    uint64_t i;
+    int j;
+    for(i = 0; i < 2; i ++){
+        j = level_find(level, &level->buckets[i][f_idx], key, key_len, fp);
+        if (j != -1)
+        {
+            level_update_slot(level, &level->buckets[i][f_idx], j, key, key_len, new_value, value_len);
+            return 0;
+        }
+        j = level_find(level, &level->buckets[i][s_idx], key, key_len, fp);
+        if (j != -1)
+        {
+            level_update_slot(level, &level->buckets[i][s_idx], j, key, key_len, new_value, value_len);
+            return 0;
+        }
+        f_idx = F_IDX(f_hash, level->addr_capacity / 2);
+        s_idx = S_IDX(s_hash, level->addr_capacity / 2);
+    }
+
+    return 1;
+}
+
+/*
+Function: level_insert_item() 
+        Insert the slot of an item already stored in the arena, whose hash values and fingerprint are known;
+*/
+static uint8_t level_insert_item(level_hash *level, uint64_t kv, uint64_t f_hash, uint64_t s_hash, uint8_t fp)
+{
+    uint64_t f_idx = F_IDX(f_hash, level->addr_capacity);
+    uint64_t s_idx = S_IDX(s_hash, level->addr_capacity);
+
+    uint64_t i, j;
+    int empty_location;
+
+    for(i = 0; i < 2; i ++){
+        for(j = 0; j < ASSOC_NUM; j ++){        
+            /*  The new item is inserted into the less-loaded bucket between 
+                the two hash locations in each level           
+            */      
+            if (level->buckets[i][f_idx].token[j] == 0)
+            {
+                level_slot_write(&level->buckets[i][f_idx], j, kv, f_hash, s_hash, fp);
+                level->level_item_num[i] ++;
+                return 0;
+            }
+            if (level->buckets[i][s_idx].token[j] == 0) 
+            {
+                level_slot_write(&level->buckets[i][s_idx], j, kv, f_hash, s_hash, fp);
+                level->level_item_num[i] ++;
+                return 0;
+            }
+        }
+        
+        f_idx = F_IDX(f_hash, level->addr_capacity / 2);
+        s_idx = S_IDX(s_hash, level->addr_capacity / 2);
+    }
+
+    f_idx = F_IDX(f_hash, level->addr_capacity);
+    s_idx = S_IDX(s_hash, level->addr_capacity);
+    
+    for(i = 0; i < 2; i++){
+        empty_location = try_movement(level, f_idx, i);
+        if(empty_location != -1){
+            level_slot_write(&level->buckets[i][f_idx], empty_location, kv, f_hash, s_hash, fp);
+            level->level_item_num[i] ++;
+            return 0;
+        }
+        empty_location = try_movement(level, s_idx, i);
+        if(empty_location != -1){
+            level_slot_write(&level->buckets[i][s_idx], empty_location, kv, f_hash, s_hash, fp);
+            level->level_item_num[i] ++;
+            return 0;
+        }
+
+        f_idx = F_IDX(f_hash, level->addr_capacity/2);
+        s_idx = S_IDX(s_hash, level->addr_capacity/2);        
+    }
+    
+    if(level->level_expand_time > 0){
+        empty_location = b2t_movement(level, f_idx);
+        if(empty_location != -1){
+            level_slot_write(&level->buckets[1][f_idx], empty_location, kv, f_hash, s_hash, fp);
+            level->level_item_num[1] ++;
+            return 0;
+        }
+
+        empty_location = b2t_movement(level, s_idx);
+        if(empty_location != -1){
+            level_slot_write(&level->buckets[1][s_idx], empty_location, kv, f_hash, s_hash, fp);
+            level->level_item_num[1] ++;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+Function: level_insert() 
+        Insert a key-value item into level hash table;
+        The item is appended to the arena first, and its record becomes dead if no slot is found
+*/
+uint8_t level_insert(level_hash *level, const uint8_t *key, uint32_t key_len, const uint8_t *value, uint32_t value_len)
+{
+    uint64_t f_hash, s_hash;
+    FS_HASH(level, key, key_len, &f_hash, &s_hash);
+
+    uint64_t kv = arena_alloc(level->arena, key, key_len, value, value_len);
+    if (level_insert_item(level, kv, f_hash, s_hash, FP_HASH(f_hash)))
+    {
+        arena_free(level->arena, kv);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+Function: try_movement() 
+        Try to move an item from the current bucket to its same-level alternative bucket;
+        Return the slot that is freed in the current bucket, or -1 if no item can be moved
+*/
+int try_movement(level_hash *level, uint64_t idx, uint64_t level_num)
+{
+    uint64_t i, j, jdx;
+
+    for(i = 0; i < ASSOC_NUM; i ++){
+        level_bucket *bucket = &level->buckets[level_num][idx];
+        uint64_t f_idx = F_IDX(bucket->f_hash[i], level->addr_capacity/(1+level_num));
+        uint64_t s_idx = S_IDX(bucket->s_hash[i], level->addr_capacity/(1+level_num));
+        
+        if(f_idx == idx)
+            jdx = s_idx;
+        else
+            jdx = f_idx;
+
+        for(j = 0; j < ASSOC_NUM; j ++){
+            if (level->buckets[level_num][jdx].token[j] == 0)
+            {
+                level_slot_move(&level->buckets[level_num][jdx], j, bucket, i);
+                // The movement is finished and then the new item can be inserted into the i-th slot
+                return i;
+            }
+        }       
+    }
+    
+    return -1;
+}
+
+/*
+Function: b2t_movement() 
+        Try to move a bottom-level item to its top-level alternative buckets;
+*/
+int b2t_movement(level_hash *level, uint64_t idx)
+{
+    uint64_t s_idx, f_idx;
+    
+    uint64_t i, j;
+    for(i = 0; i < ASSOC_NUM; i ++){
+        f_idx = F_IDX(level->buckets[1][idx].f_hash[i], level->addr_capacity);
+        s_idx = S_IDX(level->buckets[1][idx].s_hash[i], level->addr_capacity);
+    
+        for(j = 0; j < ASSOC_NUM; j ++){
+            if (level->buckets[0][f_idx].token[j] == 0)
+            {
+                level_slot_move(&level->buckets[0][f_idx], j, &level->buckets[1][idx], i);
+                level->level_item_num[0] ++;
+                level->level_item_num[1] --;
+                return i;
+            }
+            else if (level->buckets[0][s_idx].token[j] == 0)
+            {
+                level_slot_move(&level->buckets[0][s_idx], j, &level->buckets[1][idx], i);
+                level->level_item_num[0] ++;
+                level->level_item_num[1] --;
+                return i;
+            }
+        }
+    }
+
+    return -1;
+}
+
+/*
+Function: level_destroy() 
+        Destroy a level hash table
+*/
+void level_destroy(level_hash *level)
+{
+    free(level->buckets[0]);
+    free(level->buckets[1]);
+    arena_destroy(level->arena);
+    level = NULL;
+}
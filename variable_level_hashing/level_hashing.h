@@ -0,0 +1,62 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <ctype.h>
+#include <math.h>
+#include "hash.h"
+#include "kv_arena.h"
+
+#define ASSOC_NUM 4                       // The number of slots in a bucket, should be no more than 8
+#define LEVEL_MAX_SIZE 33                 // The cached 32-bit hash values address at most 2^32 buckets in each half of the top level
+#define ARENA_COMPACT_RATIO 0.25          // The arena is compacted at a resizing when dead records exceed this share of it
+
+typedef struct entry{                     // A slot referring to a key-value item in the arena
+    uint64_t kv;                          // The offset of the item in the arena
+} entry;
+
+typedef struct level_bucket               // A bucket
+{
+    uint8_t token[ASSOC_NUM];             // A token indicates whether its corresponding slot is empty, which can also be implemented using 1 bit
+    uint8_t fp[ASSOC_NUM];                // A one-byte fingerprint of the key in each slot, kept right behind the tokens so that both are matched with one SIMD load
+    uint32_t f_hash[ASSOC_NUM];           // The low 32 bits of the two hash values of the key in each slot, so that movements
+    uint32_t s_hash[ASSOC_NUM];           // and resizing never read the key back from the arena
+    entry slot[ASSOC_NUM];
+} level_bucket;
+
+typedef struct level_hash {               // A Level hash table
+    level_bucket *buckets[2];             // The top level and bottom level in the Level hash table
+    kv_arena *arena;                      // The arena storing the keys and values
+    uint64_t level_item_num[2];           // The numbers of items stored in the top and bottom levels respectively
+    uint64_t addr_capacity;               // The number of buckets in the top level
+    uint64_t total_capacity;              // The number of all buckets in the Level hash table    
+    uint64_t level_size;                  // level_size = log2(addr_capacity)
+    uint8_t level_expand_time;            // Indicate whether the Level hash table was expanded, ">1 or =1": Yes, "0": No;
+    uint8_t resize_state;                 // Indicate the resizing state of the level hash table, ‘0’ means the hash table is not during resizing; 
+                                          // ‘1’ means the hash table is being expanded; ‘2’ means the hash table is being shrunk.
+    uint64_t f_seed;
+    uint64_t s_seed;                      // Two randomized seeds for hash functions
+} level_hash;
+
+level_hash *level_init(uint64_t level_size);     
+
+uint8_t level_insert(level_hash *level, const uint8_t *key, uint32_t key_len, const uint8_t *value, uint32_t value_len);          
+
+uint8_t* level_static_query(level_hash *level, const uint8_t *key, uint32_t key_len, uint32_t *value_len);
+
+uint8_t* level_dynamic_query(level_hash *level, const uint8_t *key, uint32_t key_len, uint32_t *value_len);
+
+uint8_t level_delete(level_hash *level, const uint8_t *key, uint32_t key_len);
+
+uint8_t level_update(level_hash *level, const uint8_t *key, uint32_t key_len, const uint8_t *new_value, uint32_t value_len);
+
+void level_expand(level_hash *level);
+
+void level_shrink(level_hash *level);
+
+int try_movement(level_hash *level, uint64_t idx, uint64_t level_num);
+
+int b2t_movement(level_hash *level, uint64_t idx);
+
+void level_destroy(level_hash *level);
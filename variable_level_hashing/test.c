@@ -0,0 +1,129 @@
+#include "level_hashing.h"
+#include <time.h>
+/*  Test:
+    This is a simple test example to test the creation, insertion, search, deletion, update in Level hashing 
+    with variable-length keys and values
+*/
+#define MAX_KV_LEN 64
+
+int main(int argc, char* argv[])                        
+{
+    int level_size = atoi(argv[1]);                     // INPUT: the number of addressable buckets is 2^level_size
+    int insert_num = atoi(argv[2]);                     // INPUT: the number of items to be inserted
+    
+    struct timespec start_time, end_time;       // Wall-clock time, so that waiting and parallel expanding are counted
+    double time_taken;
+    double ops;   
+
+    printf("Pre alloc memory:\n");
+    //pre-allocate and format key and value arrays, the lengths of the values vary with the keys
+    uint8_t **keys = (uint8_t**)malloc((insert_num + 1 )* sizeof(uint8_t *));
+    uint8_t **values = (uint8_t**)malloc((insert_num + 1 )* sizeof(uint8_t *));
+    uint32_t *key_lens = (uint32_t*)malloc((insert_num + 1 )* sizeof(uint32_t));
+    uint32_t *value_lens = (uint32_t*)malloc((insert_num + 1 )* sizeof(uint32_t));
+    for (int i = 0; i < insert_num + 1; i++) {
+        keys[i] = (uint8_t *)malloc(MAX_KV_LEN * sizeof(uint8_t));
+        values[i] = (uint8_t *)malloc(MAX_KV_LEN * sizeof(uint8_t));
+    }
+    printf("Alloc memory done\n");
+    //format keys and values
+    for (int i = 1; i < insert_num + 1; i++) {
+        key_lens[i] = snprintf((char *)keys[i], MAX_KV_LEN, "key-%d", i + 1);
+        value_lens[i] = 1 + i % (MAX_KV_LEN - 1);
+        memset(values[i], 'a' + i % 26, value_lens[i]);
+    }
+
+    level_hash *level = level_init(level_size);
+    uint64_t inserted = 0, i = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    for (i = 1; i < insert_num + 1; i ++)
+    {
+        if (!level_insert(level, keys[i], key_lens[i], values[i], value_lens[i]))                               
+        {
+            inserted ++;
+        }else
+        {
+            level_expand(level);
+            level_insert(level, keys[i], key_lens[i], values[i], value_lens[i]);
+            inserted ++;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    time_taken = (end_time.tv_sec - start_time.tv_sec) + (end_time.tv_nsec - start_time.tv_nsec) / 1e9;
+    ops = (double)insert_num / time_taken; 
+    printf("%ld items are inserted ! takes %f sec, OPS %f \n", inserted ,time_taken ,ops);
+
+    printf("The static search test begins ...\n");
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    for (i = 1; i < insert_num + 1; i ++)
+    {
+        uint32_t value_len;
+        uint8_t* get_value = level_static_query(level, keys[i], key_lens[i], &value_len);
+        if(get_value == NULL || value_len != value_lens[i] || memcmp(get_value, values[i], value_len) != 0)
+            printf("Search the key %s: ERROR! \n", keys[i]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    time_taken = (end_time.tv_sec - start_time.tv_sec) + (end_time.tv_nsec - start_time.tv_nsec) / 1e9;
+    ops = (double)insert_num / time_taken; 
+    printf("%ld items are static searched ! takes %f sec, OPS %f \n", inserted ,time_taken ,ops);
+
+    printf("The dynamic search test begins ...\n");
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    for (i = 1; i < insert_num + 1; i ++)
+    {
+        uint32_t value_len;
+        uint8_t* get_value = level_dynamic_query(level, keys[i], key_lens[i], &value_len);
+        if(get_value == NULL || value_len != value_lens[i] || memcmp(get_value, values[i], value_len) != 0)
+            printf("Search the key %s: ERROR! \n", keys[i]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    time_taken = (end_time.tv_sec - start_time.tv_sec) + (end_time.tv_nsec - start_time.tv_nsec) / 1e9;
+    ops = (double)insert_num / time_taken; 
+    printf("%ld items are dynamic searched! takes %f sec, OPS %f \n", inserted ,time_taken ,ops);
+
+    printf("The update test begins ...\n");
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    for (i = 1; i < insert_num + 1; i ++)
+    {
+        // The keys are written as the new values, so some records are rewritten in place and others are reallocated
+        if(level_update(level, keys[i], key_lens[i], keys[i], key_lens[i])){
+            printf("Update the value of the key %s: ERROR! \n", keys[i]);
+            exit(0);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    time_taken = (end_time.tv_sec - start_time.tv_sec) + (end_time.tv_nsec - start_time.tv_nsec) / 1e9;
+    ops = (double)insert_num / time_taken; 
+    printf("%ld items are updated ! takes %f sec, OPS %f \n", inserted ,time_taken ,ops);
+    printf("The arena holds %ld bytes, %ld bytes of them are dead\n", level->arena->size, level->arena->dead);
+
+    printf("The deletion test begins ...\n");
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    for (i = 1; i < insert_num + 1; i ++)
+    {
+        if(level_delete(level, keys[i], key_lens[i])){
+            printf("Delete the key %s: ERROR! \n", keys[i]);
+            exit(0);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    time_taken = (end_time.tv_sec - start_time.tv_sec) + (end_time.tv_nsec - start_time.tv_nsec) / 1e9;
+    ops = (double)insert_num / time_taken; 
+    printf("%ld items are deleted ! takes %f sec, OPS %f \n", inserted ,time_taken ,ops);
+
+    printf("The number of items stored in the level hash table: %ld\n", level->level_item_num[0]+level->level_item_num[1]);    
+    level_destroy(level);
+
+    // Free allocated memory
+    for (int i = 0; i < insert_num + 1; i++) {
+        free(keys[i]);
+        free(values[i]);
+    }
+    free(keys);
+    free(values);
+    free(key_lens);
+    free(value_lens);
+
+    return 0;
+}